@@ -208,14 +208,14 @@ ModernPosit::rotationMatrixToEuler
   double yaw, pitch, roll;
   if (fabs(1.0 - a10) <= DBL_EPSILON) // singularity at north pole / special case a10 == +1
   {
-    UPM_PRINT("Gimbal lock case a10 == " << a10);
+    UPM_LOG_RATE(upm::LogLevel::warning, 1, "Gimbal lock case a10 == " << a10);
     yaw   = atan2(a02,a22);
     pitch = M_PI_2;
     roll  = 0;
   }
   else if (fabs(-1.0 - a10) <= DBL_EPSILON) // singularity at south pole / special case a10 == -1
   {
-    UPM_PRINT("Gimbal lock case a10 == " << a10);
+    UPM_LOG_RATE(upm::LogLevel::warning, 1, "Gimbal lock case a10 == " << a10);
     yaw   = atan2(a02,a22);
     pitch = -M_PI_2;
     roll  = 0;
@@ -0,0 +1,135 @@
+/** ****************************************************************************
+ *  @file    AllocationTracker.hpp
+ *  @brief   Heap allocation counting for memory footprint instrumentation
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef ALLOCATION_TRACKER_HPP
+#define ALLOCATION_TRACKER_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <cstddef>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class AllocationStats
+ * @brief Allocations made inside a scope.
+ ******************************************************************************/
+struct AllocationStats
+{
+  AllocationStats() : allocations(0), bytes(0), peak_bytes(0) {};
+  unsigned long allocations;
+  unsigned long long bytes;
+  long long peak_bytes; // live bytes high-water mark above the level at scope entry
+};
+
+/** ****************************************************************************
+ * @class AllocationTracker
+ * @brief Process-wide counters of the global operator new/delete and of the
+ * cv::Mat buffers, which OpenCV allocates outside operator new. Only compiled
+ * in with the UPM_ALLOC_TRACKING CMake option, otherwise every counter stays
+ * at zero. Counters are shared by all threads, so concurrent pipelines are
+ * attributed to whichever scopes are open at the time.
+ ******************************************************************************/
+class AllocationTracker
+{
+public:
+  static constexpr bool
+  isEnabled()
+  {
+#ifdef UPM_ALLOC_TRACKING
+    return true;
+#else
+    return false;
+#endif
+  };
+
+  static void
+  recordAllocation
+    (
+    std::size_t bytes
+    );
+
+  static void
+  recordFree
+    (
+    std::size_t bytes
+    );
+
+  static unsigned long
+  getAllocations();
+
+  static unsigned long long
+  getBytes();
+
+  static long long
+  getLiveBytes();
+
+  static long long
+  getPeakBytes();
+
+  /// Start a new high-water mark at the current live bytes, returning the old one
+  static long long
+  resetPeakBytes();
+
+  /// Merge back a high-water mark returned by resetPeakBytes
+  static void
+  restorePeakBytes
+    (
+    long long peak
+    );
+};
+
+/** ****************************************************************************
+ * @class AllocationScope
+ * @brief Allocations since construction. Scopes nest: the enclosing one still
+ * sees the high-water mark reached inside the inner ones.
+ ******************************************************************************/
+class AllocationScope
+{
+public:
+  AllocationScope() : m_allocations(0), m_bytes(0), m_live(0), m_peak(0)
+  {
+    if (AllocationTracker::isEnabled())
+    {
+      m_allocations = AllocationTracker::getAllocations();
+      m_bytes = AllocationTracker::getBytes();
+      m_live = AllocationTracker::getLiveBytes();
+      m_peak = AllocationTracker::resetPeakBytes();
+    }
+  };
+
+  ~AllocationScope()
+  {
+    if (AllocationTracker::isEnabled())
+      AllocationTracker::restorePeakBytes(m_peak);
+  };
+
+  AllocationStats
+  getStats() const
+  {
+    AllocationStats stats;
+    if (AllocationTracker::isEnabled())
+    {
+      stats.allocations = AllocationTracker::getAllocations() - m_allocations;
+      stats.bytes = AllocationTracker::getBytes() - m_bytes;
+      stats.peak_bytes = AllocationTracker::getPeakBytes() - m_live;
+    }
+    return stats;
+  };
+
+private:
+  unsigned long m_allocations;
+  unsigned long long m_bytes;
+  long long m_live;
+  long long m_peak;
+};
+
+} // namespace upm
+
+#endif /* ALLOCATION_TRACKER_HPP */
@@ -0,0 +1,122 @@
+/** ****************************************************************************
+ *  @file    AttributeEvaluator.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef ATTRIBUTE_EVALUATOR_HPP
+#define ATTRIBUTE_EVALUATOR_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/// FaceAttribute fields as matrix columns, age is the only regressed one
+enum AttributeLabel { male_attribute, age_attribute, glasses_attribute, hat_attribute, moustache_attribute, beard_attribute, fake_attribute };
+const unsigned int NUM_ATTRIBUTES = 7;
+static const char *const ATTRIBUTE_NAMES[NUM_ATTRIBUTES] = {"male", "age", "glasses", "hat", "moustache", "beard", "fake"};
+
+void
+attributeToRow
+  (
+  const FaceAttribute &attribute,
+  float *row
+  );
+
+void
+rowToAttribute
+  (
+  const float *row,
+  FaceAttribute &attribute
+  );
+
+/// False for the all-zero default of annotations without attribute labels
+bool
+isAttributeAnnotated
+  (
+  const FaceAttribute &attribute
+  );
+
+/** ****************************************************************************
+ * @class AttributeEvaluator
+ * @brief Accumulates estimated and annotated attributes as N x NUM_ATTRIBUTES
+ * matrices and scores whole columns with OpenCV vectorised operations: the
+ * accuracy of every binary attribute at a decision threshold and the mean
+ * absolute error of the age. Annotations without any attribute label are
+ * left out of the accuracies, and those without age (zero or negative) out of
+ * the age error.
+ ******************************************************************************/
+class AttributeEvaluator
+{
+public:
+  AttributeEvaluator
+    (
+    float threshold = 0.5f
+    ) : m_threshold(threshold) {};
+
+  ~AttributeEvaluator() {};
+
+  void
+  addFace
+    (
+    const FaceAttribute &face,
+    const FaceAttribute &ann
+    );
+
+  /// Rows of NUM_ATTRIBUTES CV_32F values, one per face
+  void
+  addBatch
+    (
+    const cv::Mat &faces,
+    const cv::Mat &anns
+    );
+
+  void
+  merge
+    (
+    const AttributeEvaluator &evaluator
+    );
+
+  void
+  clear();
+
+  /// Fraction of annotated faces on the same side of the threshold as their
+  /// annotation
+  float
+  getAccuracy
+    (
+    AttributeLabel label
+    ) const;
+
+  float
+  getAgeError() const;
+
+  unsigned int
+  getNumFaces() const { return static_cast<unsigned int>(m_faces.rows); };
+
+private:
+  float m_threshold;
+  cv::Mat m_faces;
+  cv::Mat m_anns;
+};
+
+/// Writes the accuracy of every binary attribute and the age MAE as key=value lines
+void
+reportAttributes
+  (
+  const AttributeEvaluator &evaluator,
+  std::ostream &output
+  );
+
+} // namespace upm
+
+#endif /* ATTRIBUTE_EVALUATOR_HPP */
@@ -0,0 +1,188 @@
+/** ****************************************************************************
+ *  @file    ComponentProfiler.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef COMPONENT_PROFILER_HPP
+#define COMPONENT_PROFILER_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <AllocationTracker.hpp>
+#include <PerfCounters.hpp>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <climits>
+#include <ostream>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+enum class ProfiledOperation { process, evaluate, show, save };
+const unsigned int NUM_PROFILED_OPERATIONS = 4;
+
+/** ****************************************************************************
+ * @class LatencyHistogram
+ * @brief Log-scale histogram with 8 bins per octave from 100 ns, so percentiles
+ * are accurate to ~9% whatever the latency range, in constant memory.
+ ******************************************************************************/
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  ~LatencyHistogram() {};
+
+  void
+  add
+    (
+    double seconds
+    );
+
+  void
+  merge
+    (
+    const LatencyHistogram &histogram
+    );
+
+  /// Latency in seconds below which lie 'percentile' (0-100) of the samples
+  double
+  getPercentile
+    (
+    double percentile
+    ) const;
+
+  unsigned long
+  getCount() const { return m_count; };
+
+  double
+  getMean() const { return (m_count > 0) ? m_sum/m_count : 0.0; };
+
+  double
+  getMax() const { return m_max; };
+
+private:
+  std::vector<unsigned long> m_bins;
+  unsigned long m_count;
+  double m_sum, m_min, m_max;
+};
+
+/** ****************************************************************************
+ * @class ComponentStats
+ * @brief Statistics of one operation of one component.
+ ******************************************************************************/
+struct ComponentStats
+{
+  ComponentStats() : calls(0), faces(0), allocations(0), bytes(0), peak_bytes(0), counted_calls(0), counters() {};
+  unsigned long calls;
+  unsigned long faces; // output faces, to report faces per call
+  LatencyHistogram latency;
+  unsigned long allocations; // only counted with UPM_ALLOC_TRACKING
+  unsigned long long bytes;
+  long long peak_bytes; // largest high-water mark of a single call
+  unsigned long counted_calls; // calls with valid hardware counters (UPM_PERF_COUNTERS)
+  unsigned long long counters[NUM_PERF_COUNTERS];
+};
+
+/** ****************************************************************************
+ * @class ComponentProfiler
+ * @brief Aggregates per-component latency of the calls made by a FaceComposite.
+ * Thread-safe, so it can be queried at runtime while the pipeline runs.
+ ******************************************************************************/
+class ComponentProfiler
+{
+public:
+  /// Index recording the whole frame instead of a single component
+  static const unsigned int FRAME = UINT_MAX;
+
+  ComponentProfiler() : m_frame(NUM_PROFILED_OPERATIONS) {};
+
+  ~ComponentProfiler() {};
+
+  /// Register a component and return the index used to record its calls
+  unsigned int
+  addComponent
+    (
+    const std::string &name
+    );
+
+  void
+  record
+    (
+    unsigned int component_idx,
+    ProfiledOperation operation,
+    double seconds,
+    unsigned int num_faces,
+    const AllocationStats &allocs = AllocationStats(),
+    const PerfCounterValues &counters = PerfCounterValues()
+    );
+
+  ComponentStats
+  getStats
+    (
+    unsigned int component_idx,
+    ProfiledOperation operation
+    ) const;
+
+  unsigned int
+  getNumComponents() const;
+
+  void
+  report
+    (
+    std::ostream &output,
+    const std::string &prefix = ""
+    ) const;
+
+  void
+  clear();
+
+private:
+  mutable std::mutex m_mutex;
+  std::vector<std::string> m_names;
+  std::vector< std::vector<ComponentStats> > m_stats;
+  std::vector<ComponentStats> m_frame;
+};
+
+/** ****************************************************************************
+ * @class ProfilerScope
+ * @brief Times the enclosing scope and records it on destruction together with
+ * the number of faces left in the vector at that point, its allocations and
+ * its hardware counters.
+ ******************************************************************************/
+class ProfilerScope
+{
+public:
+  ProfilerScope
+    (
+    ComponentProfiler &profiler,
+    unsigned int component_idx,
+    ProfiledOperation operation,
+    const std::vector<FaceAnnotation> &faces
+    ) : m_profiler(profiler), m_component_idx(component_idx), m_operation(operation), m_faces(faces), m_ticks(cv::getTickCount()) {};
+
+  ~ProfilerScope()
+  {
+    const double seconds = static_cast<double>(cv::getTickCount()-m_ticks) / cv::getTickFrequency();
+    m_profiler.record(m_component_idx, m_operation, seconds, static_cast<unsigned int>(m_faces.size()), m_allocs.getStats(), m_counters.getValues());
+  };
+
+private:
+  ComponentProfiler &m_profiler;
+  unsigned int m_component_idx;
+  ProfiledOperation m_operation;
+  const std::vector<FaceAnnotation> &m_faces;
+  cv::int64 m_ticks;
+  AllocationScope m_allocs;
+  PerfScope m_counters;
+};
+
+} // namespace upm
+
+#endif /* COMPONENT_PROFILER_HPP */
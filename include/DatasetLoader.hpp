@@ -0,0 +1,96 @@
+/** ****************************************************************************
+ *  @file    DatasetLoader.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef DATASET_LOADER_HPP
+#define DATASET_LOADER_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <string>
+#include <vector>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @brief Loaders of the annotated databases selected with --database. Each
+ * annotation file (or WFLW list line) is parsed on its own OpenCV thread into
+ * a FaceAnnotation with the landmarks grouped by part in schema order. The
+ * parsed database can be kept in a versioned binary cache, validated by a
+ * fingerprint of the database name and the path, size and modification time
+ * of every annotation file, and memory-mapped and decoded in parallel on the
+ * next run.
+ *
+ * Supported layouts under the database path, searched recursively:
+ *   300w_public, 300w_private, ls3dw, 300wlp, menpo: 68 point .pts files
+ *     next to a .jpg or .png image with the same stem. Menpo profile faces
+ *     (39 points) are skipped.
+ *   wflw: list_98pt*.txt files, one face per line, images under WFLW_images.
+ *   all: every layout above.
+ ******************************************************************************/
+
+/// Reads a 68 point .pts file, the box is the bounding rectangle of the points
+bool
+parsePtsFile
+  (
+  const std::string &filepath,
+  upm::FaceAnnotation &ann
+  );
+
+/// Reads one WFLW line: 98 points, x_min y_min x_max y_max, 6 flags and the image
+bool
+parseWflwLine
+  (
+  const char *begin,
+  const char *end,
+  const std::string &images_path,
+  upm::FaceAnnotation &ann
+  );
+
+/// Parses every annotation of 'database' under 'path', in file name order
+bool
+loadDatabase
+  (
+  const std::string &database,
+  const std::string &path,
+  std::vector<upm::FaceAnnotation> &anns
+  );
+
+/// Same as above but reads 'cache_path' when it is up to date and rewrites it
+/// otherwise. An empty 'cache_path' disables the cache.
+bool
+loadDatabase
+  (
+  const std::string &database,
+  const std::string &path,
+  const std::string &cache_path,
+  std::vector<upm::FaceAnnotation> &anns
+  );
+
+bool
+writeAnnotationCache
+  (
+  const std::string &cache_path,
+  unsigned long long fingerprint,
+  const std::vector<upm::FaceAnnotation> &anns
+  );
+
+/// Fails without touching 'anns' if the file is missing, from another version
+/// or built from different annotation files
+bool
+readAnnotationCache
+  (
+  const std::string &cache_path,
+  unsigned long long fingerprint,
+  std::vector<upm::FaceAnnotation> &anns
+  );
+
+} // namespace upm
+
+#endif /* DATASET_LOADER_HPP */
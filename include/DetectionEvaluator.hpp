@@ -0,0 +1,124 @@
+/** ****************************************************************************
+ *  @file    DetectionEvaluator.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef DETECTION_EVALUATOR_HPP
+#define DETECTION_EVALUATOR_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <vector>
+#include <ostream>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/// FDDB scores: discrete counts matched faces, continuous sums their overlap
+enum class RocType { discrete, continuous };
+
+/** ****************************************************************************
+ * @class DetectionEvaluator
+ * @brief Matches detections against every ground-truth face of each image and
+ * accumulates the results to compute precision/recall, AP and ROC curves over
+ * a whole dataset. Independent evaluators can be filled on parallel shards
+ * and merged afterwards.
+ ******************************************************************************/
+class DetectionEvaluator
+{
+public:
+  DetectionEvaluator
+    (
+    float iou_threshold = 0.5f
+    ) : m_iou_threshold(iou_threshold), m_num_images(0), m_num_annotations(0) {};
+
+  ~DetectionEvaluator() {};
+
+  void
+  addImage
+    (
+    const std::vector<FaceAnnotation> &faces,
+    const std::vector<FaceAnnotation> &anns
+    );
+
+  void
+  merge
+    (
+    const DetectionEvaluator &evaluator
+    );
+
+  void
+  clear();
+
+  void
+  getPrecisionRecall
+    (
+    std::vector<float> &precision,
+    std::vector<float> &recall,
+    std::vector<float> &thresholds
+    ) const;
+
+  float
+  getAveragePrecision() const;
+
+  void
+  getRoc
+    (
+    RocType type,
+    std::vector<float> &false_positives,
+    std::vector<float> &true_positives,
+    std::vector<float> &thresholds
+    ) const;
+
+  unsigned int
+  getNumImages() const { return m_num_images; };
+
+  unsigned int
+  getNumAnnotations() const { return m_num_annotations; };
+
+  /// Evaluate a whole dataset splitting its images in 'num_shards' parallel evaluators
+  static DetectionEvaluator
+  evaluate
+    (
+    const std::vector< std::vector<FaceAnnotation> > &faces,
+    const std::vector< std::vector<FaceAnnotation> > &anns,
+    float iou_threshold,
+    unsigned int num_shards
+    );
+
+private:
+  struct Detection
+  {
+    float score;
+    float iou; // overlap with the matched annotation, zero for false positives
+  };
+
+  void
+  sortDetections
+    (
+    std::vector<Detection> &detections
+    ) const;
+
+  float m_iou_threshold;
+  unsigned int m_num_images;
+  unsigned int m_num_annotations;
+  std::vector<Detection> m_detections;
+};
+
+/// Writes the AP and the discrete and continuous ROC true positive rates at
+/// the usual false positive counts as key=value lines
+void
+reportDetection
+  (
+  const DetectionEvaluator &evaluator,
+  std::ostream &output
+  );
+
+} // namespace upm
+
+#endif /* DETECTION_EVALUATOR_HPP */
@@ -0,0 +1,122 @@
+/** ****************************************************************************
+ *  @file    DetectionUtils.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef DETECTION_UTILS_HPP
+#define DETECTION_UTILS_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+enum class SoftNmsMethod { linear, gaussian };
+
+/** ****************************************************************************
+ * @class BoxArray
+ * @brief Structure of arrays with the corners of a set of bounding boxes. The
+ * arrays are padded with empty boxes up to a whole SIMD register past the last
+ * box, so overlap kernels never need a scalar tail.
+ ******************************************************************************/
+class BoxArray
+{
+public:
+  BoxArray() : m_size(0) {};
+
+  ~BoxArray() {};
+
+  void
+  assign
+    (
+    const std::vector<cv::Rect_<float>> &boxes
+    );
+
+  void
+  assign
+    (
+    const std::vector<FaceAnnotation> &faces
+    );
+
+  void
+  set
+    (
+    unsigned int idx,
+    const cv::Rect_<float> &box
+    );
+
+  /// Intersection over union between 'box' and boxes [begin, end) of this array.
+  /// The output buffer must hold (end-begin) rounded up to a multiple of 4 values
+  void
+  overlap
+    (
+    const cv::Rect_<float> &box,
+    unsigned int begin,
+    unsigned int end,
+    float *iou
+    ) const;
+
+  unsigned int
+  size() const { return m_size; };
+
+  std::vector<float> x1, y1, x2, y2, area;
+
+private:
+  void
+  resize
+    (
+    unsigned int num_boxes
+    );
+
+  unsigned int m_size;
+};
+
+float
+computeIoU
+  (
+  const cv::Rect_<float> &r1,
+  const cv::Rect_<float> &r2
+  );
+
+void
+computeIoU
+  (
+  const std::vector<FaceAnnotation> &faces1,
+  const std::vector<FaceAnnotation> &faces2,
+  cv::Mat &iou
+  );
+
+void
+nonMaximumSuppression
+  (
+  std::vector<FaceAnnotation> &faces,
+  float iou_threshold
+  );
+
+void
+softNonMaximumSuppression
+  (
+  std::vector<FaceAnnotation> &faces,
+  SoftNmsMethod method,
+  float iou_threshold,
+  float sigma,
+  float score_threshold
+  );
+
+void
+fuseDetections
+  (
+  std::vector<FaceAnnotation> &faces,
+  float iou_threshold
+  );
+
+} // namespace upm
+
+#endif /* DETECTION_UTILS_HPP */
@@ -0,0 +1,272 @@
+/** ****************************************************************************
+ *  @file    EmbeddingCodec.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef EMBEDDING_CODEC_HPP
+#define EMBEDDING_CODEC_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceGallery.hpp>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class EmbeddingCodec
+ * @brief Compact codes for gallery embeddings. Distances between a float
+ * query and the codes are asymmetric: the query is never quantized, a lookup
+ * table prepared once per query makes every code distance cheap.
+ ******************************************************************************/
+class EmbeddingCodec
+{
+public:
+  virtual
+  ~EmbeddingCodec() {};
+
+  /// Rows of 'samples' are padded embeddings as stored by the gallery
+  virtual bool
+  train
+    (
+    const cv::Mat &samples,
+    GalleryMetric metric
+    ) = 0;
+
+  /// Bytes per code
+  virtual unsigned int
+  getCodeSize() const = 0;
+
+  virtual void
+  encode
+    (
+    const float *embedding,
+    unsigned char *code
+    ) const = 0;
+
+  virtual void
+  decode
+    (
+    const unsigned char *code,
+    float *embedding
+    ) const = 0;
+
+  virtual void
+  prepare
+    (
+    const float *query,
+    std::vector<float> &table
+    ) const = 0;
+
+  /// Distances from the prepared query to 'num_codes' codes 'stride' bytes apart
+  virtual void
+  distances
+    (
+    const float *table,
+    const unsigned char *codes,
+    unsigned int num_codes,
+    size_t stride,
+    float *output
+    ) const = 0;
+
+  virtual std::string
+  getName() const = 0;
+
+  /// Trained parameters, tagged with the codec type
+  virtual void
+  serialize
+    (
+    std::vector<unsigned char> &buffer
+    ) const = 0;
+
+  /// Codec of the type tagged in 'data', null if it cannot be restored
+  static boost::shared_ptr<EmbeddingCodec>
+  deserialize
+    (
+    const unsigned char *data,
+    size_t size
+    );
+
+protected:
+  virtual bool
+  restore
+    (
+    const unsigned char *data,
+    size_t size
+    ) = 0;
+};
+
+/** ****************************************************************************
+ * @class ScalarQuantizer
+ * @brief One signed byte per dimension over the per-dimension range of the
+ * training samples, 4x smaller than floats. Codes are expanded to floats in
+ * SIMD registers, so scanning costs about the same as the float kernels with a
+ * quarter of the memory traffic.
+ ******************************************************************************/
+class ScalarQuantizer : public EmbeddingCodec
+{
+public:
+  ScalarQuantizer() : m_dimension(0), m_metric(GalleryMetric::cosine) {};
+
+  ~ScalarQuantizer() {};
+
+  bool
+  train
+    (
+    const cv::Mat &samples,
+    GalleryMetric metric
+    );
+
+  unsigned int
+  getCodeSize() const { return m_dimension; };
+
+  void
+  encode
+    (
+    const float *embedding,
+    unsigned char *code
+    ) const;
+
+  void
+  decode
+    (
+    const unsigned char *code,
+    float *embedding
+    ) const;
+
+  void
+  prepare
+    (
+    const float *query,
+    std::vector<float> &table
+    ) const;
+
+  void
+  distances
+    (
+    const float *table,
+    const unsigned char *codes,
+    unsigned int num_codes,
+    size_t stride,
+    float *output
+    ) const;
+
+  std::string
+  getName() const { return "int8"; };
+
+  void
+  serialize
+    (
+    std::vector<unsigned char> &buffer
+    ) const;
+
+protected:
+  bool
+  restore
+    (
+    const unsigned char *data,
+    size_t size
+    );
+
+private:
+  unsigned int m_dimension;
+  GalleryMetric m_metric;
+  std::vector<float> m_center;
+  std::vector<float> m_scale;
+};
+
+/** ****************************************************************************
+ * @class ProductQuantizer
+ * @brief The embedding is split into 'num_subspaces' chunks, each replaced by
+ * the index of its closest k-means centroid (Jegou et al., 2011). A 128-D
+ * embedding with 16 subspaces takes 16 bytes instead of 512. The distance to a
+ * code is the sum of one table entry per subspace.
+ ******************************************************************************/
+class ProductQuantizer : public EmbeddingCodec
+{
+public:
+  ProductQuantizer
+    (
+    unsigned int num_subspaces,
+    unsigned int num_centroids = 256
+    );
+
+  ~ProductQuantizer() {};
+
+  bool
+  train
+    (
+    const cv::Mat &samples,
+    GalleryMetric metric
+    );
+
+  unsigned int
+  getCodeSize() const { return m_num_subspaces; };
+
+  void
+  encode
+    (
+    const float *embedding,
+    unsigned char *code
+    ) const;
+
+  void
+  decode
+    (
+    const unsigned char *code,
+    float *embedding
+    ) const;
+
+  void
+  prepare
+    (
+    const float *query,
+    std::vector<float> &table
+    ) const;
+
+  void
+  distances
+    (
+    const float *table,
+    const unsigned char *codes,
+    unsigned int num_codes,
+    size_t stride,
+    float *output
+    ) const;
+
+  std::string
+  getName() const { return "pq" + std::to_string(m_num_subspaces) + "x" + std::to_string(m_num_centroids); };
+
+  void
+  serialize
+    (
+    std::vector<unsigned char> &buffer
+    ) const;
+
+protected:
+  bool
+  restore
+    (
+    const unsigned char *data,
+    size_t size
+    );
+
+private:
+  unsigned int m_num_subspaces;
+  unsigned int m_num_centroids;
+  unsigned int m_subspace_dim;
+  GalleryMetric m_metric;
+  /// Centroids of subspace j are rows [j*num_centroids, (j+1)*num_centroids)
+  cv::Mat m_centroids;
+};
+
+} // namespace upm
+
+#endif /* EMBEDDING_CODEC_HPP */
@@ -80,12 +80,22 @@ public:
   save
     (
     const std::string dirpath,
+    cv::Mat frame,
     const std::vector<FaceAnnotation> &faces,
     const FaceAnnotation &ann
     );
 
+  /// Parses _database under _annotations_path through _annotations_cache
+  bool
+  loadAnnotations
+    (
+    std::vector<FaceAnnotation> &anns
+    ) const;
+
   ErrorMeasure _measure;
   std::string _database;
+  std::string _annotations_path;
+  std::string _annotations_cache;
 };
 
 } // namespace upm
@@ -0,0 +1,143 @@
+/** ****************************************************************************
+ *  @file    FaceAnnotationCodec.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef FACE_ANNOTATION_CODEC_HPP
+#define FACE_ANNOTATION_CODEC_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <vector>
+#include <cstddef>
+#include <boost/archive/archive_exception.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/throw_exception.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/serialization/split_free.hpp>
+
+namespace upm {
+
+/// Increase whenever the record layout changes
+const unsigned int ANNOTATION_CODEC_VERSION = 1;
+
+/** ****************************************************************************
+ * @brief Compact little-endian binary encoding of FaceAnnotation, the same
+ * bytes on every host. A record holds the filename, the box, the head pose,
+ * the attributes and the parts with their landmarks (16 bit feature ids,
+ * float positions and occlusion). Records are written by plain functions
+ * into buffers sized beforehand, no per-field dispatch.
+ *
+ * Annotation vectors are encoded as a block: magic, codec version, count and
+ * a table of record offsets, so the records are encoded and decoded in
+ * parallel and a reader can jump to any of them.
+ ******************************************************************************/
+
+/// Bytes of the record of 'ann', 0 if it cannot be encoded (feature ids or
+/// landmark counts above 16 bits)
+size_t
+getEncodedSize
+  (
+  const upm::FaceAnnotation &ann
+  );
+
+/// Appends the record of 'ann' to 'buffer'
+bool
+encodeAnnotation
+  (
+  const upm::FaceAnnotation &ann,
+  std::vector<unsigned char> &buffer
+  );
+
+/// Reads one record, advancing 'data' and decreasing 'size' past it
+bool
+decodeAnnotation
+  (
+  const unsigned char *&data,
+  size_t &size,
+  upm::FaceAnnotation &ann
+  );
+
+/// Appends a block with every annotation of 'anns' to 'buffer'
+bool
+encodeAnnotations
+  (
+  const std::vector<upm::FaceAnnotation> &anns,
+  std::vector<unsigned char> &buffer
+  );
+
+/// Decodes a whole block, 'anns' is untouched if the block is corrupt or
+/// written by another codec version
+bool
+decodeAnnotations
+  (
+  const unsigned char *data,
+  size_t size,
+  std::vector<upm::FaceAnnotation> &anns
+  );
+
+} // namespace upm
+
+// Boost.Serialization adapter: the archive stores the binary record, so text,
+// XML and binary archives all carry the same fields. Records that cannot be
+// encoded or decoded, or of another codec version, throw archive_exception
+namespace boost {
+namespace serialization {
+
+template<class Archive>
+void
+save
+  (
+  Archive &ar,
+  const upm::FaceAnnotation &ann,
+  const unsigned int version
+  )
+{
+  std::vector<unsigned char> record;
+  if (not upm::encodeAnnotation(ann, record))
+    boost::serialization::throw_exception(boost::archive::archive_exception(boost::archive::archive_exception::output_stream_error));
+  ar & record;
+};
+
+template<class Archive>
+void
+load
+  (
+  Archive &ar,
+  upm::FaceAnnotation &ann,
+  const unsigned int version
+  )
+{
+  if (version != upm::ANNOTATION_CODEC_VERSION)
+    boost::serialization::throw_exception(boost::archive::archive_exception(boost::archive::archive_exception::unsupported_class_version));
+  std::vector<unsigned char> record;
+  ar & record;
+  const unsigned char *data = record.data();
+  size_t size = record.size();
+  if ((not upm::decodeAnnotation(data, size, ann)) or (size != 0))
+    boost::serialization::throw_exception(boost::archive::archive_exception(boost::archive::archive_exception::input_stream_error));
+};
+
+template<class Archive>
+void
+serialize
+  (
+  Archive &ar,
+  upm::FaceAnnotation &ann,
+  const unsigned int version
+  )
+{
+  boost::serialization::split_free(ar, ann, version);
+};
+
+} // namespace serialization
+} // namespace boost
+
+BOOST_CLASS_VERSION(upm::FaceAnnotation, upm::ANNOTATION_CODEC_VERSION)
+
+#endif /* FACE_ANNOTATION_CODEC_HPP */
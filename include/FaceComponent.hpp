@@ -14,6 +14,7 @@
 // ----------------------- INCLUDES --------------------------------------------
 #include <Viewer.hpp>
 #include <FaceAnnotation.hpp>
+#include <FrameCache.hpp>
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <opencv2/opencv.hpp>
@@ -30,7 +31,7 @@ public:
   FaceComponent
     (
     unsigned int part
-    ) : m_part(part) {};
+    ) : m_part(part), m_cache(new FrameCache()) {};
 
   virtual
   ~FaceComponent() {};
@@ -80,6 +81,7 @@ public:
   save
     (
     const std::string dirpath,
+    cv::Mat frame,
     const std::vector<upm::FaceAnnotation> &faces,
     const upm::FaceAnnotation &ann
     ) = 0;
@@ -87,8 +89,20 @@ public:
   unsigned int
   getComponentClass() { return m_part; };
 
+  /// Components sharing a cache reuse the images derived from the current frame.
+  /// FaceComposite resets it on every frame, standalone users must call reset()
+  virtual void
+  setFrameCache
+    (
+    const boost::shared_ptr<upm::FrameCache> &cache
+    ) { m_cache = cache; };
+
+  boost::shared_ptr<upm::FrameCache>
+  getFrameCache() { return m_cache; };
+
 private:
-  unsigned int m_part; // 1-FaceDetector, 2-FaceHeadPose, 3-FaceAlignment
+  unsigned int m_part; // 1-FaceDetector, 2-FaceHeadPose, 3-FaceAlignment, 4-FaceRecognition, 5-FaceQualityGate
+  boost::shared_ptr<upm::FrameCache> m_cache;
 };
 
 } // namespace upm
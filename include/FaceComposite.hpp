@@ -12,10 +12,14 @@
 #define FACE_COMPOSITE_HPP
 
 // ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
 #include <Viewer.hpp>
 #include <FaceComponent.hpp>
+#include <FaceQualityGate.hpp>
+#include <ComponentProfiler.hpp>
 #include <FaceAnnotation.hpp>
 #include <vector>
+#include <sstream>
 #include <boost/shared_ptr.hpp>
 #include <opencv2/opencv.hpp>
 
@@ -28,9 +32,17 @@ namespace upm {
 class FaceComposite : public FaceComponent
 {
 public:
-  FaceComposite() : FaceComponent(0) {};
+  FaceComposite() : FaceComponent(0), m_nested(false) {};
 
-  ~FaceComposite() {};
+  ~FaceComposite()
+  {
+    if ((not m_nested) and (m_profiler.getNumComponents() > 0))
+    {
+      std::ostringstream outs;
+      report(outs);
+      UPM_PRINT("FaceComposite profile:" << std::endl << outs.str());
+    }
+  };
 
   void
   parseOptions
@@ -69,8 +81,27 @@ public:
     const upm::FaceAnnotation &ann
     )
   {
+    ProfilerScope frame_scope(m_profiler, ComponentProfiler::FRAME, ProfiledOperation::process, faces);
+    m_frame = frame;
+    if (not m_nested)
+      getFrameCache()->reset(frame);
+    // Components after a quality gate only see the faces it accepted
+    m_active_gates.clear();
     for (unsigned int i=0; i < m_components.size(); i++)
-      m_components[i]->process(frame, faces, ann);
+    {
+      {
+        UPM_TRACE_SCOPE(getTraceName(m_components[i]->getComponentClass()));
+        ProfilerScope scope(m_profiler, i, ProfiledOperation::process, faces);
+        m_components[i]->process(frame, faces, ann);
+      }
+      if (m_gates[i])
+      {
+        m_gates[i]->removeRejected(faces);
+        m_active_gates.push_back(m_gates[i]);
+      }
+    }
+    for (std::vector<FaceQualityGate*>::reverse_iterator it=m_active_gates.rbegin(); it != m_active_gates.rend(); ++it)
+      (*it)->restoreRejected(faces);
   };
 
   void
@@ -81,8 +112,16 @@ public:
     const upm::FaceAnnotation &ann
     )
   {
+    std::vector<upm::FaceAnnotation> accepted;
+    const std::vector<upm::FaceAnnotation> *visible = &faces;
     for (unsigned int i=0; i < m_components.size(); i++)
-      m_components[i]->show(viewer, faces, ann);
+    {
+      {
+        ProfilerScope scope(m_profiler, i, ProfiledOperation::show, *visible);
+        m_components[i]->show(viewer, *visible, ann);
+      }
+      visible = getAccepted(i, *visible, accepted);
+    }
   };
 
   void
@@ -93,20 +132,59 @@ public:
     const upm::FaceAnnotation &ann
     )
   {
+    std::vector<upm::FaceAnnotation> accepted;
+    const std::vector<upm::FaceAnnotation> *visible = &faces;
     for (unsigned int i=0; i < m_components.size(); i++)
-      m_components[i]->evaluate(output, faces, ann);
+    {
+      {
+        ProfilerScope scope(m_profiler, i, ProfiledOperation::evaluate, *visible);
+        m_components[i]->evaluate(output, *visible, ann);
+      }
+      visible = getAccepted(i, *visible, accepted);
+    }
   };
 
   void
   save
     (
     const std::string dirpath,
+    cv::Mat frame,
     const std::vector<upm::FaceAnnotation> &faces,
     const upm::FaceAnnotation &ann
     )
   {
+    std::vector<upm::FaceAnnotation> accepted;
+    const std::vector<upm::FaceAnnotation> *visible = &faces;
     for (unsigned int i=0; i < m_components.size(); i++)
-      m_components[i]->save(dirpath, faces, ann);
+    {
+      {
+        ProfilerScope scope(m_profiler, i, ProfiledOperation::save, *visible);
+        m_components[i]->save(dirpath, frame, *visible, ann);
+      }
+      visible = getAccepted(i, *visible, accepted);
+    }
+  };
+
+  /// Save results over the last processed frame, avoiding to decode it again
+  void
+  save
+    (
+    const std::string dirpath,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    )
+  {
+    save(dirpath, m_frame, faces, ann);
+  };
+
+  /// Drops the references to the last processed frame, e.g. before handing
+  /// its buffer back to an ImageLoader. save() without a frame needs it.
+  void
+  releaseFrame()
+  {
+    m_frame = cv::Mat();
+    if (not m_nested)
+      getFrameCache()->reset(cv::Mat());
   };
 
   void
@@ -115,7 +193,27 @@ public:
     boost::shared_ptr<upm::FaceComponent> component
     )
   {
+    const char *names[] = {"FaceComposite", "FaceDetector", "FaceHeadPose", "FaceAlignment", "FaceRecognition", "FaceQualityGate"};
+    const unsigned int part = component->getComponentClass();
+    m_profiler.addComponent(std::to_string(m_components.size()) + ":" + ((part < 6) ? names[part] : "FaceComponent"));
+    /// Nested composites are reported by their parent and use its frame cache
+    FaceComposite *composite = dynamic_cast<FaceComposite*>(component.get());
+    if (composite)
+      composite->m_nested = true;
+    component->setFrameCache(getFrameCache());
     m_components.push_back(component);
+    m_gates.push_back(dynamic_cast<FaceQualityGate*>(component.get()));
+  };
+
+  void
+  setFrameCache
+    (
+    const boost::shared_ptr<upm::FrameCache> &cache
+    )
+  {
+    FaceComponent::setFrameCache(cache);
+    for (unsigned int i=0; i < m_components.size(); i++)
+      m_components[i]->setFrameCache(cache);
   };
 
   bool
@@ -130,8 +228,82 @@ public:
     return false;
   };
 
+  /// Faces of the output of the last frame processed by component 'i', the
+  /// ones a quality gate before it accepted, e.g. to follow the rows of the
+  /// FaceRecognition embeddings
+  void
+  getProcessedFaces
+    (
+    unsigned int i,
+    const std::vector<upm::FaceAnnotation> &faces,
+    std::vector<upm::FaceAnnotation> &processed
+    ) const
+  {
+    std::vector<upm::FaceAnnotation> accepted;
+    const std::vector<upm::FaceAnnotation> *visible = &faces;
+    for (unsigned int j=0; j < std::min(i, static_cast<unsigned int>(m_components.size())); j++)
+      visible = getAccepted(j, *visible, accepted);
+    processed = *visible;
+  };
+
+  const ComponentProfiler &
+  getProfiler() const { return m_profiler; };
+
+  /// Per-component statistics and quality gate skip counts, nested composites
+  /// below their parent entry
+  void
+  report
+    (
+    std::ostream &output,
+    const std::string &prefix = ""
+    ) const
+  {
+    m_profiler.report(output, prefix);
+    for (unsigned int i=0; i < m_components.size(); i++)
+    {
+      if (m_gates[i])
+        m_gates[i]->report(output, prefix + std::to_string(i) + ":FaceQualityGate ");
+      const FaceComposite *composite = dynamic_cast<const FaceComposite*>(m_components[i].get());
+      if (composite)
+        composite->report(output, prefix + std::to_string(i) + "/");
+    }
+  };
+
 private:
+  /// Faces seen by the components after component 'i', 'accepted' holds them
+  /// when 'i' is a quality gate
+  const std::vector<upm::FaceAnnotation> *
+  getAccepted
+    (
+    unsigned int i,
+    const std::vector<upm::FaceAnnotation> &faces,
+    std::vector<upm::FaceAnnotation> &accepted
+    ) const
+  {
+    if (not m_gates[i])
+      return &faces;
+    if (&faces != &accepted)
+      accepted = faces;
+    m_gates[i]->keepAccepted(accepted);
+    return &accepted;
+  };
+
+  static const char *
+  getTraceName
+    (
+    unsigned int part
+    )
+  {
+    const char *names[] = {"FaceComposite::process", "FaceDetector::process", "FaceHeadPose::process", "FaceAlignment::process", "FaceRecognition::process", "FaceQualityGate::process"};
+    return (part < 6) ? names[part] : "FaceComponent::process";
+  };
+
   std::vector< boost::shared_ptr<upm::FaceComponent> > m_components;
+  std::vector<FaceQualityGate*> m_gates; // null for components that are not gates
+  std::vector<FaceQualityGate*> m_active_gates;
+  ComponentProfiler m_profiler;
+  bool m_nested; // added to another composite
+  cv::Mat m_frame; // shallow reference to the last processed frame
 };
 
 } // namespace upm
@@ -0,0 +1,94 @@
+/** ****************************************************************************
+ *  @file    FaceCropBatch.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef FACE_CROP_BATCH_HPP
+#define FACE_CROP_BATCH_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class FaceCropBatch
+ * @brief Extracts the enlarged square region around every face of a frame into
+ * one contiguous N x C x H x W CV_32F blob (the cv::dnn layout) with values in
+ * [0,1], warping the faces in parallel. The buffer only grows, so a batch
+ * reused across frames stops allocating once it has seen the largest crowd.
+ ******************************************************************************/
+class FaceCropBatch
+{
+public:
+  FaceCropBatch
+    (
+    const cv::Size &size,
+    float bbox_scale = 0.3f,
+    bool gray = false
+    ) : m_size(size), m_bbox_scale(bbox_scale), m_channels(gray ? 1 : 3), m_num_faces(0), m_capacity(0) {};
+
+  ~FaceCropBatch() {};
+
+  void
+  extract
+    (
+    cv::Mat frame,
+    const std::vector<FaceAnnotation> &faces
+    );
+
+  /// Adds the faces of another frame after the current patches, so faces of
+  /// several frames can be processed in one batch
+  void
+  append
+    (
+    cv::Mat frame,
+    const std::vector<FaceAnnotation> &faces
+    );
+
+  /// Drops the patches keeping the buffer
+  void
+  clear() { m_num_faces = 0; };
+
+  /// Header over the first 'size()' patches of the buffer
+  cv::Mat
+  getBlob() const;
+
+  /// Plane 'channel' of patch 'idx' as a H x W CV_32F header into the blob
+  cv::Mat
+  getPatch
+    (
+    unsigned int idx,
+    unsigned int channel = 0
+    ) const;
+
+  /// Affine 2x3 CV_64F transformation from frame to patch coordinates
+  const cv::Mat &
+  getTransform
+    (
+    unsigned int idx
+    ) const { return m_transforms[idx]; };
+
+  unsigned int
+  size() const { return m_num_faces; };
+
+private:
+  cv::Size m_size;
+  float m_bbox_scale;
+  int m_channels;
+  unsigned int m_num_faces;
+  unsigned int m_capacity;
+  cv::Mat m_buffer;
+  std::vector<cv::Mat> m_transforms;
+};
+
+} // namespace upm
+
+#endif /* FACE_CROP_BATCH_HPP */
@@ -12,10 +12,13 @@
 #define FACE_DETECTOR_HPP
 
 // ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
 #include <Viewer.hpp>
 #include <FaceComponent.hpp>
 #include <FaceAnnotation.hpp>
+#include <DetectionEvaluator.hpp>
 #include <vector>
+#include <sstream>
 #include <boost/shared_ptr.hpp>
 #include <opencv2/opencv.hpp>
 
@@ -30,8 +33,17 @@ class FaceDetector : public FaceComponent
 public:
   FaceDetector() : FaceComponent(1) {};
 
+  /// Reports the accumulated detection scores when something was evaluated
   virtual
-  ~FaceDetector() {};
+  ~FaceDetector()
+  {
+    if (m_evaluator.getNumImages() > 0)
+    {
+      std::ostringstream outs;
+      reportDetection(m_evaluator, outs);
+      UPM_PRINT("FaceDetector evaluation:" << std::endl << outs.str());
+    }
+  };
 
   virtual void
   parseOptions
@@ -78,9 +90,17 @@ public:
   save
     (
     const std::string dirpath,
+    cv::Mat frame,
     const std::vector<upm::FaceAnnotation> &faces,
     const upm::FaceAnnotation &ann
     );
+
+  /// Matches accumulated over every evaluated frame
+  const DetectionEvaluator &
+  getEvaluator() const { return m_evaluator; };
+
+private:
+  DetectionEvaluator m_evaluator;
 };
 
 } // namespace upm
@@ -0,0 +1,332 @@
+/** ****************************************************************************
+ *  @file    FaceGallery.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef FACE_GALLERY_HPP
+#define FACE_GALLERY_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <vector>
+#include <ostream>
+#include <functional>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/// Cosine galleries store unit-norm embeddings and rank by 1-dot product,
+/// L2 galleries rank by squared euclidean distance
+enum class GalleryMetric { cosine, l2 };
+
+struct GalleryMatch
+{
+  int id;
+  float distance;
+};
+
+class EmbeddingCodec;
+
+/** ****************************************************************************
+ * @class FaceGallery
+ * @brief Enrolled identities as fixed-dimension embeddings, one row per slot
+ * of a 16-byte aligned matrix padded with zeros to a multiple of 4 floats so
+ * distance kernels never need a scalar tail. Exact search scans every slot with
+ * SIMD kernels, in parallel for large galleries. Approximate search walks a
+ * HNSW graph (Malkov and Yashunin, 2018) built incrementally on insert.
+ * Removed identities leave a tombstone that is still used for routing but
+ * never returned; compact() reclaims them and rebuilds the graph. With a
+ * codec every slot also has a compact code; quantized search scans the codes
+ * with asymmetric distances and re-ranks the best candidates with the floats.
+ * Searches may run concurrently, insert/remove/compact take exclusive access.
+ ******************************************************************************/
+class FaceGallery
+{
+public:
+  FaceGallery
+    (
+    unsigned int dimension,
+    GalleryMetric metric = GalleryMetric::cosine
+    );
+
+  ~FaceGallery() {};
+
+  /// Builds a HNSW index over the current slots and keeps it updated on insert.
+  /// M links per node (2M on the base layer), ef candidates when building and
+  /// searching
+  void
+  enableIndex
+    (
+    unsigned int M = 16,
+    unsigned int ef_construction = 200,
+    unsigned int ef_search = 64
+    );
+
+  void
+  setEfSearch
+    (
+    unsigned int ef_search
+    );
+
+  /// Trains the codec on the enrolled embeddings and encodes every slot. Without
+  /// 'keep_embeddings' the float rows are released: lookups only use the codes,
+  /// there is no re-ranking and the HNSW index is disabled
+  bool
+  setCodec
+    (
+    const boost::shared_ptr<EmbeddingCodec> &codec,
+    bool keep_embeddings = true
+    );
+
+  /// Candidates of the code scan re-ranked with float distances, 0 disables it
+  void
+  setRerank
+    (
+    unsigned int num_candidates
+    );
+
+  /// Enrolls an identity, replacing its previous embedding if already present
+  void
+  insert
+    (
+    int id,
+    const float *embedding
+    );
+
+  bool
+  remove
+    (
+    int id
+    );
+
+  bool
+  contains
+    (
+    int id
+    ) const;
+
+  /// Uses the HNSW index when enabled, otherwise the codes if there is a codec,
+  /// otherwise an exact scan
+  void
+  search
+    (
+    const float *query,
+    unsigned int k,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  void
+  searchExact
+    (
+    const float *query,
+    unsigned int k,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  void
+  searchApproximate
+    (
+    const float *query,
+    unsigned int k,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  void
+  searchQuantized
+    (
+    const float *query,
+    unsigned int k,
+    unsigned int rerank,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  /// Drops tombstones, renumbering slots, and rebuilds the index if enabled
+  void
+  compact();
+
+  /// Number of enrolled identities
+  unsigned int
+  size() const;
+
+  unsigned int
+  getDimension() const { return m_dimension; };
+
+  GalleryMetric
+  getMetric() const { return m_metric; };
+
+  bool
+  isIndexEnabled() const { return m_index_enabled; };
+
+  bool
+  hasEmbeddings() const { return m_has_embeddings; };
+
+  boost::shared_ptr<EmbeddingCodec>
+  getCodec() const { return m_codec; };
+
+  unsigned int
+  getRerank() const { return m_rerank; };
+
+  /// Bytes allocated for float rows, codes and HNSW links
+  void
+  getMemoryUsage
+    (
+    size_t &embeddings,
+    size_t &codes,
+    size_t &graph
+    ) const;
+
+  /// Distance between two embeddings of this gallery dimension
+  float
+  distance
+    (
+    const float *a,
+    const float *b
+    ) const;
+
+private:
+  friend class GalleryFile;
+
+  /// size() for callers already holding the mutex
+  unsigned int
+  getNumIdentities() const { return static_cast<unsigned int>(m_slots.size()); };
+
+  void
+  reserve
+    (
+    unsigned int capacity
+    );
+
+  unsigned int
+  addSlot
+    (
+    int id,
+    const float *embedding
+    );
+
+  void
+  exactSearch
+    (
+    const float *padded_query,
+    unsigned int k,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  void
+  approximateSearch
+    (
+    const float *padded_query,
+    unsigned int k,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  void
+  quantizedSearch
+    (
+    const float *padded_query,
+    unsigned int k,
+    unsigned int rerank,
+    std::vector<GalleryMatch> &matches
+    ) const;
+
+  /// Keeps the k closest live slots, 'kernel' fills the distances of a block
+  void
+  scanSlots
+    (
+    const std::function<void(unsigned int,unsigned int,float*)> &kernel,
+    unsigned int k,
+    std::vector< std::pair<float,unsigned int> > &nearest
+    ) const;
+
+  void
+  prepareQuery
+    (
+    const float *query,
+    float *padded
+    ) const;
+
+  float
+  slotDistance
+    (
+    const float *padded_query,
+    unsigned int slot
+    ) const;
+
+  void
+  indexSlot
+    (
+    unsigned int slot
+    );
+
+  unsigned int
+  greedyClosest
+    (
+    const float *padded_query,
+    unsigned int entry,
+    unsigned int level
+    ) const;
+
+  void
+  searchLayer
+    (
+    const float *padded_query,
+    unsigned int entry,
+    unsigned int ef,
+    unsigned int level,
+    bool skip_deleted,
+    std::vector< std::pair<float,unsigned int> > &nearest
+    ) const;
+
+  void
+  selectNeighbors
+    (
+    std::vector< std::pair<float,unsigned int> > &candidates,
+    unsigned int max_links
+    ) const;
+
+  unsigned int m_dimension;
+  unsigned int m_padded;
+  GalleryMetric m_metric;
+  cv::Mat m_embeddings;
+  bool m_has_embeddings;
+  unsigned int m_capacity;
+  unsigned int m_num_slots;
+  std::vector<int> m_ids;
+  std::vector<unsigned char> m_deleted;
+  std::unordered_map<int,unsigned int> m_slots;
+  /// HNSW graph, m_links[slot][level] are the neighbours of slot at level
+  bool m_index_enabled;
+  unsigned int m_M, m_ef_construction, m_ef_search;
+  double m_level_mult;
+  cv::RNG m_rng;
+  std::vector< std::vector< std::vector<unsigned int> > > m_links;
+  unsigned int m_entry;
+  int m_max_level;
+  boost::shared_ptr<EmbeddingCodec> m_codec;
+  cv::Mat m_codes;
+  unsigned int m_rerank;
+  /// Keeps alive the file mapping the rows point to, see GalleryFile
+  boost::shared_ptr<void> m_storage;
+  mutable boost::shared_mutex m_mutex;
+};
+
+/// Recall@k against the exact scan and mean latency of every search path of
+/// the gallery over the rows of 'queries', followed by its memory usage
+void
+reportGalleryTradeoffs
+  (
+  const FaceGallery &gallery,
+  const cv::Mat &queries,
+  unsigned int k,
+  std::ostream &output
+  );
+
+} // namespace upm
+
+#endif /* FACE_GALLERY_HPP */
@@ -78,6 +78,7 @@ public:
   save
     (
     const std::string dirpath,
+    cv::Mat frame,
     const std::vector<upm::FaceAnnotation> &faces,
     const upm::FaceAnnotation &ann
     );
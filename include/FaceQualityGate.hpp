@@ -0,0 +1,173 @@
+/** ****************************************************************************
+ *  @file    FaceQualityGate.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef FACE_QUALITY_GATE_HPP
+#define FACE_QUALITY_GATE_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <Viewer.hpp>
+#include <FaceComponent.hpp>
+#include <FaceAnnotation.hpp>
+#include <cfloat>
+#include <vector>
+#include <ostream>
+#include <boost/shared_ptr.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/// Checks in evaluation order, the first failed one is the reason of a skip
+enum class QualityCheck { size, score, yaw, sharpness, none };
+const unsigned int NUM_QUALITY_CHECKS = 4;
+
+struct FaceQuality
+{
+  cv::Rect_<float> pos; // box of the face when it was measured
+  float size; // smallest side of the box in pixels
+  float score; // detector confidence
+  float yaw; // degrees, -FLT_MAX if not estimated
+  float sharpness; // variance of the Laplacian of the face, -1 if not computed
+  QualityCheck failed;
+};
+
+/** ****************************************************************************
+ * @class FaceQualityGate
+ * @brief Cheap component placed after detection (and head-pose, to check the
+ * yaw) that rejects faces too small, too unconfident, too profile or too
+ * blurred to be aligned or recognised. FaceComposite hides the rejected faces
+ * from the components added after the gate and puts them back, in their
+ * original order, once the frame is processed; show, evaluate and save of
+ * those components get the accepted faces again. Checks run from the
+ * cheapest to the most expensive, so sharpness is only measured on faces
+ * that passed the others. Disabled checks use limits that every face meets.
+ ******************************************************************************/
+class FaceQualityGate : public FaceComponent
+{
+public:
+  FaceQualityGate
+    (
+    float min_size = 32.0f,
+    float min_score = -FLT_MAX,
+    float max_yaw = 60.0f,
+    float min_sharpness = 0.001f
+    ) : FaceComponent(5), m_min_size(min_size), m_min_score(min_score), m_max_yaw(max_yaw), m_min_sharpness(min_sharpness),
+        m_keep_rejected(true), m_num_frames(0), m_num_faces(0), m_num_skipped(NUM_QUALITY_CHECKS, 0) {};
+
+  ~FaceQualityGate() {};
+
+  void
+  parseOptions
+    (
+    int argc,
+    char **argv
+    );
+
+  void
+  train
+    (
+    const std::vector<upm::FaceAnnotation> &anns_train,
+    const std::vector<upm::FaceAnnotation> &anns_valid
+    ) {};
+
+  void
+  load() {};
+
+  void
+  process
+    (
+    cv::Mat frame,
+    std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    );
+
+  void
+  show
+    (
+    const boost::shared_ptr<upm::Viewer> &viewer,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    );
+
+  void
+  evaluate
+    (
+    boost::shared_ptr<std::ostream> output,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    );
+
+  void
+  save
+    (
+    const std::string dirpath,
+    cv::Mat frame,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    ) {};
+
+  /// Moves the faces rejected by the last process call out of 'faces'
+  void
+  removeRejected
+    (
+    std::vector<upm::FaceAnnotation> &faces
+    );
+
+  /// Puts the rejected faces back in their original positions, or after the
+  /// others if a later component changed the number of faces
+  void
+  restoreRejected
+    (
+    std::vector<upm::FaceAnnotation> &faces
+    );
+
+  /// Keeps the faces of a processed output that the components after the gate
+  /// saw, 'faces' is untouched if it is not the output of the last frame
+  void
+  keepAccepted
+    (
+    std::vector<upm::FaceAnnotation> &faces
+    ) const;
+
+  /// Without it rejected faces are dropped from the output
+  void
+  setKeepRejected
+    (
+    bool keep_rejected
+    ) { m_keep_rejected = keep_rejected; };
+
+  /// Qualities of the faces of the last processed frame in their original order
+  const std::vector<FaceQuality> &
+  getQualities() const { return m_qualities; };
+
+  /// Skip counts per failed check as key=value lines
+  void
+  report
+    (
+    std::ostream &output,
+    const std::string &prefix = ""
+    ) const;
+
+private:
+  float m_min_size;
+  float m_min_score;
+  float m_max_yaw;
+  float m_min_sharpness;
+  bool m_keep_rejected;
+  std::vector<FaceQuality> m_qualities;
+  std::vector<upm::FaceAnnotation> m_rejected;
+  std::vector<bool> m_accepted; // per face of the output after restoreRejected
+  unsigned long m_num_frames;
+  unsigned long m_num_faces;
+  std::vector<unsigned long> m_num_skipped;
+};
+
+} // namespace upm
+
+#endif /* FACE_QUALITY_GATE_HPP */
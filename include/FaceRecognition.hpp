@@ -12,10 +12,17 @@
 #define FACE_RECOGNITION_HPP
 
 // ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
 #include <Viewer.hpp>
 #include <FaceComponent.hpp>
 #include <FaceAnnotation.hpp>
+#include <FaceGallery.hpp>
+#include <RecognitionEvaluator.hpp>
+#include <IdentityAccumulator.hpp>
+#include <AttributeEvaluator.hpp>
+#include <FaceCropBatch.hpp>
 #include <vector>
+#include <sstream>
 #include <boost/shared_ptr.hpp>
 #include <opencv2/opencv.hpp>
 
@@ -23,15 +30,36 @@ namespace upm {
 
 /** ****************************************************************************
  * @class FaceRecognition
- * @brief Class interface for attributes estimation.
+ * @brief Class interface for attributes estimation. Attribute models implement
+ * estimateAttributes() over a batch of face crops; processAttributes() runs it
+ * once for every face of a frame, or of several frames, reusing the crop and
+ * output buffers.
  ******************************************************************************/
 class FaceRecognition : public FaceComponent
 {
 public:
-  FaceRecognition() : FaceComponent(4) {};
+  FaceRecognition
+    (
+    const cv::Size &crop_size = cv::Size(112,112)
+    ) : FaceComponent(4), m_crops(crop_size), m_estimates_attributes(false) {};
 
   virtual
-  ~FaceRecognition() {};
+  ~FaceRecognition()
+  {
+    if (m_evaluator.getNumSamples() > 0)
+    {
+      m_evaluator.score();
+      std::ostringstream outs;
+      reportVerification(m_evaluator, outs);
+      UPM_PRINT("FaceRecognition evaluation:" << std::endl << outs.str());
+    }
+    if (m_attribute_evaluator.getNumFaces() > 0)
+    {
+      std::ostringstream outs;
+      reportAttributes(m_attribute_evaluator, outs);
+      UPM_PRINT("FaceRecognition attributes:" << std::endl << outs.str());
+    }
+  };
 
   virtual void
   parseOptions
@@ -78,9 +106,89 @@ public:
   save
     (
     const std::string dirpath,
+    cv::Mat frame,
     const std::vector<upm::FaceAnnotation> &faces,
     const upm::FaceAnnotation &ann
     );
+
+  /// Enrolled identities the process looks embeddings up in
+  void
+  setGallery
+    (
+    const boost::shared_ptr<upm::FaceGallery> &gallery
+    ) { m_gallery = gallery; };
+
+  boost::shared_ptr<upm::FaceGallery>
+  getGallery() { return m_gallery; };
+
+  /// Attributes of every face of the frame estimated in one batch
+  void
+  processAttributes
+    (
+    cv::Mat frame,
+    std::vector<upm::FaceAnnotation> &faces
+    );
+
+  /// Attributes of the faces of several frames, e.g. a dataset shard, in one batch
+  void
+  processAttributes
+    (
+    const std::vector<cv::Mat> &frames,
+    std::vector< std::vector<upm::FaceAnnotation> > &faces
+    );
+
+  /// Identities of the tracked faces of the last processed frame, pooling the
+  /// embeddings of each track over time. 'faces' are the ones this component
+  /// processed (FaceComposite::getProcessedFaces behind a quality gate) and
+  /// 'track_ids' follow their order
+  void
+  identifyTracks
+    (
+    const std::vector<int> &track_ids,
+    const std::vector<upm::FaceAnnotation> &faces,
+    std::vector<upm::GalleryMatch> &decisions
+    );
+
+  IdentityAccumulator &
+  getTracks() { return m_tracks; };
+
+  /// Embeddings of the faces of the last processed frame, one row per face
+  const cv::Mat &
+  getEmbeddings() const { return m_embeddings; };
+
+  /// Embeddings of every evaluated frame, scored and reported on destruction
+  const RecognitionEvaluator &
+  getEvaluator() const { return m_evaluator; };
+
+  /// Attributes of every evaluated frame, reported on destruction
+  const AttributeEvaluator &
+  getAttributeEvaluator() const { return m_attribute_evaluator; };
+
+protected:
+  /// Writes one row of NUM_ATTRIBUTES scores per patch of 'crops' into the
+  /// preallocated 'attributes' header, which must not be reallocated. False
+  /// when the model estimates no attributes
+  virtual bool
+  estimateAttributes
+    (
+    const FaceCropBatch &crops,
+    cv::Mat &attributes
+    ) { return false; };
+
+  /// False when there are no faces or no attribute estimator
+  bool
+  runAttributes();
+
+  boost::shared_ptr<upm::FaceGallery> m_gallery;
+  cv::Mat m_embeddings; // filled by process in the order of the faces
+  IdentityAccumulator m_tracks;
+  FaceCropBatch m_crops;
+  cv::Mat m_attributes; // capacity rows, the first m_crops.size() are valid
+  bool m_estimates_attributes;
+
+private:
+  RecognitionEvaluator m_evaluator;
+  AttributeEvaluator m_attribute_evaluator;
 };
 
 } // namespace upm
@@ -0,0 +1,92 @@
+/** ****************************************************************************
+ *  @file    FrameCache.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef FRAME_CACHE_HPP
+#define FRAME_CACHE_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/// Crops kept per frame, e.g. a crowd with several components per face
+const unsigned int MAX_CACHED_CROPS = 256;
+
+/** ****************************************************************************
+ * @class FrameCache
+ * @brief Per-frame preprocessing context shared by the components of a
+ * composite. Derived images are computed the first time a component asks for
+ * them and reused by the rest until the next frame. Returned images are shared
+ * and must be treated as read-only.
+ ******************************************************************************/
+class FrameCache
+{
+public:
+  FrameCache() {};
+
+  ~FrameCache() {};
+
+  /// Start a new frame, discarding every derived image. Only the composite
+  /// owning the cache resets it, nested composites share the parent frame
+  void
+  reset
+    (
+    cv::Mat frame
+    );
+
+  cv::Mat
+  getFrame();
+
+  cv::Mat
+  getGray();
+
+  /// Level 0 is the frame itself, each level halves the previous one (cv::pyrDown)
+  cv::Mat
+  getPyramidLevel
+    (
+    unsigned int level,
+    bool gray = true
+    );
+
+  cv::Mat
+  getScaled
+    (
+    double scale,
+    bool gray = true
+    );
+
+  /// Region resized to 'size' as CV_32F values in [0,1], zero outside the frame
+  cv::Mat
+  getNormalizedCrop
+    (
+    const cv::Rect_<float> &roi,
+    const cv::Size &size,
+    bool gray = false
+    );
+
+private:
+  cv::Mat
+  gray();
+
+  std::mutex m_mutex;
+  cv::Mat m_frame;
+  cv::Mat m_gray;
+  std::vector<cv::Mat> m_pyramids[2]; // color and gray
+  std::map<std::pair<double,bool>,cv::Mat> m_scaled;
+  std::map<std::tuple<float,float,float,float,int,int,bool>,cv::Mat> m_crops;
+};
+
+} // namespace upm
+
+#endif /* FRAME_CACHE_HPP */
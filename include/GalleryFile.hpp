@@ -0,0 +1,155 @@
+/** ****************************************************************************
+ *  @file    GalleryFile.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef GALLERY_FILE_HPP
+#define GALLERY_FILE_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceGallery.hpp>
+#include <mutex>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class GalleryFile
+ * @brief Persistent FaceGallery. The file is a header followed by page aligned
+ * blocks: float rows, codes, ids, tombstones, metadata offsets and bytes, the
+ * codec parameters and the HNSW links. Opening maps the file copy-on-write, so
+ * the rows and codes are used in place and worker processes opening the same
+ * file share the physical pages until they modify them. Ids, metadata lookup
+ * and links are read in one linear pass. The float and code blocks reserve
+ * spare rows, so appends fill mapped pages instead of copying the gallery.
+ *
+ * Appends and removals go to '<path>.wal' and are synced before being applied.
+ * Opening replays the log and ignores a torn last record, which the next
+ * append truncates. compact() folds the log into a new file offline.
+ * Replaying a log already folded is harmless, as inserts replace and removals
+ * are idempotent. Processes with the file open hold a shared lock on its log,
+ * and write() and compact() refuse to replace a file that another process has
+ * open. Opening only reads the file and its log, so workers without write
+ * access to the directory can search it; the log is created by the first
+ * append.
+ ******************************************************************************/
+class GalleryFile
+{
+public:
+  GalleryFile() : m_metadata_offsets(NULL), m_metadata(NULL), m_wal(NULL), m_wal_lock(-1), m_log_size(0), m_log_torn(false) {};
+
+  ~GalleryFile() { close(); };
+
+  /// Snapshot of the gallery with the metadata of its identities. The file is
+  /// replaced atomically and its log discarded
+  static bool
+  write
+    (
+    const std::string &path,
+    const FaceGallery &gallery,
+    const std::unordered_map<int,std::string> &metadata
+    );
+
+  /// Maps the file and replays its write-ahead log
+  bool
+  open
+    (
+    const std::string &path
+    );
+
+  void
+  close();
+
+  boost::shared_ptr<FaceGallery>
+  getGallery() const { return m_gallery; };
+
+  /// Empty for unknown identities
+  std::string
+  getMetadata
+    (
+    int id
+    ) const;
+
+  /// Enrolls or replaces an identity, durable when it returns true
+  bool
+  append
+    (
+    int id,
+    const float *embedding,
+    const std::string &metadata
+    );
+
+  bool
+  remove
+    (
+    int id
+    );
+
+  /// Folds the write-ahead log of the file and drops its tombstones
+  static bool
+  compact
+    (
+    const std::string &path
+    );
+
+private:
+  static bool
+  writeSnapshot
+    (
+    const std::string &path,
+    const FaceGallery &gallery,
+    const std::unordered_map<int,std::string> &metadata
+    );
+
+  bool
+  load
+    (
+    const std::string &path
+    );
+
+  bool
+  logRecord
+    (
+    unsigned int operation,
+    int id,
+    const float *embedding,
+    const std::string &metadata
+    );
+
+  bool
+  openLog();
+
+  bool
+  replayLog();
+
+  std::string m_path;
+  boost::shared_ptr<FaceGallery> m_gallery;
+  /// Keeps the metadata mapped after the gallery drops its storage
+  boost::shared_ptr<void> m_mapping;
+  /// Metadata of the identities in the mapped file, by id
+  std::unordered_map<int,unsigned int> m_file_slots;
+  const unsigned long long *m_metadata_offsets;
+  const char *m_metadata;
+  /// Metadata of the identities appended since the file was written
+  std::unordered_map<int,std::string> m_appended;
+  /// Log opened for writing by the first append
+  std::FILE *m_wal;
+  /// Read-only descriptor holding the shared lock, -1 if there was no log
+  int m_wal_lock;
+  /// Bytes of complete records replayed, a torn tail beyond them is truncated
+  unsigned long long m_log_size;
+  bool m_log_torn;
+  mutable std::mutex m_wal_mutex;
+};
+
+} // namespace upm
+
+#endif /* GALLERY_FILE_HPP */
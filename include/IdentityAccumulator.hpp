@@ -0,0 +1,122 @@
+/** ****************************************************************************
+ *  @file    IdentityAccumulator.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef IDENTITY_ACCUMULATOR_HPP
+#define IDENTITY_ACCUMULATOR_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <FaceGallery.hpp>
+#include <vector>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class IdentityAccumulator
+ * @brief Identity of video face tracks. The embeddings of a track are pooled
+ * weighted by the quality of each face, so large, frontal and unoccluded
+ * views dominate the estimate. The pool is an exponential moving average,
+ * every update scaling the previous faces by 'decay', so it follows the
+ * recent faces and a track whose tracker swapped people drifts away from its
+ * old identity within a few frames. The gallery is only queried when a track has
+ * no decision yet or its pooled embedding has drifted from the one used for
+ * the last query; every other frame reuses the cached decision. Track ids
+ * come from the caller's tracker.
+ ******************************************************************************/
+class IdentityAccumulator
+{
+public:
+  IdentityAccumulator
+    (
+    float max_drift = 0.02f,
+    unsigned int max_idle_frames = 30,
+    float decay = 0.95f
+    ) : m_max_drift(max_drift), m_max_idle_frames(max_idle_frames), m_decay(decay), m_num_updates(0), m_num_queries(0) {};
+
+  ~IdentityAccumulator() {};
+
+  /// Weight in [0,1] from box height, head-pose and landmark occlusion
+  static float
+  computeQuality
+    (
+    const FaceAnnotation &face
+    );
+
+  /// Pools the embedding of the face into its track and returns the track
+  /// decision, id -1 if the gallery is empty
+  GalleryMatch
+  update
+    (
+    const FaceGallery &gallery,
+    int track_id,
+    const FaceAnnotation &face,
+    const float *embedding
+    );
+
+  /// False for unknown tracks
+  bool
+  getDecision
+    (
+    int track_id,
+    GalleryMatch &decision
+    ) const;
+
+  /// Tracks not updated for max_idle_frames calls are forgotten
+  void
+  endFrame();
+
+  void
+  endTrack
+    (
+    int track_id
+    );
+
+  /// Forces the next update of every track to query again, e.g. after
+  /// enrolling identities
+  void
+  invalidate();
+
+  void
+  clear();
+
+  unsigned int
+  getNumTracks() const { return static_cast<unsigned int>(m_tracks.size()); };
+
+  unsigned long long
+  getNumUpdates() const { return m_num_updates; };
+
+  unsigned long long
+  getNumQueries() const { return m_num_queries; };
+
+private:
+  struct Track
+  {
+    std::vector<float> pooled; // decayed quality weighted sum of embeddings
+    float weight;
+    std::vector<float> queried; // unit pooled embedding of the last query
+    GalleryMatch decision;
+    bool decided;
+    unsigned int idle_frames;
+  };
+
+  float m_max_drift;
+  unsigned int m_max_idle_frames;
+  float m_decay;
+  std::unordered_map<int,Track> m_tracks;
+  std::vector<GalleryMatch> m_matches;
+  unsigned long long m_num_updates;
+  unsigned long long m_num_queries;
+};
+
+} // namespace upm
+
+#endif /* IDENTITY_ACCUMULATOR_HPP */
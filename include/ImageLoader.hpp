@@ -0,0 +1,143 @@
+/** ****************************************************************************
+ *  @file    ImageLoader.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef IMAGE_LOADER_HPP
+#define IMAGE_LOADER_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceAnnotation.hpp>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+struct LoadedImage
+{
+  unsigned int index; // position of the annotation in the list
+  cv::Mat image; // empty if the file could not be read or decoded
+  float scale; // image pixels per annotation pixel, below 1 for reduced decodes
+};
+
+/** ****************************************************************************
+ * @class ImageLoader
+ * @brief Decodes the images of an annotation list ahead of the consumer on a
+ * pool of threads. At most 'prefetch' images are being decoded or waiting to
+ * be consumed, so memory stays bounded whatever the list length. Each thread
+ * reads the file into its own byte buffer and decodes it with cv::imdecode
+ * into a matrix taken from a pool refilled by release(), so in steady state
+ * no pixel buffer is allocated. Images are delivered in list order, or as
+ * soon as they are ready when the order does not matter.
+ *
+ * With a minimum face size, JPEG images whose annotated box is large enough
+ * are decoded at 1/2, 1/4 or 1/8 of their resolution by libjpeg (the largest
+ * reduction keeping the box above the minimum), which skips most of the IDCT
+ * work. LoadedImage::scale maps annotation coordinates to the reduced image.
+ ******************************************************************************/
+class ImageLoader
+{
+public:
+  ImageLoader
+    (
+    unsigned int num_threads = 4,
+    unsigned int prefetch = 16,
+    bool ordered = true
+    );
+
+  ~ImageLoader();
+
+  /// Only faces at least this large in the reduced image are needed, 0 decodes
+  /// every image at full resolution. Applies to the next start().
+  void
+  setMinFaceSize
+    (
+    float min_face_size
+    ) { m_min_face_size = min_face_size; };
+
+  /// Cancels the previous list, if any, and starts decoding 'anns'
+  void
+  start
+    (
+    const std::vector<upm::FaceAnnotation> &anns,
+    int flags = cv::IMREAD_COLOR
+    );
+
+  /// Waits for the next image, false once the whole list was delivered
+  bool
+  next
+    (
+    upm::LoadedImage &image
+    );
+
+  /// Returns the image buffer to the pool. Buffers with other references,
+  /// e.g. FaceComposite before releaseFrame(), are not reused.
+  void
+  release
+    (
+    upm::LoadedImage &image
+    );
+
+  /// Seconds next() spent waiting for the decoders since the last start()
+  double
+  getWaitSeconds() const { return m_wait_ticks / cv::getTickFrequency(); };
+
+  unsigned int
+  getNumReduced() const { return m_num_reduced; };
+
+private:
+  struct Job
+  {
+    std::string filename;
+    int flags;
+    float scale;
+  };
+
+  void
+  run();
+
+  void
+  cancel
+    (
+    std::unique_lock<std::mutex> &lock
+    );
+
+  const unsigned int m_prefetch;
+  const bool m_ordered;
+  float m_min_face_size;
+  std::vector<Job> m_jobs;
+  unsigned int m_next_job; // first job not taken by a decoder
+  unsigned int m_consumed; // images returned by next()
+  unsigned int m_in_flight; // jobs being decoded
+  unsigned int m_num_reduced;
+  double m_wait_ticks;
+  std::vector<LoadedImage> m_ready;
+  std::vector<cv::Mat> m_pool;
+  bool m_stop;
+  std::mutex m_mutex;
+  std::condition_variable m_work; // decoders wait for jobs
+  std::condition_variable m_done; // next() and cancel() wait for decoders
+  std::vector<std::thread> m_threads;
+};
+
+/// Annotation in the coordinates of an image decoded with LoadedImage::scale
+void
+scaleAnnotation
+  (
+  const upm::FaceAnnotation &ann,
+  float scale,
+  upm::FaceAnnotation &scaled
+  );
+
+} // namespace upm
+
+#endif /* IMAGE_LOADER_HPP */
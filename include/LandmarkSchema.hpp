@@ -0,0 +1,278 @@
+/** ****************************************************************************
+ *  @file    LandmarkSchema.hpp
+ *  @brief   Compile-time landmark layout of each annotated database
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef LANDMARK_SCHEMA_HPP
+#define LANDMARK_SCHEMA_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <utils.hpp>
+#include <FaceAlignment.hpp>
+#include <FaceAnnotation.hpp>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+const unsigned int NUM_FACE_PARTS = 10;
+const unsigned int MAX_FEATURE_IDX = 256; // feature ids are below this bound
+
+constexpr unsigned int
+getMaxFeatureIdx
+  (
+  const unsigned int *ids,
+  unsigned int num_ids,
+  unsigned int max_idx = 0
+  )
+{
+  return (num_ids == 0) ? max_idx : getMaxFeatureIdx(ids, num_ids-1, (ids[num_ids-1] > max_idx) ? ids[num_ids-1] : max_idx);
+};
+
+/** ****************************************************************************
+ * @brief Landmark schemas. 'landmarks' holds the feature ids grouped by
+ * FacePartLabel, part p spanning [part_offsets[p], part_offsets[p+1]).
+ * 'left_corner'/'right_corner' are the outer eye corners used by
+ * ErrorMeasure::corners. The ids match the mean-face files in
+ * headpose/posit/data.
+ ******************************************************************************/
+struct AflwSchema
+{
+  static constexpr unsigned int num_landmarks = 21;
+  static constexpr unsigned int landmarks[num_landmarks] = {1, 2, 3, 4, 5, 6, 7, 101, 8, 11, 102, 12, 16, 17, 18, 20, 103, 21, 15, 19, 24};
+  static constexpr unsigned int part_offsets[NUM_FACE_PARTS+1] = {0, 3, 6, 9, 12, 15, 18, 18, 19, 20, 21};
+  static constexpr unsigned int left_corner = 7;
+  static constexpr unsigned int right_corner = 12;
+};
+
+struct CofwSchema
+{
+  static constexpr unsigned int num_landmarks = 29;
+  static constexpr unsigned int landmarks[num_landmarks] = {1, 101, 3, 102, 4, 103, 6, 104, 7, 8, 9, 10, 105, 11, 12, 13, 14, 106, 17, 16, 107, 18, 20, 22, 21, 108, 23, 109, 24};
+  static constexpr unsigned int part_offsets[NUM_FACE_PARTS+1] = {0, 4, 8, 13, 18, 22, 26, 28, 28, 28, 29};
+  static constexpr unsigned int left_corner = 7;
+  static constexpr unsigned int right_corner = 12;
+};
+
+struct Ibug300WSchema
+{
+  static constexpr unsigned int num_landmarks = 68;
+  static constexpr unsigned int landmarks[num_landmarks] = {1, 119, 2, 121, 3, 4, 124, 5, 126, 6, 7, 138, 139, 8, 141, 142, 11, 144, 145, 12, 147, 148, 128, 129, 130, 17, 16, 133, 134, 135, 18, 20, 150, 151, 22, 153, 154, 21, 161, 162, 163, 164, 165, 156, 157, 23, 159, 160, 166, 167, 168, 101, 102, 103, 104, 105, 106, 112, 113, 114, 115, 116, 117, 107, 108, 24, 110, 111};
+  static constexpr unsigned int part_offsets[NUM_FACE_PARTS+1] = {0, 5, 10, 16, 22, 31, 43, 51, 57, 63, 68};
+  static constexpr unsigned int left_corner = 7;
+  static constexpr unsigned int right_corner = 12;
+};
+
+struct WflwSchema
+{
+  static constexpr unsigned int num_landmarks = 98;
+  static constexpr unsigned int landmarks[num_landmarks] = {1, 134, 2, 136, 3, 138, 139, 140, 141, 4, 143, 5, 145, 6, 147, 148, 149, 150, 7, 161, 9, 163, 8, 165, 10, 167, 196, 11, 169, 13, 171, 12, 173, 14, 175, 197, 151, 152, 153, 17, 16, 156, 157, 158, 18, 20, 177, 178, 22, 180, 181, 21, 188, 189, 190, 191, 192, 183, 184, 23, 186, 187, 193, 194, 195, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 111, 112, 113, 114, 115, 24, 117, 118, 119, 120, 121};
+  static constexpr unsigned int part_offsets[NUM_FACE_PARTS+1] = {0, 9, 18, 27, 36, 45, 57, 65, 76, 87, 98};
+  static constexpr unsigned int left_corner = 7;
+  static constexpr unsigned int right_corner = 12;
+};
+
+static_assert(AflwSchema::part_offsets[NUM_FACE_PARTS] == AflwSchema::num_landmarks, "AFLW parts must cover every landmark");
+static_assert(CofwSchema::part_offsets[NUM_FACE_PARTS] == CofwSchema::num_landmarks, "COFW parts must cover every landmark");
+static_assert(Ibug300WSchema::part_offsets[NUM_FACE_PARTS] == Ibug300WSchema::num_landmarks, "300W parts must cover every landmark");
+static_assert(WflwSchema::part_offsets[NUM_FACE_PARTS] == WflwSchema::num_landmarks, "WFLW parts must cover every landmark");
+static_assert(getMaxFeatureIdx(WflwSchema::landmarks, WflwSchema::num_landmarks) < MAX_FEATURE_IDX, "Feature ids exceed MAX_FEATURE_IDX");
+
+/** ****************************************************************************
+ * @class LandmarkIndex
+ * @brief Dense feature id to schema position table, -1 for foreign ids. Built
+ * once per schema.
+ ******************************************************************************/
+template<typename Schema>
+class LandmarkIndex
+{
+public:
+  static const LandmarkIndex &
+  get()
+  {
+    static const LandmarkIndex index;
+    return index;
+  };
+
+  int
+  operator[]
+    (
+    unsigned int feature_idx
+    ) const { return (feature_idx < MAX_FEATURE_IDX) ? m_positions[feature_idx] : -1; };
+
+  /// Copy the landmarks of an annotation into schema order, and their
+  /// occlusion if 'occluded' is given
+  void
+  gather
+    (
+    const FaceAnnotation &ann,
+    cv::Point2f *pts,
+    bool *found,
+    float *occluded = nullptr
+    ) const
+  {
+    std::fill(found, found+Schema::num_landmarks, false);
+    for (const FacePart &part : ann.parts)
+      for (const FaceLandmark &landmark : part.landmarks)
+      {
+        const int pos = (*this)[landmark.feature_idx];
+        if (pos < 0)
+          continue;
+        pts[pos] = landmark.pos;
+        found[pos] = true;
+        if (occluded)
+          occluded[pos] = landmark.occluded;
+      }
+  };
+
+private:
+  LandmarkIndex()
+  {
+    std::fill(m_positions, m_positions+MAX_FEATURE_IDX, -1);
+    for (unsigned int i=0; i < Schema::num_landmarks; i++)
+      m_positions[Schema::landmarks[i]] = static_cast<int>(i);
+  };
+
+  int m_positions[MAX_FEATURE_IDX];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: same errors as getNormalizedErrors, in schema order,
+// with both shapes copied into fixed-size arrays instead of searching every
+// landmark of the other annotation.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+template<typename Schema>
+void
+getNormalizedErrors
+  (
+  const FaceAnnotation &face,
+  const FaceAnnotation &ann,
+  const ErrorMeasure &measure,
+  std::vector<unsigned int> &indices,
+  std::vector<float> &errors
+  )
+{
+  const LandmarkIndex<Schema> &index = LandmarkIndex<Schema>::get();
+  cv::Point2f face_pts[Schema::num_landmarks], ann_pts[Schema::num_landmarks];
+  bool face_found[Schema::num_landmarks], ann_found[Schema::num_landmarks];
+  index.gather(face, face_pts, face_found);
+  index.gather(ann, ann_pts, ann_found);
+  float normalization;
+  switch (measure)
+  {
+    case ErrorMeasure::pupils:
+    {
+      /// Pupil distance normalization
+      cv::Point2f pupils[2];
+      const unsigned int labels[2] = {FacePartLabel::leye, FacePartLabel::reye};
+      for (unsigned int j=0; j < 2; j++)
+      {
+        unsigned int count = 0;
+        for (unsigned int i=Schema::part_offsets[labels[j]]; i < Schema::part_offsets[labels[j]+1]; i++)
+          if (ann_found[i])
+          {
+            pupils[j] += ann_pts[i];
+            count++;
+          }
+        pupils[j] = pupils[j] * (1.0f/count);
+      }
+      normalization = static_cast<float>(cv::norm(pupils[0]-pupils[1]));
+      break;
+    }
+    case ErrorMeasure::corners:
+    {
+      /// Outer corners of the eyes normalization
+      normalization = static_cast<float>(cv::norm(ann_pts[index[Schema::left_corner]]-ann_pts[index[Schema::right_corner]]));
+      break;
+    }
+    case ErrorMeasure::height:
+    {
+      /// Bounding box size normalization
+      normalization = getBbox(ann).height;
+      break;
+    }
+    default:
+    {
+      /// Diagonal of the bounding box
+      cv::Rect_<float> bbox = getBbox(ann);
+      normalization = cv::sqrt((bbox.width*bbox.width)+(bbox.height*bbox.height));
+      break;
+    }
+  }
+  /// Estimate normalized error for each landmark labelled in both shapes
+  for (unsigned int i=0; i < Schema::num_landmarks; i++)
+    if (ann_found[i] and face_found[i])
+    {
+      indices.push_back(Schema::landmarks[i]);
+      errors.push_back(static_cast<float>(cv::norm(face_pts[i]-ann_pts[i])/normalization)*100.0f);
+    }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: occlusion of the landmarks 'indices' of an annotation,
+// gathered once in schema order and read through the index.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: every id in 'indices' must be labelled in 'ann',
+// as the ones returned by getNormalizedErrors.
+//
+// -----------------------------------------------------------------------------
+template<typename Schema>
+void
+getOcclusions
+  (
+  const FaceAnnotation &ann,
+  const std::vector<unsigned int> &indices,
+  std::vector<float> &occlusions
+  )
+{
+  const LandmarkIndex<Schema> &index = LandmarkIndex<Schema>::get();
+  cv::Point2f ann_pts[Schema::num_landmarks];
+  bool ann_found[Schema::num_landmarks];
+  float ann_occluded[Schema::num_landmarks];
+  index.gather(ann, ann_pts, ann_found, ann_occluded);
+  occlusions.reserve(occlusions.size()+indices.size());
+  for (unsigned int idx : indices)
+    occlusions.push_back(ann_occluded[index[idx]]);
+};
+
+/// Runtime dispatch on FaceAlignment::_database, false if it has no schema
+bool
+getNormalizedErrors
+  (
+  const std::string &database,
+  const FaceAnnotation &face,
+  const FaceAnnotation &ann,
+  const ErrorMeasure &measure,
+  std::vector<unsigned int> &indices,
+  std::vector<float> &errors
+  );
+
+/// Runtime dispatch on FaceAlignment::_database, false if it has no schema
+bool
+getOcclusions
+  (
+  const std::string &database,
+  const FaceAnnotation &ann,
+  const std::vector<unsigned int> &indices,
+  std::vector<float> &occlusions
+  );
+
+} // namespace upm
+
+#endif /* LANDMARK_SCHEMA_HPP */
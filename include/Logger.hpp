@@ -0,0 +1,149 @@
+/** ****************************************************************************
+ *  @file    Logger.hpp
+ *  @brief   Asynchronous leveled logging behind the trace macros
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+namespace upm {
+
+enum class LogLevel { debug, info, warning, error };
+
+/** ****************************************************************************
+ * @class Logger
+ * @brief Messages are formatted by the calling thread and pushed to a lock-free
+ * multiple-producer queue. A background thread writes them (errors to
+ * std::cerr, the rest to std::cout) and flushes once per batch, so logging
+ * threads never wait on the iostream lock. An error waits until it and every
+ * message before it are written. The logger is never destroyed: at exit the
+ * writer drains the queue and stops, and later messages, e.g. from static
+ * destructors, are written by the calling thread. The idle writer blocks
+ * without polling.
+ ******************************************************************************/
+class Logger
+{
+public:
+  static Logger &
+  getInstance();
+
+  void
+  log
+    (
+    LogLevel level,
+    std::string message
+    );
+
+  bool
+  isEnabled
+    (
+    LogLevel level
+    ) const { return level >= m_level.load(std::memory_order_relaxed); };
+
+  void
+  setLevel
+    (
+    LogLevel level
+    ) { m_level.store(level, std::memory_order_relaxed); };
+
+  /// Block until every message logged so far has been written
+  void
+  flush();
+
+private:
+  Logger();
+
+  /// Registered with std::atexit by getInstance()
+  static void
+  shutdown();
+
+  void
+  drain();
+
+  struct Node
+  {
+    std::atomic<Node*> next;
+    LogLevel level;
+    std::string message;
+  };
+
+  bool
+  pop
+    (
+    LogLevel &level,
+    std::string &message
+    );
+
+  void
+  run();
+
+  std::atomic<LogLevel> m_level;
+  std::atomic<Node*> m_head; // producers push here
+  Node *m_tail; // only touched by the writer thread
+  std::atomic<unsigned long> m_pushed;
+  std::atomic<unsigned long> m_written;
+  std::atomic<bool> m_sleeping;
+  std::atomic<bool> m_stop;
+  std::atomic<bool> m_writer_stopped; // raised by the writer once it is done
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  std::condition_variable m_drained;
+  std::thread m_writer;
+};
+
+/** ****************************************************************************
+ * @class LogRateLimiter
+ * @brief Lets through at most 'per_second' messages of a call site each second
+ * and counts the rest, so the next message can report how many were dropped.
+ ******************************************************************************/
+class LogRateLimiter
+{
+public:
+  explicit
+  LogRateLimiter
+    (
+    unsigned int per_second
+    ) : m_per_second(per_second), m_second(-1), m_count(0), m_suppressed(0) {};
+
+  bool
+  allow
+    (
+    unsigned long &suppressed
+    )
+  {
+    const long long second = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    long long current = m_second.load(std::memory_order_relaxed);
+    if ((second != current) and m_second.compare_exchange_strong(current, second))
+      m_count.store(0, std::memory_order_relaxed);
+    if (m_count.fetch_add(1, std::memory_order_relaxed) < m_per_second)
+    {
+      suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+      return true;
+    }
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  };
+
+private:
+  const unsigned int m_per_second;
+  std::atomic<long long> m_second;
+  std::atomic<unsigned int> m_count;
+  std::atomic<unsigned long> m_suppressed;
+};
+
+} // namespace upm
+
+#endif /* LOGGER_HPP */
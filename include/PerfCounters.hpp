@@ -0,0 +1,102 @@
+/** ****************************************************************************
+ *  @file    PerfCounters.hpp
+ *  @brief   Hardware performance counters around profiled calls
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <string>
+
+namespace upm {
+
+enum class PerfCounter { cycles, instructions, cache_misses, branch_misses };
+const unsigned int NUM_PERF_COUNTERS = 4;
+
+/** ****************************************************************************
+ * @class PerfCounterValues
+ * @brief Counter values, 'valid' is false when no counter could be read.
+ ******************************************************************************/
+struct PerfCounterValues
+{
+  PerfCounterValues() : valid(false), values() {};
+  bool valid;
+  unsigned long long values[NUM_PERF_COUNTERS];
+};
+
+/** ****************************************************************************
+ * @class PerfCounters
+ * @brief Per-thread group of Linux perf events counting the calling thread in
+ * user space, opened on first use and read with a single system call. Only
+ * compiled in with the UPM_PERF_COUNTERS CMake option. When perf events are
+ * unavailable (non-Linux, perf_event_paranoid, containers, virtual machines
+ * without a PMU) a warning is logged once and every reading is invalid.
+ * Events the CPU lacks are reported as zero. Multiplexed counters are scaled
+ * by their enabled/running time.
+ ******************************************************************************/
+class PerfCounters
+{
+public:
+  static constexpr bool
+  isEnabled()
+  {
+#ifdef UPM_PERF_COUNTERS
+    return true;
+#else
+    return false;
+#endif
+  };
+
+  /// Current values of the calling thread counters
+  static PerfCounterValues
+  read();
+
+  static const char *
+  getName
+    (
+    PerfCounter counter
+    );
+};
+
+/** ****************************************************************************
+ * @class PerfScope
+ * @brief Counter increments since construction.
+ ******************************************************************************/
+class PerfScope
+{
+public:
+  PerfScope()
+  {
+    if (PerfCounters::isEnabled())
+      m_start = PerfCounters::read();
+  };
+
+  ~PerfScope() {};
+
+  PerfCounterValues
+  getValues() const
+  {
+    PerfCounterValues delta;
+    if (PerfCounters::isEnabled() and m_start.valid)
+    {
+      PerfCounterValues end = PerfCounters::read();
+      delta.valid = end.valid;
+      for (unsigned int i=0; i < NUM_PERF_COUNTERS; i++)
+        delta.values[i] = (end.values[i] > m_start.values[i]) ? end.values[i]-m_start.values[i] : 0;
+    }
+    return delta;
+  };
+
+private:
+  PerfCounterValues m_start;
+};
+
+} // namespace upm
+
+#endif /* PERF_COUNTERS_HPP */
@@ -0,0 +1,170 @@
+/** ****************************************************************************
+ *  @file    PoseBuckets.hpp
+ *  @brief   Grouping of faces by yaw bin for pose-conditioned models
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef POSE_BUCKETS_HPP
+#define POSE_BUCKETS_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceComponent.hpp>
+#include <FaceAnnotation.hpp>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class PoseBuckets
+ * @brief Stable counting sort of items by getHeadposeIdx of their yaw. One
+ * bucket per HP_LABELS bin plus a last one for items without head-pose.
+ ******************************************************************************/
+class PoseBuckets
+{
+public:
+  PoseBuckets();
+
+  ~PoseBuckets() {};
+
+  void
+  assign
+    (
+    const std::vector<FaceAnnotation> &faces
+    );
+
+  /// Yaws equal to -FLT_MAX (default FaceAnnotation) go to the last bucket
+  void
+  assign
+    (
+    const float *yaws,
+    unsigned int num_items
+    );
+
+  unsigned int
+  getNumBuckets() const { return static_cast<unsigned int>(m_offsets.size()-1); };
+
+  /// Original positions of the items of a bucket, in increasing order
+  const unsigned int *
+  begin
+    (
+    unsigned int bucket
+    ) const { return m_order.data() + m_offsets[bucket]; };
+
+  const unsigned int *
+  end
+    (
+    unsigned int bucket
+    ) const { return m_order.data() + m_offsets[bucket+1]; };
+
+private:
+  std::vector<float> m_yaws;
+  std::vector<int> m_bins;
+  std::vector<unsigned int> m_offsets;
+  std::vector<unsigned int> m_order;
+};
+
+/** ****************************************************************************
+ * @class FacePoseBatcher
+ * @brief Runs a pose-conditioned component (e.g. a multi-view aligner) once
+ * per yaw bucket instead of once over faces of mixed poses, so each call only
+ * touches the model of one bin. Faces are moved into the bucket batch and back
+ * to their original positions. If the component changes the number of faces
+ * of a batch, the output is the concatenation of the batches in bucket order.
+ ******************************************************************************/
+class FacePoseBatcher : public FaceComponent
+{
+public:
+  FacePoseBatcher
+    (
+    const boost::shared_ptr<FaceComponent> &component
+    ) : FaceComponent(component->getComponentClass()), m_component(component) {};
+
+  ~FacePoseBatcher() {};
+
+  void
+  parseOptions
+    (
+    int argc,
+    char **argv
+    ) { m_component->parseOptions(argc, argv); };
+
+  void
+  train
+    (
+    const std::vector<upm::FaceAnnotation> &anns_train,
+    const std::vector<upm::FaceAnnotation> &anns_valid
+    ) { m_component->train(anns_train, anns_valid); };
+
+  void
+  load() { m_component->load(); };
+
+  void
+  process
+    (
+    cv::Mat frame,
+    std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    );
+
+  void
+  show
+    (
+    const boost::shared_ptr<upm::Viewer> &viewer,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    ) { m_component->show(viewer, faces, ann); };
+
+  void
+  evaluate
+    (
+    boost::shared_ptr<std::ostream> output,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    ) { m_component->evaluate(output, faces, ann); };
+
+  void
+  save
+    (
+    const std::string dirpath,
+    cv::Mat frame,
+    const std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    ) { m_component->save(dirpath, frame, faces, ann); };
+
+  void
+  setFrameCache
+    (
+    const boost::shared_ptr<upm::FrameCache> &cache
+    )
+  {
+    FaceComponent::setFrameCache(cache);
+    m_component->setFrameCache(cache);
+  };
+
+private:
+  boost::shared_ptr<FaceComponent> m_component;
+  PoseBuckets m_buckets;
+  std::vector<FaceAnnotation> m_batch;
+  std::vector<FaceAnnotation> m_results;
+};
+
+/// Offline pass over a dataset shard: the faces of each image are processed
+/// bucket by bucket, one call per image and bucket
+void
+processByPose
+  (
+  const boost::shared_ptr<FaceComponent> &component,
+  const std::vector<cv::Mat> &frames,
+  std::vector< std::vector<FaceAnnotation> > &faces,
+  const std::vector<FaceAnnotation> &anns
+  );
+
+} // namespace upm
+
+#endif /* POSE_BUCKETS_HPP */
@@ -0,0 +1,158 @@
+/** ****************************************************************************
+ *  @file    RecognitionEvaluator.hpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef RECOGNITION_EVALUATOR_HPP
+#define RECOGNITION_EVALUATOR_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <string>
+#include <vector>
+#include <ostream>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class RecognitionEvaluator
+ * @brief Collects one embedding per evaluated face with its identity and
+ * compares all of them against each other to compute genuine and impostor
+ * score distributions, ROC, TAR@FAR and rank-N identification rates.
+ *
+ * Scores are cosine similarities of the L2 normalised embeddings. The score
+ * matrix is computed in tiles with cv::gemm, row blocks in parallel, and never
+ * stored: every pair only updates two histograms and the best scores of its
+ * row, so memory grows linearly with the number of samples. Identification is
+ * leave-one-out closed-set: each sample with another sample of its identity
+ * is a probe against every other sample, and its rank is one plus the number
+ * of impostor samples scoring above its best genuine match.
+ ******************************************************************************/
+class RecognitionEvaluator
+{
+public:
+  RecognitionEvaluator
+    (
+    unsigned int max_rank = 20
+    ) : m_max_rank(std::max(max_rank, 1U)), m_num_genuine(0), m_num_impostor(0), m_num_probes(0) {};
+
+  ~RecognitionEvaluator() {};
+
+  /// Adds a sample, the embedding dimension is set by the first one
+  bool
+  addEmbedding
+    (
+    const std::string &identity,
+    const cv::Mat &embedding
+    );
+
+  void
+  merge
+    (
+    const RecognitionEvaluator &evaluator
+    );
+
+  void
+  clear();
+
+  /// Compares every pair of samples, the getters below report the last call
+  void
+  score();
+
+  /// One point per non empty histogram bin, from the highest to the lowest threshold
+  void
+  getRoc
+    (
+    std::vector<float> &false_accept_rates,
+    std::vector<float> &true_accept_rates,
+    std::vector<float> &thresholds
+    ) const;
+
+  /// Highest TAR with a FAR not above 'false_accept_rate', and its threshold
+  float
+  getTrueAcceptRate
+    (
+    float false_accept_rate,
+    float &threshold
+    ) const;
+
+  /// Cumulative match characteristic, rates of ranks 1 to max_rank
+  void
+  getCmc
+    (
+    std::vector<float> &identification_rates
+    ) const;
+
+  float
+  getIdentificationRate
+    (
+    unsigned int rank
+    ) const;
+
+  /// Pair counts per score bin, bin i covers [getBinScore(i), getBinScore(i+1))
+  const std::vector<unsigned long long> &
+  getGenuineHistogram() const { return m_genuine; };
+
+  const std::vector<unsigned long long> &
+  getImpostorHistogram() const { return m_impostor; };
+
+  static float
+  getBinScore
+    (
+    unsigned int bin
+    );
+
+  unsigned int
+  getNumSamples() const { return static_cast<unsigned int>(m_labels.size()); };
+
+  unsigned int
+  getNumIdentities() const { return static_cast<unsigned int>(m_identities.size()); };
+
+  unsigned long long
+  getNumGenuine() const { return m_num_genuine; };
+
+  unsigned long long
+  getNumImpostor() const { return m_num_impostor; };
+
+  unsigned int
+  getNumProbes() const { return m_num_probes; };
+
+  unsigned int
+  getMaxRank() const { return m_max_rank; };
+
+  /// Similarity histograms resolution over [-1,1]
+  static const unsigned int NUM_BINS = 65536;
+
+private:
+  unsigned int m_max_rank;
+  cv::Mat m_embeddings;
+  std::vector<int> m_labels;
+  std::vector<std::string> m_names;
+  std::unordered_map<std::string,int> m_identities;
+  std::vector<unsigned long long> m_genuine;
+  std::vector<unsigned long long> m_impostor;
+  unsigned long long m_num_genuine;
+  unsigned long long m_num_impostor;
+  /// Probes found at each rank, the last entry counts those beyond max_rank
+  std::vector<unsigned int> m_ranks;
+  unsigned int m_num_probes;
+};
+
+/// Writes the number of comparisons, TAR at the usual FARs and rank-1/rank-N
+/// rates as key=value lines
+void
+reportVerification
+  (
+  const RecognitionEvaluator &evaluator,
+  std::ostream &output
+  );
+
+} // namespace upm
+
+#endif /* RECOGNITION_EVALUATOR_HPP */
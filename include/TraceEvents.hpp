@@ -0,0 +1,78 @@
+/** ****************************************************************************
+ *  @file    TraceEvents.hpp
+ *  @brief   Structured tracing of begin/end/counter events
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ------------------ RECURSION PROTECTION -------------------------------------
+#ifndef TRACE_EVENTS_HPP
+#define TRACE_EVENTS_HPP
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <string>
+
+namespace upm {
+
+/** ****************************************************************************
+ * @class TraceEvents
+ * @brief Each thread records its events into its own fixed-size ring buffer
+ * without locks, the oldest events being overwritten when it is full. Export
+ * produces the Chrome trace event JSON format, which chrome://tracing and the
+ * Perfetto UI open directly. Event names must be string literals since only
+ * the pointer is stored. Use it through the UPM_TRACE_* macros in trace.hpp.
+ ******************************************************************************/
+class TraceEvents
+{
+public:
+  static void
+  begin
+    (
+    const char *name
+    );
+
+  static void
+  end
+    (
+    const char *name
+    );
+
+  static void
+  counter
+    (
+    const char *name,
+    double value
+    );
+
+  /// Events still being written while exporting are skipped
+  static bool
+  exportChromeJson
+    (
+    const std::string &path
+    );
+};
+
+/** ****************************************************************************
+ * @class TraceScope
+ * @brief Begin event on construction and end event on destruction.
+ ******************************************************************************/
+class TraceScope
+{
+public:
+  explicit
+  TraceScope
+    (
+    const char *name
+    ) : m_name(name) { TraceEvents::begin(m_name); };
+
+  ~TraceScope() { TraceEvents::end(m_name); };
+
+private:
+  const char *m_name;
+};
+
+} // namespace upm
+
+#endif /* TRACE_EVENTS_HPP */
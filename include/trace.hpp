@@ -12,17 +12,43 @@
 #define TRACE_HPP
 
 // ----------------------- INCLUDES --------------------------------------------
+#include <Logger.hpp>
 #include <iostream>
+#include <sstream>
 
-#define UPM_PRINT(...) std::cout << __VA_ARGS__ << std::endl;
-#define UPM_ERROR(...) std::cerr << __VA_ARGS__ << std::endl;
+/// Messages are formatted in place and written by the asynchronous logger
+#define UPM_LOG(level,...) do { if (upm::Logger::getInstance().isEnabled(level)) { std::ostringstream upm_log_stream; upm_log_stream << __VA_ARGS__; upm::Logger::getInstance().log(level, upm_log_stream.str()); } } while (0)
+/// At most 'per_second' messages from this call site each second
+#define UPM_LOG_RATE(level,per_second,...) do { static upm::LogRateLimiter upm_log_limiter(per_second); unsigned long upm_log_suppressed; if (upm_log_limiter.allow(upm_log_suppressed)) UPM_LOG(level, __VA_ARGS__ << ((upm_log_suppressed > 0) ? " (" + std::to_string(upm_log_suppressed) + " similar messages suppressed)" : std::string())); } while (0)
+
+#define UPM_PRINT(...) UPM_LOG(upm::LogLevel::info, __VA_ARGS__);
+#define UPM_WARNING(...) UPM_LOG(upm::LogLevel::warning, __VA_ARGS__);
+#define UPM_ERROR(...) UPM_LOG(upm::LogLevel::error, __VA_ARGS__);
 
 #ifdef DEBUG
-  #define UPM_TRACE(...) std::cout << __VA_ARGS__ << std::endl;
-  #define UPM_TRACE_INFO(...) std::cout << __FILE__ << "(" << __LINE__ << "):" << __VA_ARGS__ << std::endl;
+  #define UPM_TRACE(...) UPM_LOG(upm::LogLevel::debug, __VA_ARGS__);
+  #define UPM_TRACE_INFO(...) UPM_LOG(upm::LogLevel::debug, __FILE__ << "(" << __LINE__ << "):" << __VA_ARGS__);
 #else
   #define UPM_TRACE(...)
   #define UPM_TRACE_INFO(...)
 #endif
 
+/// Structured events exported to Chrome trace JSON, compiled out unless UPM_TRACE_EVENTS
+#define UPM_TRACE_CONCAT_IMPL(a,b) a##b
+#define UPM_TRACE_CONCAT(a,b) UPM_TRACE_CONCAT_IMPL(a,b)
+#ifdef UPM_TRACE_EVENTS
+  #include <TraceEvents.hpp>
+  #define UPM_TRACE_BEGIN(name) upm::TraceEvents::begin(name);
+  #define UPM_TRACE_END(name) upm::TraceEvents::end(name);
+  #define UPM_TRACE_SCOPE(name) upm::TraceScope UPM_TRACE_CONCAT(upm_trace_scope_,__LINE__)(name);
+  #define UPM_TRACE_COUNTER(name,value) upm::TraceEvents::counter(name, value);
+  #define UPM_TRACE_EXPORT(path) upm::TraceEvents::exportChromeJson(path);
+#else
+  #define UPM_TRACE_BEGIN(name)
+  #define UPM_TRACE_END(name)
+  #define UPM_TRACE_SCOPE(name)
+  #define UPM_TRACE_COUNTER(name,value)
+  #define UPM_TRACE_EXPORT(path)
+#endif
+
 #endif /* TRACE_HPP */
@@ -25,6 +25,7 @@ namespace upm {
 static const std::vector<float> HP_LABELS = {-90, -75, -60, -45, -30, -15, 0, 15, 30, 45, 60, 75, 90};
 extern std::map< FacePartLabel,std::vector<int> > DB_PARTS;
 extern std::vector<unsigned int> DB_LANDMARKS;
+static const std::string POSIT_DATA_PATH = "faces_framework/headpose/posit/data/";
 
 double
 processFrame
@@ -60,12 +61,36 @@ getHeadposeIdx
   float label
   );
 
+/// Batch variant, indices must hold num_labels elements
+void
+getHeadposeIdx
+  (
+  const float *labels,
+  unsigned int num_labels,
+  int *indices
+  );
+
 cv::Rect_<float>
 getBbox
   (
   const FaceAnnotation &ann
   );
 
+cv::Rect_<float>
+getEnlargedBbox
+  (
+  const cv::Rect_<float> &bbox,
+  float scale
+  );
+
+cv::Point3f
+estimateHeadpose
+  (
+  const std::vector<cv::Point3f> &world_pts,
+  const std::vector<cv::Point2f> &image_pts,
+  const cv::Rect_<float> &bbox
+  );
+
 cv::Point3f
 getHeadpose
   (
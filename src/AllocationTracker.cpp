@@ -0,0 +1,338 @@
+/** ****************************************************************************
+ *  @file    AllocationTracker.cpp
+ *  @brief   Heap allocation counting for memory footprint instrumentation
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <AllocationTracker.hpp>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <malloc.h>
+#include <opencv2/opencv.hpp>
+
+namespace upm {
+
+/// Constant-initialized, so operator new can use them before static constructors run
+static std::atomic<unsigned long> alloc_count(0);
+static std::atomic<unsigned long long> alloc_bytes(0);
+static std::atomic<long long> alloc_live(0);
+static std::atomic<long long> alloc_peak(0);
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static void
+updatePeakBytes
+  (
+  long long live
+  )
+{
+  long long peak = alloc_peak.load(std::memory_order_relaxed);
+  while ((live > peak) and (not alloc_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AllocationTracker::recordAllocation
+  (
+  std::size_t bytes
+  )
+{
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  updatePeakBytes(alloc_live.fetch_add(static_cast<long long>(bytes), std::memory_order_relaxed) + static_cast<long long>(bytes));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AllocationTracker::recordFree
+  (
+  std::size_t bytes
+  )
+{
+  alloc_live.fetch_sub(static_cast<long long>(bytes), std::memory_order_relaxed);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned long
+AllocationTracker::getAllocations()
+{
+  return alloc_count.load(std::memory_order_relaxed);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned long long
+AllocationTracker::getBytes()
+{
+  return alloc_bytes.load(std::memory_order_relaxed);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+long long
+AllocationTracker::getLiveBytes()
+{
+  return alloc_live.load(std::memory_order_relaxed);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+long long
+AllocationTracker::getPeakBytes()
+{
+  return alloc_peak.load(std::memory_order_relaxed);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+long long
+AllocationTracker::resetPeakBytes()
+{
+  return alloc_peak.exchange(alloc_live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AllocationTracker::restorePeakBytes
+  (
+  long long peak
+  )
+{
+  updatePeakBytes(peak);
+};
+
+#ifdef UPM_ALLOC_TRACKING
+/** ****************************************************************************
+ * @class TrackingMatAllocator
+ * @brief Forwards cv::Mat buffers to the standard allocator and counts them.
+ * Buffers remember this allocator, so they are also released through it.
+ ******************************************************************************/
+class TrackingMatAllocator : public cv::MatAllocator
+{
+public:
+  cv::UMatData *
+  allocate
+    (
+    int dims,
+    const int *sizes,
+    int type,
+    void *data,
+    size_t *step,
+    int flags,
+    cv::UMatUsageFlags usage_flags
+    ) const
+  {
+    cv::UMatData *u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+    if (u)
+    {
+      u->currAllocator = this;
+      if (not (u->flags & cv::UMatData::USER_ALLOCATED))
+        AllocationTracker::recordAllocation(u->size);
+    }
+    return u;
+  };
+
+  bool
+  allocate
+    (
+    cv::UMatData *data,
+    int access_flags,
+    cv::UMatUsageFlags usage_flags
+    ) const
+  {
+    return cv::Mat::getStdAllocator()->allocate(data, access_flags, usage_flags);
+  };
+
+  void
+  deallocate
+    (
+    cv::UMatData *data
+    ) const
+  {
+    if (data and (not (data->flags & cv::UMatData::USER_ALLOCATED)))
+      AllocationTracker::recordFree(data->size);
+    cv::Mat::getStdAllocator()->deallocate(data);
+  };
+};
+
+struct TrackingMatAllocatorInstaller
+{
+  TrackingMatAllocatorInstaller()
+  {
+    static TrackingMatAllocator allocator;
+    cv::Mat::setDefaultAllocator(&allocator);
+  };
+} tracking_mat_allocator_installer;
+#endif
+
+} // namespace upm
+
+#ifdef UPM_ALLOC_TRACKING
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: replaces the global allocation functions. Sizes come
+// from malloc_usable_size so frees are accounted without a header.
+// Inputs:
+// Outputs:
+// Dependencies: glibc
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void *
+operator new
+  (
+  std::size_t size
+  )
+{
+  void *ptr = std::malloc(size > 0 ? size : 1);
+  if (not ptr)
+    throw std::bad_alloc();
+  upm::AllocationTracker::recordAllocation(malloc_usable_size(ptr));
+  return ptr;
+};
+
+void *
+operator new[]
+  (
+  std::size_t size
+  )
+{
+  return operator new(size);
+};
+
+void *
+operator new
+  (
+  std::size_t size,
+  const std::nothrow_t &
+  ) noexcept
+{
+  void *ptr = std::malloc(size > 0 ? size : 1);
+  if (ptr)
+    upm::AllocationTracker::recordAllocation(malloc_usable_size(ptr));
+  return ptr;
+};
+
+void *
+operator new[]
+  (
+  std::size_t size,
+  const std::nothrow_t &tag
+  ) noexcept
+{
+  return operator new(size, tag);
+};
+
+void
+operator delete
+  (
+  void *ptr
+  ) noexcept
+{
+  if (not ptr)
+    return;
+  upm::AllocationTracker::recordFree(malloc_usable_size(ptr));
+  std::free(ptr);
+};
+
+void
+operator delete[]
+  (
+  void *ptr
+  ) noexcept
+{
+  operator delete(ptr);
+};
+
+void
+operator delete
+  (
+  void *ptr,
+  const std::nothrow_t &
+  ) noexcept
+{
+  operator delete(ptr);
+};
+
+void
+operator delete[]
+  (
+  void *ptr,
+  const std::nothrow_t &
+  ) noexcept
+{
+  operator delete(ptr);
+};
+#endif
@@ -0,0 +1,254 @@
+/** ****************************************************************************
+ *  @file    AttributeEvaluator.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <AttributeEvaluator.hpp>
+#include <iomanip>
+
+namespace upm {
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+attributeToRow
+  (
+  const FaceAttribute &attribute,
+  float *row
+  )
+{
+  row[male_attribute] = attribute.male;
+  row[age_attribute] = attribute.age;
+  row[glasses_attribute] = attribute.glasses;
+  row[hat_attribute] = attribute.hat;
+  row[moustache_attribute] = attribute.moustache;
+  row[beard_attribute] = attribute.beard;
+  row[fake_attribute] = attribute.fake;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+rowToAttribute
+  (
+  const float *row,
+  FaceAttribute &attribute
+  )
+{
+  attribute.male = row[male_attribute];
+  attribute.age = row[age_attribute];
+  attribute.glasses = row[glasses_attribute];
+  attribute.hat = row[hat_attribute];
+  attribute.moustache = row[moustache_attribute];
+  attribute.beard = row[beard_attribute];
+  attribute.fake = row[fake_attribute];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+isAttributeAnnotated
+  (
+  const FaceAttribute &attribute
+  )
+{
+  float row[NUM_ATTRIBUTES];
+  attributeToRow(attribute, row);
+  for (unsigned int label=0; label < NUM_ATTRIBUTES; label++)
+    if (row[label] != 0.0f)
+      return true;
+  return false;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AttributeEvaluator::addFace
+  (
+  const FaceAttribute &face,
+  const FaceAttribute &ann
+  )
+{
+  cv::Mat face_row(1, NUM_ATTRIBUTES, CV_32F), ann_row(1, NUM_ATTRIBUTES, CV_32F);
+  attributeToRow(face, face_row.ptr<float>(0));
+  attributeToRow(ann, ann_row.ptr<float>(0));
+  m_faces.push_back(face_row);
+  m_anns.push_back(ann_row);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AttributeEvaluator::addBatch
+  (
+  const cv::Mat &faces,
+  const cv::Mat &anns
+  )
+{
+  if ((faces.type() != CV_32F) or (faces.cols != static_cast<int>(NUM_ATTRIBUTES)) or (faces.rows != anns.rows) or (faces.type() != anns.type()) or (faces.cols != anns.cols))
+  {
+    UPM_ERROR("Attribute batches must be two N x " << NUM_ATTRIBUTES << " float matrices");
+    return;
+  }
+  m_faces.push_back(faces);
+  m_anns.push_back(anns);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AttributeEvaluator::merge
+  (
+  const AttributeEvaluator &evaluator
+  )
+{
+  if (not evaluator.m_faces.empty())
+    addBatch(evaluator.m_faces, evaluator.m_anns);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+AttributeEvaluator::clear()
+{
+  m_faces.release();
+  m_anns.release();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: both columns are thresholded into masks and the
+// disagreements counted, without visiting the faces one by one.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: annotations without any attribute are skipped.
+//
+// -----------------------------------------------------------------------------
+float
+AttributeEvaluator::getAccuracy
+  (
+  AttributeLabel label
+  ) const
+{
+  if (m_faces.empty())
+    return 0.0f;
+  cv::Mat magnitudes;
+  cv::reduce(cv::abs(m_anns), magnitudes, 1, cv::REDUCE_MAX);
+  cv::Mat annotated = (magnitudes > 0.0f);
+  const int num_annotated = cv::countNonZero(annotated);
+  if (num_annotated == 0)
+    return 0.0f;
+  cv::Mat faces = (m_faces.col(label) >= m_threshold);
+  cv::Mat anns = (m_anns.col(label) >= m_threshold);
+  cv::Mat errors = (faces != anns) & annotated;
+  return 1.0f - static_cast<float>(cv::countNonZero(errors)) / static_cast<float>(num_annotated);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+AttributeEvaluator::getAgeError() const
+{
+  if (m_faces.empty())
+    return 0.0f;
+  cv::Mat errors, annotated = (m_anns.col(age_attribute) > 0.0f);
+  if (cv::countNonZero(annotated) == 0)
+    return 0.0f;
+  cv::absdiff(m_faces.col(age_attribute), m_anns.col(age_attribute), errors);
+  return static_cast<float>(cv::mean(errors, annotated)[0]);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+reportAttributes
+  (
+  const AttributeEvaluator &evaluator,
+  std::ostream &output
+  )
+{
+  const std::ios::fmtflags flags = output.flags();
+  const std::streamsize precision = output.precision();
+  output << std::setprecision(4);
+  output << "attributes faces=" << evaluator.getNumFaces();
+  for (unsigned int label=0; label < NUM_ATTRIBUTES; label++)
+    if (label == age_attribute)
+      output << " age_mae=" << evaluator.getAgeError();
+    else
+      output << " " << ATTRIBUTE_NAMES[label] << "=" << evaluator.getAccuracy(static_cast<AttributeLabel>(label));
+  output << std::endl;
+  output.flags(flags);
+  output.precision(precision);
+};
+
+} // namespace upm
@@ -0,0 +1,285 @@
+/** ****************************************************************************
+ *  @file    ComponentProfiler.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <ComponentProfiler.hpp>
+#include <iomanip>
+
+namespace upm {
+
+const int HISTOGRAM_BINS_PER_OCTAVE = 8;
+const int HISTOGRAM_NUM_BINS = 32*HISTOGRAM_BINS_PER_OCTAVE;
+const double HISTOGRAM_MIN_SECONDS = 1e-7;
+static const char *const PROFILED_OPERATION_NAMES[NUM_PROFILED_OPERATIONS] = {"process", "evaluate", "show", "save"};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+LatencyHistogram::LatencyHistogram() :
+  m_bins(HISTOGRAM_NUM_BINS, 0),
+  m_count(0),
+  m_sum(0.0),
+  m_min(DBL_MAX),
+  m_max(0.0)
+{
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+LatencyHistogram::add
+  (
+  double seconds
+  )
+{
+  int idx = static_cast<int>(HISTOGRAM_BINS_PER_OCTAVE * std::log2(std::max(seconds, HISTOGRAM_MIN_SECONDS) / HISTOGRAM_MIN_SECONDS));
+  m_bins[std::min(idx, HISTOGRAM_NUM_BINS-1)]++;
+  m_count++;
+  m_sum += seconds;
+  m_min = std::min(m_min, seconds);
+  m_max = std::max(m_max, seconds);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+LatencyHistogram::merge
+  (
+  const LatencyHistogram &histogram
+  )
+{
+  for (unsigned int i=0; i < m_bins.size(); i++)
+    m_bins[i] += histogram.m_bins[i];
+  m_count += histogram.m_count;
+  m_sum += histogram.m_sum;
+  m_min = std::min(m_min, histogram.m_min);
+  m_max = std::max(m_max, histogram.m_max);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: geometric center of the bin holding the requested rank.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: clamped to the observed range.
+//
+// -----------------------------------------------------------------------------
+double
+LatencyHistogram::getPercentile
+  (
+  double percentile
+  ) const
+{
+  if (m_count == 0)
+    return 0.0;
+  const unsigned long rank = std::max(1UL, static_cast<unsigned long>(std::ceil(percentile*0.01*m_count)));
+  unsigned long accumulated = 0;
+  for (int i=0; i < HISTOGRAM_NUM_BINS; i++)
+  {
+    accumulated += m_bins[i];
+    if (accumulated >= rank)
+    {
+      double center = HISTOGRAM_MIN_SECONDS * std::exp2((i+0.5) / HISTOGRAM_BINS_PER_OCTAVE);
+      return std::min(std::max(center, m_min), m_max);
+    }
+  }
+  return m_max;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned int
+ComponentProfiler::addComponent
+  (
+  const std::string &name
+  )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_names.push_back(name);
+  m_stats.push_back(std::vector<ComponentStats>(NUM_PROFILED_OPERATIONS));
+  return static_cast<unsigned int>(m_names.size()-1);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ComponentProfiler::record
+  (
+  unsigned int component_idx,
+  ProfiledOperation operation,
+  double seconds,
+  unsigned int num_faces,
+  const AllocationStats &allocs,
+  const PerfCounterValues &counters
+  )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ComponentStats &stats = (component_idx == FRAME) ? m_frame[static_cast<unsigned int>(operation)] : m_stats[component_idx][static_cast<unsigned int>(operation)];
+  stats.calls++;
+  stats.faces += num_faces;
+  stats.latency.add(seconds);
+  stats.allocations += allocs.allocations;
+  stats.bytes += allocs.bytes;
+  stats.peak_bytes = std::max(stats.peak_bytes, allocs.peak_bytes);
+  if (counters.valid)
+  {
+    stats.counted_calls++;
+    for (unsigned int i=0; i < NUM_PERF_COUNTERS; i++)
+      stats.counters[i] += counters.values[i];
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+ComponentStats
+ComponentProfiler::getStats
+  (
+  unsigned int component_idx,
+  ProfiledOperation operation
+  ) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (component_idx == FRAME)
+    return m_frame[static_cast<unsigned int>(operation)];
+  return m_stats[component_idx][static_cast<unsigned int>(operation)];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned int
+ComponentProfiler::getNumComponents() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return static_cast<unsigned int>(m_names.size());
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: one line per component and operation called at least
+// once, then the whole frame. Latencies in milliseconds, allocations and
+// hardware counters per call when they are collected.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ComponentProfiler::report
+  (
+  std::ostream &output,
+  const std::string &prefix
+  ) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const std::ios::fmtflags flags = output.flags();
+  const std::streamsize precision = output.precision();
+  output << std::fixed << std::setprecision(3);
+  for (unsigned int i=0; i <= m_names.size(); i++)
+    for (unsigned int j=0; j < NUM_PROFILED_OPERATIONS; j++)
+    {
+      const ComponentStats &stats = (i < m_names.size()) ? m_stats[i][j] : m_frame[j];
+      if (stats.calls == 0)
+        continue;
+      output << prefix << ((i < m_names.size()) ? m_names[i] : "frame") << " " << PROFILED_OPERATION_NAMES[j];
+      output << " calls=" << stats.calls;
+      output << " faces/call=" << static_cast<double>(stats.faces)/stats.calls;
+      output << " mean=" << stats.latency.getMean()*1e3;
+      output << " p50=" << stats.latency.getPercentile(50)*1e3;
+      output << " p95=" << stats.latency.getPercentile(95)*1e3;
+      output << " p99=" << stats.latency.getPercentile(99)*1e3;
+      output << " max=" << stats.latency.getMax()*1e3 << " ms";
+      if (AllocationTracker::isEnabled())
+      {
+        output << " allocs/call=" << static_cast<double>(stats.allocations)/stats.calls;
+        output << " KB/call=" << static_cast<double>(stats.bytes)/(1024.0*stats.calls);
+        output << " peak=" << static_cast<double>(stats.peak_bytes)/1024.0 << " KB";
+      }
+      if (stats.counted_calls > 0)
+      {
+        const unsigned int cycles = static_cast<unsigned int>(PerfCounter::cycles), instructions = static_cast<unsigned int>(PerfCounter::instructions);
+        if (stats.counters[cycles] > 0)
+          output << " IPC=" << static_cast<double>(stats.counters[instructions])/stats.counters[cycles];
+        for (unsigned int k=0; k < NUM_PERF_COUNTERS; k++)
+          output << " " << PerfCounters::getName(static_cast<PerfCounter>(k)) << "/call=" << std::setprecision(0) << static_cast<double>(stats.counters[k])/stats.counted_calls << std::setprecision(3);
+      }
+      output << std::endl;
+    }
+  output.flags(flags);
+  output.precision(precision);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ComponentProfiler::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (std::vector<ComponentStats> &stats : m_stats)
+    stats.assign(NUM_PROFILED_OPERATIONS, ComponentStats());
+  m_frame.assign(NUM_PROFILED_OPERATIONS, ComponentStats());
+};
+
+} // namespace upm
@@ -0,0 +1,539 @@
+/** ****************************************************************************
+ *  @file    DatasetLoader.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <DatasetLoader.hpp>
+#include <LandmarkSchema.hpp>
+#include <FaceAnnotationCodec.hpp>
+#include <cctype>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace upm {
+
+const char ANNOTATION_CACHE_MAGIC[8] = {'U','P','M','A','N','N','O','T'};
+/// Increase whenever the parsers change, the records carry their own version
+const unsigned int ANNOTATION_CACHE_VERSION = 2;
+
+/// Followed by a FaceAnnotationCodec block
+struct AnnotationCacheHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int reserved;
+  unsigned long long fingerprint;
+};
+
+const std::vector<std::string> PTS_DATABASES = {"300w_public", "300w_private", "ls3dw", "300wlp", "menpo"};
+
+/// Feature ids of the points of a .pts file in file order
+const unsigned int PTS_LANDMARKS[Ibug300WSchema::num_landmarks] = {101, 102, 103, 104, 105, 106, 107, 108, 24, 110, 111, 112, 113, 114, 115, 116, 117, 1, 119, 2, 121, 3, 4, 124, 5, 126, 6, 128, 129, 130, 17, 16, 133, 134, 135, 18, 7, 138, 139, 8, 141, 142, 11, 144, 145, 12, 147, 148, 20, 150, 151, 22, 153, 154, 21, 156, 157, 23, 159, 160, 161, 162, 163, 164, 165, 166, 167, 168};
+
+/// Feature ids of the points of a WFLW line in file order
+const unsigned int WFLW_LANDMARKS[WflwSchema::num_landmarks] = {100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 24, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 1, 134, 2, 136, 3, 138, 139, 140, 141, 4, 143, 5, 145, 6, 147, 148, 149, 150, 151, 152, 153, 17, 16, 156, 157, 158, 18, 7, 161, 9, 163, 8, 165, 10, 167, 11, 169, 13, 171, 12, 173, 14, 175, 20, 177, 178, 22, 180, 181, 21, 183, 184, 23, 186, 187, 188, 189, 190, 191, 192, 193, 194, 195, 196, 197};
+
+/// Annotation files of a database, sorted so the output order is stable
+struct DatabaseSources
+{
+  std::vector<std::string> pts_files;
+  std::vector<std::string> list_files;
+  std::string images_path;
+  unsigned long long fingerprint;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: 64 bit FNV-1a.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static unsigned long long
+updateFingerprint
+  (
+  unsigned long long hash,
+  const void *data,
+  size_t size
+  )
+{
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i=0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+readFile
+  (
+  const std::string &filepath,
+  std::string &buffer
+  )
+{
+  std::ifstream ifs(filepath.c_str(), std::ios::binary);
+  if (not ifs.is_open())
+    return false;
+  ifs.seekg(0, std::ios::end);
+  buffer.resize(static_cast<size_t>(ifs.tellg()));
+  ifs.seekg(0, std::ios::beg);
+  ifs.read(&buffer[0], buffer.size());
+  return not ifs.fail();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: points given in file order are stored part by part in
+// schema order, the box is their bounding rectangle.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: every id in 'ids' must belong to the schema.
+//
+// -----------------------------------------------------------------------------
+template<typename Schema>
+static void
+setLandmarks
+  (
+  const unsigned int *ids,
+  const cv::Point2f *pts,
+  upm::FaceAnnotation &ann
+  )
+{
+  const LandmarkIndex<Schema> &index = LandmarkIndex<Schema>::get();
+  cv::Point2f ordered[Schema::num_landmarks];
+  for (unsigned int i=0; i < Schema::num_landmarks; i++)
+    ordered[index[ids[i]]] = pts[i];
+  for (unsigned int p=0; p < NUM_FACE_PARTS; p++)
+  {
+    std::vector<FaceLandmark> &landmarks = ann.parts[p].landmarks;
+    landmarks.clear();
+    for (unsigned int i=Schema::part_offsets[p]; i < Schema::part_offsets[p+1]; i++)
+      landmarks.push_back({Schema::landmarks[i], ordered[i], 0.0f});
+  }
+  float x_min = FLT_MAX, y_min = FLT_MAX, x_max = -FLT_MAX, y_max = -FLT_MAX;
+  for (unsigned int i=0; i < Schema::num_landmarks; i++)
+  {
+    x_min = std::min(x_min, pts[i].x);
+    y_min = std::min(y_min, pts[i].y);
+    x_max = std::max(x_max, pts[i].x);
+    y_max = std::max(y_max, pts[i].y);
+  }
+  ann.bbox.pos = cv::Rect_<float>(x_min, y_min, x_max-x_min, y_max-y_min);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: strtof based, much faster than stream extraction.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+parseFloats
+  (
+  const char *&cursor,
+  const char *end,
+  float *values,
+  unsigned int num_values
+  )
+{
+  char *next;
+  for (unsigned int i=0; i < num_values; i++)
+  {
+    values[i] = strtof(cursor, &next);
+    if ((next == cursor) or (next > end))
+      return false;
+    cursor = next;
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the image is the .png with the same stem if it
+// exists, the .jpg otherwise.
+//
+// -----------------------------------------------------------------------------
+bool
+parsePtsFile
+  (
+  const std::string &filepath,
+  upm::FaceAnnotation &ann
+  )
+{
+  std::string buffer;
+  if (not readFile(filepath, buffer))
+    return false;
+  const char *text = buffer.c_str(), *end = text+buffer.size();
+  const char *found = strstr(text, "n_points:");
+  if (found == NULL)
+    return false;
+  char *next;
+  if (strtol(found+9, &next, 10) != static_cast<long>(Ibug300WSchema::num_landmarks))
+    return false;
+  const char *cursor = strchr(next, '{');
+  if (cursor == NULL)
+    return false;
+  cursor++;
+  cv::Point2f pts[Ibug300WSchema::num_landmarks];
+  if (not parseFloats(cursor, end, &pts[0].x, 2*Ibug300WSchema::num_landmarks))
+    return false;
+  setLandmarks<Ibug300WSchema>(PTS_LANDMARKS, pts, ann);
+  boost::filesystem::path image(filepath);
+  image.replace_extension(".png");
+  if (not boost::filesystem::exists(image))
+    image.replace_extension(".jpg");
+  ann.filename = image.string();
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the annotated box replaces the landmarks one. The six
+// flags (pose, expression, illumination, make-up, occlusion, blur) have no
+// FaceAnnotation counterpart and are skipped.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+parseWflwLine
+  (
+  const char *begin,
+  const char *end,
+  const std::string &images_path,
+  upm::FaceAnnotation &ann
+  )
+{
+  const char *cursor = begin;
+  cv::Point2f pts[WflwSchema::num_landmarks];
+  float rect[4], flags[6];
+  if ((not parseFloats(cursor, end, &pts[0].x, 2*WflwSchema::num_landmarks)) or (not parseFloats(cursor, end, rect, 4)) or (not parseFloats(cursor, end, flags, 6)))
+    return false;
+  while ((cursor < end) and isspace(*cursor))
+    cursor++;
+  while ((end > cursor) and isspace(*(end-1)))
+    end--;
+  if (cursor == end)
+    return false;
+  setLandmarks<WflwSchema>(WFLW_LANDMARKS, pts, ann);
+  ann.bbox.pos = cv::Rect_<float>(rect[0], rect[1], rect[2]-rect[0], rect[3]-rect[1]);
+  ann.filename = images_path + "/" + std::string(cursor, end);
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: a single directory walk finds the annotation files and
+// the WFLW images directory, which is not descended. The fingerprint covers
+// the database name and the path, size and modification time of each file.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+findSources
+  (
+  const std::string &database,
+  const std::string &path,
+  DatabaseSources &sources
+  )
+{
+  namespace fs = boost::filesystem;
+  const bool all = (database == "all");
+  const bool pts = all or (std::find(PTS_DATABASES.begin(), PTS_DATABASES.end(), database) != PTS_DATABASES.end());
+  const bool wflw = all or (database == "wflw");
+  if ((not pts) and (not wflw))
+  {
+    UPM_ERROR("Database not supported by the loaders: " << database);
+    return false;
+  }
+  boost::system::error_code ec;
+  if (not fs::is_directory(path, ec))
+  {
+    UPM_ERROR("Database directory not found: " << path);
+    return false;
+  }
+  sources.pts_files.clear();
+  sources.list_files.clear();
+  sources.images_path = path;
+  for (fs::recursive_directory_iterator it(path, ec), end; (not ec) and (it != end); it.increment(ec))
+  {
+    const fs::path &filepath = it->path();
+    if (fs::is_directory(it->status()))
+    {
+      if (filepath.filename() == "WFLW_images")
+      {
+        sources.images_path = filepath.string();
+        it.no_push();
+      }
+      continue;
+    }
+    if (pts and (filepath.extension() == ".pts"))
+      sources.pts_files.push_back(filepath.string());
+    else if (wflw and (filepath.extension() == ".txt") and (filepath.filename().string().compare(0, 9, "list_98pt") == 0))
+      sources.list_files.push_back(filepath.string());
+  }
+  if (ec)
+  {
+    UPM_ERROR("Error reading " << path << ": " << ec.message());
+    return false;
+  }
+  std::sort(sources.pts_files.begin(), sources.pts_files.end());
+  std::sort(sources.list_files.begin(), sources.list_files.end());
+
+  unsigned long long hash = updateFingerprint(14695981039346656037ULL, database.data(), database.size());
+  for (const std::vector<std::string> *files : {&sources.pts_files, &sources.list_files})
+    for (const std::string &file : *files)
+    {
+      const unsigned long long size = static_cast<unsigned long long>(fs::file_size(file, ec));
+      const long long time = static_cast<long long>(fs::last_write_time(file, ec));
+      hash = updateFingerprint(hash, file.data(), file.size());
+      hash = updateFingerprint(hash, &size, sizeof(size));
+      hash = updateFingerprint(hash, &time, sizeof(time));
+    }
+  sources.fingerprint = hash;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: .pts files are parsed one per task, WFLW list files are
+// read whole and their lines parsed one per task.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: unreadable files, malformed lines and Menpo
+// profile faces are counted and skipped.
+//
+// -----------------------------------------------------------------------------
+static bool
+parseSources
+  (
+  const DatabaseSources &sources,
+  std::vector<upm::FaceAnnotation> &anns
+  )
+{
+  std::vector<FaceAnnotation> parsed(sources.pts_files.size());
+  std::vector<char> valid(parsed.size(), 0);
+  cv::parallel_for_(cv::Range(0,static_cast<int>(parsed.size())), [&](const cv::Range &range)
+  {
+    for (int i=range.start; i < range.end; i++)
+      valid[i] = parsePtsFile(sources.pts_files[i], parsed[i]);
+  });
+
+  std::string buffer;
+  for (const std::string &list_file : sources.list_files)
+  {
+    if (not readFile(list_file, buffer))
+    {
+      UPM_ERROR("Error reading " << list_file);
+      return false;
+    }
+    std::vector<std::pair<size_t,size_t>> lines;
+    for (size_t begin=0, end; begin < buffer.size(); begin=end+1)
+    {
+      end = std::min(buffer.find('\n', begin), buffer.size());
+      if (end > begin+1)
+        lines.push_back(std::make_pair(begin, end));
+    }
+    const size_t first = parsed.size();
+    parsed.resize(first+lines.size());
+    valid.resize(parsed.size(), 0);
+    cv::parallel_for_(cv::Range(0,static_cast<int>(lines.size())), [&](const cv::Range &range)
+    {
+      for (int i=range.start; i < range.end; i++)
+        valid[first+i] = parseWflwLine(buffer.data()+lines[i].first, buffer.data()+lines[i].second, sources.images_path, parsed[first+i]);
+    });
+  }
+
+  anns.clear();
+  anns.reserve(parsed.size());
+  for (unsigned int i=0; i < parsed.size(); i++)
+    if (valid[i])
+      anns.push_back(std::move(parsed[i]));
+  if (anns.size() != parsed.size())
+    UPM_WARNING("Skipped " << parsed.size()-anns.size() << " of " << parsed.size() << " annotations");
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+loadDatabase
+  (
+  const std::string &database,
+  const std::string &path,
+  std::vector<upm::FaceAnnotation> &anns
+  )
+{
+  return loadDatabase(database, path, "", anns);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: a cache that cannot be written only warns, the
+// parsed annotations are still returned.
+//
+// -----------------------------------------------------------------------------
+bool
+loadDatabase
+  (
+  const std::string &database,
+  const std::string &path,
+  const std::string &cache_path,
+  std::vector<upm::FaceAnnotation> &anns
+  )
+{
+  DatabaseSources sources;
+  if (not findSources(database, path, sources))
+    return false;
+  if ((not cache_path.empty()) and readAnnotationCache(cache_path, sources.fingerprint, anns))
+    return true;
+  if (not parseSources(sources, anns))
+    return false;
+  if ((not cache_path.empty()) and (not writeAnnotationCache(cache_path, sources.fingerprint, anns)))
+    UPM_WARNING("Annotations of " << database << " not cached");
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the annotations are encoded in parallel into one block
+// and written to a temporary file renamed over the cache, so readers never see
+// a partial file.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+writeAnnotationCache
+  (
+  const std::string &cache_path,
+  unsigned long long fingerprint,
+  const std::vector<upm::FaceAnnotation> &anns
+  )
+{
+  AnnotationCacheHeader header;
+  memcpy(header.magic, ANNOTATION_CACHE_MAGIC, sizeof(header.magic));
+  header.version = ANNOTATION_CACHE_VERSION;
+  header.reserved = 0;
+  header.fingerprint = fingerprint;
+  std::vector<unsigned char> buffer(reinterpret_cast<const unsigned char*>(&header), reinterpret_cast<const unsigned char*>(&header)+sizeof(header));
+  if (not encodeAnnotations(anns, buffer))
+    return false;
+
+  const std::string tmp_path = cache_path + ".tmp";
+  std::ofstream ofs(tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+  if (not ofs.is_open())
+  {
+    UPM_ERROR("Error opening file: " << tmp_path);
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  ofs.close();
+  boost::system::error_code ec;
+  if (not ofs.fail())
+    boost::filesystem::rename(tmp_path, cache_path, ec);
+  if (ofs.fail() or ec)
+  {
+    UPM_ERROR("Error writing file: " << cache_path);
+    boost::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the file is mapped read-only and its block decoded in
+// parallel straight from the mapping.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+readAnnotationCache
+  (
+  const std::string &cache_path,
+  unsigned long long fingerprint,
+  std::vector<upm::FaceAnnotation> &anns
+  )
+{
+  namespace bip = boost::interprocess;
+  boost::system::error_code ec;
+  if ((not boost::filesystem::exists(cache_path, ec)) or (boost::filesystem::file_size(cache_path, ec) < sizeof(AnnotationCacheHeader)))
+    return false;
+  bip::mapped_region region;
+  try
+  {
+    bip::file_mapping mapping(cache_path.c_str(), bip::read_only);
+    bip::mapped_region(mapping, bip::read_only).swap(region);
+  }
+  catch (const bip::interprocess_exception &ex)
+  {
+    UPM_WARNING("Error mapping " << cache_path << ": " << ex.what());
+    return false;
+  }
+  const unsigned char *data = static_cast<const unsigned char*>(region.get_address());
+  AnnotationCacheHeader header;
+  memcpy(&header, data, sizeof(header));
+  if ((memcmp(header.magic, ANNOTATION_CACHE_MAGIC, sizeof(header.magic)) != 0) or (header.version != ANNOTATION_CACHE_VERSION) or (header.fingerprint != fingerprint))
+    return false;
+  if (not decodeAnnotations(data+sizeof(header), region.get_size()-sizeof(header), anns))
+  {
+    UPM_WARNING("Corrupt annotation cache, rebuilding: " << cache_path);
+    return false;
+  }
+  return true;
+};
+
+} // namespace upm
@@ -0,0 +1,304 @@
+/** ****************************************************************************
+ *  @file    DetectionEvaluator.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <DetectionEvaluator.hpp>
+#include <DetectionUtils.hpp>
+#include <numeric>
+#include <algorithm>
+#include <iomanip>
+
+namespace upm {
+
+/// False positive counts of the reported ROC points, as plotted by FDDB
+static const std::vector<float> REPORTED_FALSE_POSITIVES = {50.0f, 100.0f, 500.0f, 1000.0f, 2000.0f};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: detections are visited by decreasing score and each one
+// is matched to the unmatched annotation it overlaps the most, provided the
+// IoU reaches the threshold (PASCAL VOC / WIDER FACE protocol).
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: FDDB solves a bipartite matching instead, greedy
+// matching by score gives the same result except for crowded ambiguities.
+//
+// -----------------------------------------------------------------------------
+void
+DetectionEvaluator::addImage
+  (
+  const std::vector<FaceAnnotation> &faces,
+  const std::vector<FaceAnnotation> &anns
+  )
+{
+  m_num_images++;
+  m_num_annotations += static_cast<unsigned int>(anns.size());
+  std::vector<unsigned int> order(faces.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&faces](unsigned int a, unsigned int b){return faces[a].bbox.score > faces[b].bbox.score;});
+
+  cv::Mat iou;
+  if (not anns.empty())
+    computeIoU(faces, anns, iou);
+  std::vector<unsigned char> matched(anns.size(), 0);
+  for (unsigned int idx : order)
+  {
+    int best_idx = -1;
+    float best_iou = m_iou_threshold;
+    for (unsigned int j=0; j < anns.size(); j++)
+      if ((not matched[j]) and (iou.at<float>(idx,j) >= best_iou))
+      {
+        best_idx = static_cast<int>(j);
+        best_iou = iou.at<float>(idx,j);
+      }
+    if (best_idx >= 0)
+      matched[best_idx] = 1;
+    m_detections.push_back({faces[idx].bbox.score, (best_idx >= 0) ? best_iou : -1.0f});
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+DetectionEvaluator::merge
+  (
+  const DetectionEvaluator &evaluator
+  )
+{
+  m_num_images += evaluator.m_num_images;
+  m_num_annotations += evaluator.m_num_annotations;
+  m_detections.insert(m_detections.end(), evaluator.m_detections.begin(), evaluator.m_detections.end());
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+DetectionEvaluator::clear()
+{
+  m_num_images = 0;
+  m_num_annotations = 0;
+  m_detections.clear();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+DetectionEvaluator::sortDetections
+  (
+  std::vector<Detection> &detections
+  ) const
+{
+  detections = m_detections;
+  std::sort(detections.begin(), detections.end(), [](const Detection &a, const Detection &b){return a.score > b.score;});
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: one point per distinct detection score, from the most
+// to the least confident threshold.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+DetectionEvaluator::getPrecisionRecall
+  (
+  std::vector<float> &precision,
+  std::vector<float> &recall,
+  std::vector<float> &thresholds
+  ) const
+{
+  std::vector<Detection> detections;
+  sortDetections(detections);
+  precision.clear();
+  recall.clear();
+  thresholds.clear();
+  const float num_annotations = static_cast<float>(std::max(m_num_annotations, 1U));
+  unsigned int tp = 0, fp = 0;
+  for (unsigned int i=0; i < detections.size(); i++)
+  {
+    (detections[i].iou >= 0.0f) ? tp++ : fp++;
+    if ((i+1 < detections.size()) and (detections[i+1].score == detections[i].score))
+      continue;
+    precision.push_back(static_cast<float>(tp) / static_cast<float>(tp+fp));
+    recall.push_back(static_cast<float>(tp) / num_annotations);
+    thresholds.push_back(detections[i].score);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: area under the precision/recall curve using all-point
+// interpolation (precision made monotonically decreasing), as in PASCAL VOC
+// 2010+ and WIDER FACE.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+DetectionEvaluator::getAveragePrecision() const
+{
+  std::vector<float> precision, recall, thresholds;
+  getPrecisionRecall(precision, recall, thresholds);
+  for (int i=static_cast<int>(precision.size())-2; i >= 0; i--)
+    precision[i] = std::max(precision[i], precision[i+1]);
+  float ap = 0.0f, prev_recall = 0.0f;
+  for (unsigned int i=0; i < precision.size(); i++)
+  {
+    ap += (recall[i]-prev_recall) * precision[i];
+    prev_recall = recall[i];
+  }
+  return ap;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: FDDB style ROC, true positive rate against the absolute
+// number of false positives for each distinct detection score.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+DetectionEvaluator::getRoc
+  (
+  RocType type,
+  std::vector<float> &false_positives,
+  std::vector<float> &true_positives,
+  std::vector<float> &thresholds
+  ) const
+{
+  std::vector<Detection> detections;
+  sortDetections(detections);
+  false_positives.clear();
+  true_positives.clear();
+  thresholds.clear();
+  const float num_annotations = static_cast<float>(std::max(m_num_annotations, 1U));
+  float tp = 0.0f, fp = 0.0f;
+  for (unsigned int i=0; i < detections.size(); i++)
+  {
+    if (detections[i].iou < 0.0f)
+      fp += 1.0f;
+    else
+      tp += (type == RocType::discrete) ? 1.0f : detections[i].iou;
+    if ((i+1 < detections.size()) and (detections[i+1].score == detections[i].score))
+      continue;
+    false_positives.push_back(fp);
+    true_positives.push_back(tp / num_annotations);
+    thresholds.push_back(detections[i].score);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: images are interleaved across shards so that each
+// shard gets a similar mix of easy and crowded images.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+DetectionEvaluator
+DetectionEvaluator::evaluate
+  (
+  const std::vector< std::vector<FaceAnnotation> > &faces,
+  const std::vector< std::vector<FaceAnnotation> > &anns,
+  float iou_threshold,
+  unsigned int num_shards
+  )
+{
+  const unsigned int num_images = static_cast<unsigned int>(std::min(faces.size(), anns.size()));
+  num_shards = std::max(1U, std::min(num_shards, num_images));
+  std::vector<DetectionEvaluator> shards(num_shards, DetectionEvaluator(iou_threshold));
+  cv::parallel_for_(cv::Range(0,num_shards), [&](const cv::Range &range)
+  {
+    for (int shard=range.start; shard < range.end; shard++)
+      for (unsigned int i=static_cast<unsigned int>(shard); i < num_images; i+=num_shards)
+        shards[shard].addImage(faces[i], anns[i]);
+  });
+  DetectionEvaluator evaluator(iou_threshold);
+  for (const DetectionEvaluator &shard : shards)
+    evaluator.merge(shard);
+  return evaluator;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: each ROC point is the last one of the curve with at
+// most that many false positives, a point is reported once the run produced
+// that many.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+reportDetection
+  (
+  const DetectionEvaluator &evaluator,
+  std::ostream &output
+  )
+{
+  std::vector<float> false_positives[2], true_positives[2], thresholds;
+  evaluator.getRoc(RocType::discrete, false_positives[0], true_positives[0], thresholds);
+  evaluator.getRoc(RocType::continuous, false_positives[1], true_positives[1], thresholds);
+  const float num_false_positives = false_positives[0].empty() ? 0.0f : false_positives[0].back();
+  const std::ios::fmtflags flags = output.flags();
+  const std::streamsize precision = output.precision();
+  output << std::setprecision(4);
+  output << "detection images=" << evaluator.getNumImages() << " annotations=" << evaluator.getNumAnnotations();
+  output << " false_positives=" << num_false_positives << " ap=" << evaluator.getAveragePrecision() << std::endl;
+  for (float fp : REPORTED_FALSE_POSITIVES)
+  {
+    if (num_false_positives < fp)
+      break;
+    output << "detection fp=" << fp;
+    for (unsigned int type=0; type < 2; type++)
+    {
+      const std::vector<float>::const_iterator found = std::upper_bound(false_positives[type].begin(), false_positives[type].end(), fp);
+      const float tpr = (found == false_positives[type].begin()) ? 0.0f : true_positives[type][found-false_positives[type].begin()-1];
+      output << ((type == 0) ? " discrete_tpr=" : " continuous_tpr=") << tpr;
+    }
+    output << std::endl;
+  }
+  output.flags(flags);
+  output.precision(precision);
+};
+
+} // namespace upm
@@ -0,0 +1,411 @@
+/** ****************************************************************************
+ *  @file    DetectionUtils.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <DetectionUtils.hpp>
+#include <set>
+#include <numeric>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace upm {
+
+const unsigned int SIMD_WIDTH = 4;
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: sorts candidate indices by decreasing detection score.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: ties keep the detector output order.
+//
+// -----------------------------------------------------------------------------
+static std::vector<unsigned int>
+sortByScore
+  (
+  const std::vector<FaceAnnotation> &faces
+  )
+{
+  std::vector<unsigned int> order(faces.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&faces](unsigned int a, unsigned int b){return faces[a].bbox.score > faces[b].bbox.score;});
+  return order;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+BoxArray::resize
+  (
+  unsigned int num_boxes
+  )
+{
+  /// Padding boxes are empty so they never overlap anything
+  m_size = num_boxes;
+  const unsigned int padded = num_boxes + SIMD_WIDTH - 1;
+  x1.assign(padded, 0.0f);
+  y1.assign(padded, 0.0f);
+  x2.assign(padded, 0.0f);
+  y2.assign(padded, 0.0f);
+  area.assign(padded, 0.0f);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+BoxArray::set
+  (
+  unsigned int idx,
+  const cv::Rect_<float> &box
+  )
+{
+  x1[idx] = box.x;
+  y1[idx] = box.y;
+  x2[idx] = box.x + box.width;
+  y2[idx] = box.y + box.height;
+  area[idx] = box.width * box.height;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+BoxArray::assign
+  (
+  const std::vector<cv::Rect_<float>> &boxes
+  )
+{
+  resize(static_cast<unsigned int>(boxes.size()));
+  for (unsigned int i=0; i < boxes.size(); i++)
+    set(i, boxes[i]);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+BoxArray::assign
+  (
+  const std::vector<FaceAnnotation> &faces
+  )
+{
+  resize(static_cast<unsigned int>(faces.size()));
+  for (unsigned int i=0; i < faces.size(); i++)
+    set(i, faces[i].bbox.pos);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: four boxes per iteration using OpenCV universal
+// intrinsics (SSE/NEON/VSX depending on the target).
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the union is clamped to epsilon so padding and
+// degenerate boxes produce zero instead of NaN.
+//
+// -----------------------------------------------------------------------------
+void
+BoxArray::overlap
+  (
+  const cv::Rect_<float> &box,
+  unsigned int begin,
+  unsigned int end,
+  float *iou
+  ) const
+{
+  const float bx1 = box.x, by1 = box.y, bx2 = box.x+box.width, by2 = box.y+box.height;
+  const float barea = box.width * box.height;
+  unsigned int j = begin;
+#if CV_SIMD128
+  const cv::v_float32x4 vx1 = cv::v_setall_f32(bx1), vy1 = cv::v_setall_f32(by1);
+  const cv::v_float32x4 vx2 = cv::v_setall_f32(bx2), vy2 = cv::v_setall_f32(by2);
+  const cv::v_float32x4 varea = cv::v_setall_f32(barea), vzero = cv::v_setzero_f32(), veps = cv::v_setall_f32(FLT_EPSILON);
+  for (; j < end; j+=SIMD_WIDTH, iou+=SIMD_WIDTH)
+  {
+    cv::v_float32x4 w = cv::v_max(cv::v_min(vx2, cv::v_load(&x2[j])) - cv::v_max(vx1, cv::v_load(&x1[j])), vzero);
+    cv::v_float32x4 h = cv::v_max(cv::v_min(vy2, cv::v_load(&y2[j])) - cv::v_max(vy1, cv::v_load(&y1[j])), vzero);
+    cv::v_float32x4 inter = w * h;
+    cv::v_float32x4 uni = cv::v_max(varea + cv::v_load(&area[j]) - inter, veps);
+    cv::v_store(iou, inter / uni);
+  }
+#endif
+  for (; j < end; j++, iou++)
+  {
+    const float w = std::max(std::min(bx2, x2[j]) - std::max(bx1, x1[j]), 0.0f);
+    const float h = std::max(std::min(by2, y2[j]) - std::max(by1, y1[j]), 0.0f);
+    const float inter = w * h;
+    *iou = inter / std::max(barea + area[j] - inter, FLT_EPSILON);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+computeIoU
+  (
+  const cv::Rect_<float> &r1,
+  const cv::Rect_<float> &r2
+  )
+{
+  const float w = std::min(r1.x+r1.width, r2.x+r2.width) - std::max(r1.x, r2.x);
+  const float h = std::min(r1.y+r1.height, r2.y+r2.height) - std::max(r1.y, r2.y);
+  if ((w <= 0.0f) or (h <= 0.0f))
+    return 0.0f;
+  const float inter = w * h;
+  return inter / ((r1.width*r1.height) + (r2.width*r2.height) - inter);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: fills a faces1.size() x faces2.size() CV_32F matrix,
+// one row per parallel task.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+computeIoU
+  (
+  const std::vector<FaceAnnotation> &faces1,
+  const std::vector<FaceAnnotation> &faces2,
+  cv::Mat &iou
+  )
+{
+  const int rows = static_cast<int>(faces1.size()), cols = static_cast<int>(faces2.size());
+  BoxArray boxes;
+  boxes.assign(faces2);
+  /// Rows are padded so the kernel can store whole registers
+  cv::Mat padded(rows, cols+SIMD_WIDTH-1, CV_32F);
+  cv::parallel_for_(cv::Range(0,rows), [&](const cv::Range &range)
+  {
+    for (int i=range.start; i < range.end; i++)
+      boxes.overlap(faces1[i].bbox.pos, 0, static_cast<unsigned int>(cols), padded.ptr<float>(i));
+  });
+  iou = padded.colRange(0,cols);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: greedy NMS. Candidates are visited by decreasing score
+// and each survivor suppresses the lower scored boxes overlapping it more than
+// the threshold.
+// Inputs:
+// Outputs: surviving faces sorted by decreasing score.
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+nonMaximumSuppression
+  (
+  std::vector<FaceAnnotation> &faces,
+  float iou_threshold
+  )
+{
+  const unsigned int num_faces = static_cast<unsigned int>(faces.size());
+  std::vector<unsigned int> order = sortByScore(faces);
+  std::vector<cv::Rect_<float>> rects(num_faces);
+  for (unsigned int i=0; i < num_faces; i++)
+    rects[i] = faces[order[i]].bbox.pos;
+  BoxArray boxes;
+  boxes.assign(rects);
+
+  std::vector<unsigned char> suppressed(num_faces, 0);
+  std::vector<float> iou(num_faces+SIMD_WIDTH-1);
+  std::vector<FaceAnnotation> kept;
+  for (unsigned int i=0; i < num_faces; i++)
+  {
+    if (suppressed[i])
+      continue;
+    kept.push_back(std::move(faces[order[i]]));
+    boxes.overlap(rects[i], i+1, num_faces, iou.data());
+    for (unsigned int j=i+1; j < num_faces; j++)
+      suppressed[j] |= static_cast<unsigned char>(iou[j-i-1] > iou_threshold);
+  }
+  faces.swap(kept);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: soft-NMS (Bodla et al., ICCV 2017). Instead of removing
+// overlapping boxes their score is decayed linearly (1-IoU above the
+// threshold) or with a gaussian penalty exp(-IoU^2/sigma).
+// Inputs:
+// Outputs: faces scoring above 'score_threshold' after decay, sorted by
+// decreasing decayed score.
+// Dependencies:
+// Restrictions and Caveats: quadratic in the number of candidates, the IoU of
+// every selected box against the whole set is computed with SIMD.
+//
+// -----------------------------------------------------------------------------
+void
+softNonMaximumSuppression
+  (
+  std::vector<FaceAnnotation> &faces,
+  SoftNmsMethod method,
+  float iou_threshold,
+  float sigma,
+  float score_threshold
+  )
+{
+  const unsigned int num_faces = static_cast<unsigned int>(faces.size());
+  BoxArray boxes;
+  boxes.assign(faces);
+  std::vector<float> scores(num_faces), iou(num_faces+SIMD_WIDTH-1);
+  std::vector<unsigned char> active(num_faces, 0);
+  for (unsigned int i=0; i < num_faces; i++)
+  {
+    scores[i] = faces[i].bbox.score;
+    active[i] = static_cast<unsigned char>(scores[i] >= score_threshold);
+  }
+
+  std::vector<FaceAnnotation> kept;
+  for (;;)
+  {
+    /// Select the best remaining candidate
+    int best_idx = -1;
+    float best_score = -FLT_MAX;
+    for (unsigned int i=0; i < num_faces; i++)
+      if (active[i] and (scores[i] > best_score))
+      {
+        best_idx = static_cast<int>(i);
+        best_score = scores[i];
+      }
+    if (best_idx < 0)
+      break;
+    active[best_idx] = 0;
+    kept.push_back(std::move(faces[best_idx]));
+    kept.back().bbox.score = best_score;
+
+    /// Decay the score of the remaining candidates
+    boxes.overlap(kept.back().bbox.pos, 0, num_faces, iou.data());
+    for (unsigned int i=0; i < num_faces; i++)
+    {
+      if (not active[i])
+        continue;
+      if (method == SoftNmsMethod::linear)
+        scores[i] *= (iou[i] > iou_threshold) ? 1.0f-iou[i] : 1.0f;
+      else
+        scores[i] *= std::exp(-(iou[i]*iou[i])/sigma);
+      active[i] = static_cast<unsigned char>(scores[i] >= score_threshold);
+    }
+  }
+  faces.swap(kept);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: weighted boxes fusion across detectors. Boxes are
+// clustered by decreasing score against the running fused box of each
+// cluster, whose corners are the score weighted average of its members. The
+// fused score is the mean score scaled by the fraction of detectors
+// ('FaceBox::detector_idx') agreeing on the face.
+// Inputs:
+// Outputs: one face per cluster, copied from its best scored member.
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+fuseDetections
+  (
+  std::vector<FaceAnnotation> &faces,
+  float iou_threshold
+  )
+{
+  struct Cluster
+  {
+    unsigned int best_idx;
+    float x1, y1, x2, y2, score_sum;
+    unsigned int num_boxes;
+    std::set<unsigned int> detectors;
+  };
+  const unsigned int num_faces = static_cast<unsigned int>(faces.size());
+  std::set<unsigned int> detectors;
+  for (const FaceAnnotation &face : faces)
+    detectors.insert(face.bbox.detector_idx);
+  std::vector<unsigned int> order = sortByScore(faces);
+
+  BoxArray fused;
+  fused.assign(std::vector<cv::Rect_<float>>(num_faces));
+  std::vector<Cluster> clusters;
+  std::vector<float> iou(num_faces+SIMD_WIDTH-1);
+  for (unsigned int idx : order)
+  {
+    const FaceBox &box = faces[idx].bbox;
+    const unsigned int num_clusters = static_cast<unsigned int>(clusters.size());
+    fused.overlap(box.pos, 0, num_clusters, iou.data());
+    auto best = std::max_element(iou.begin(), iou.begin()+num_clusters);
+    if ((best == iou.begin()+num_clusters) or (*best <= iou_threshold))
+    {
+      clusters.push_back({idx, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0, {}});
+      best = iou.begin()+num_clusters;
+    }
+    const unsigned int cluster_idx = static_cast<unsigned int>(std::distance(iou.begin(), best));
+    Cluster &cluster = clusters[cluster_idx];
+    cluster.x1 += box.score * box.pos.x;
+    cluster.y1 += box.score * box.pos.y;
+    cluster.x2 += box.score * (box.pos.x+box.pos.width);
+    cluster.y2 += box.score * (box.pos.y+box.pos.height);
+    cluster.score_sum += box.score;
+    cluster.num_boxes++;
+    cluster.detectors.insert(box.detector_idx);
+    const float norm = 1.0f / std::max(cluster.score_sum, FLT_EPSILON);
+    fused.set(cluster_idx, cv::Rect_<float>(cv::Point2f(cluster.x1*norm, cluster.y1*norm), cv::Point2f(cluster.x2*norm, cluster.y2*norm)));
+  }
+
+  std::vector<FaceAnnotation> kept;
+  for (unsigned int i=0; i < clusters.size(); i++)
+  {
+    const Cluster &cluster = clusters[i];
+    kept.push_back(std::move(faces[cluster.best_idx]));
+    FaceBox &box = kept.back().bbox;
+    box.pos = cv::Rect_<float>(cv::Point2f(fused.x1[i], fused.y1[i]), cv::Point2f(fused.x2[i], fused.y2[i]));
+    box.score = (cluster.score_sum / cluster.num_boxes) * static_cast<float>(cluster.detectors.size()) / static_cast<float>(detectors.size());
+  }
+  faces.swap(kept);
+};
+
+} // namespace upm
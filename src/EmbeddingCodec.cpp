@@ -0,0 +1,584 @@
+/** ****************************************************************************
+ *  @file    EmbeddingCodec.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <EmbeddingCodec.hpp>
+#include <trace.hpp>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace upm {
+
+/// Codes are expanded from one 16-byte register at a time
+const unsigned int SQ_BLOCK = 16;
+const int SQ_LEVELS = 127;
+enum CodecTag { scalar_tag = 1, product_tag = 2 };
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+template<typename T>
+static void
+appendValues
+  (
+  std::vector<unsigned char> &buffer,
+  const T *values,
+  size_t count
+  )
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(values);
+  buffer.insert(buffer.end(), bytes, bytes+count*sizeof(T));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: consumes 'count' values from the front of the buffer.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+template<typename T>
+static bool
+readValues
+  (
+  const unsigned char *&data,
+  size_t &size,
+  T *values,
+  size_t count
+  )
+{
+  if (size < count*sizeof(T))
+    return false;
+  std::memcpy(values, data, count*sizeof(T));
+  data += count*sizeof(T);
+  size -= count*sizeof(T);
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+boost::shared_ptr<EmbeddingCodec>
+EmbeddingCodec::deserialize
+  (
+  const unsigned char *data,
+  size_t size
+  )
+{
+  boost::shared_ptr<EmbeddingCodec> codec;
+  unsigned int tag = 0;
+  if (not readValues(data, size, &tag, 1))
+    return codec;
+  if (tag == scalar_tag)
+    codec.reset(new ScalarQuantizer());
+  else if (tag == product_tag)
+    codec.reset(new ProductQuantizer(1));
+  if (codec and (not codec->restore(data, size)))
+    codec.reset();
+  return codec;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: each dimension is mapped to [-127,127] over the range of
+// the samples, centered so the zero code is the middle of the range.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+ScalarQuantizer::train
+  (
+  const cv::Mat &samples,
+  GalleryMetric metric
+  )
+{
+  if (samples.rows == 0)
+  {
+    UPM_ERROR("ScalarQuantizer: no training samples");
+    return false;
+  }
+  m_dimension = static_cast<unsigned int>(samples.cols);
+  m_metric = metric;
+  std::vector<float> min_values(samples.ptr<float>(0), samples.ptr<float>(0)+m_dimension);
+  std::vector<float> max_values(min_values);
+  for (int i=1; i < samples.rows; i++)
+  {
+    const float *row = samples.ptr<float>(i);
+    for (unsigned int j=0; j < m_dimension; j++)
+    {
+      min_values[j] = std::min(min_values[j], row[j]);
+      max_values[j] = std::max(max_values[j], row[j]);
+    }
+  }
+  m_center.resize(m_dimension);
+  m_scale.resize(m_dimension);
+  for (unsigned int j=0; j < m_dimension; j++)
+  {
+    m_center[j] = 0.5f * (min_values[j]+max_values[j]);
+    m_scale[j] = std::max((max_values[j]-min_values[j]) / (2*SQ_LEVELS), FLT_EPSILON);
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: values outside the training range are clamped.
+//
+// -----------------------------------------------------------------------------
+void
+ScalarQuantizer::encode
+  (
+  const float *embedding,
+  unsigned char *code
+  ) const
+{
+  signed char *values = reinterpret_cast<signed char*>(code);
+  for (unsigned int j=0; j < m_dimension; j++)
+  {
+    const int level = cvRound((embedding[j]-m_center[j]) / m_scale[j]);
+    values[j] = static_cast<signed char>(std::max(-SQ_LEVELS, std::min(SQ_LEVELS, level)));
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ScalarQuantizer::decode
+  (
+  const unsigned char *code,
+  float *embedding
+  ) const
+{
+  const signed char *values = reinterpret_cast<const signed char*>(code);
+  for (unsigned int j=0; j < m_dimension; j++)
+    embedding[j] = m_center[j] + m_scale[j]*values[j];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ScalarQuantizer::serialize
+  (
+  std::vector<unsigned char> &buffer
+  ) const
+{
+  const unsigned int header[3] = {scalar_tag, m_dimension, static_cast<unsigned int>(m_metric)};
+  appendValues(buffer, header, 3);
+  appendValues(buffer, m_center.data(), m_dimension);
+  appendValues(buffer, m_scale.data(), m_dimension);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+ScalarQuantizer::restore
+  (
+  const unsigned char *data,
+  size_t size
+  )
+{
+  unsigned int header[2];
+  if (not readValues(data, size, header, 2))
+    return false;
+  if ((header[1] > static_cast<unsigned int>(GalleryMetric::l2)) or (size < 2*static_cast<size_t>(header[0])*sizeof(float)))
+    return false;
+  m_dimension = header[0];
+  m_metric = static_cast<GalleryMetric>(header[1]);
+  m_center.resize(m_dimension);
+  m_scale.resize(m_dimension);
+  return readValues(data, size, m_center.data(), m_dimension) and readValues(data, size, m_scale.data(), m_dimension);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: with x = center + scale*c the dot product is
+// sum(q*center) + sum((q*scale)*c), and the L2 residual is (q-center)-scale*c.
+// The table holds the per-dimension weights, the scales and the constant term.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ScalarQuantizer::prepare
+  (
+  const float *query,
+  std::vector<float> &table
+  ) const
+{
+  table.resize(2*m_dimension+1);
+  float bias = 0.0f;
+  for (unsigned int j=0; j < m_dimension; j++)
+  {
+    if (m_metric == GalleryMetric::cosine)
+    {
+      table[j] = query[j] * m_scale[j];
+      bias += query[j] * m_center[j];
+    }
+    else
+      table[j] = query[j] - m_center[j];
+    table[m_dimension+j] = m_scale[j];
+  }
+  table[2*m_dimension] = bias;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: bytes are widened to 16 then 32 bits and converted to
+// floats in registers, 16 dimensions per iteration.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ScalarQuantizer::distances
+  (
+  const float *table,
+  const unsigned char *codes,
+  unsigned int num_codes,
+  size_t stride,
+  float *output
+  ) const
+{
+  const float *weights = table, *scales = table+m_dimension;
+  const bool cosine = (m_metric == GalleryMetric::cosine);
+  for (unsigned int i=0; i < num_codes; i++, codes+=stride)
+  {
+    const signed char *values = reinterpret_cast<const signed char*>(codes);
+    unsigned int j = 0;
+    float sum = 0.0f;
+#if CV_SIMD128
+    cv::v_float32x4 acc = cv::v_setzero_f32();
+    for (; j+SQ_BLOCK <= m_dimension; j+=SQ_BLOCK)
+    {
+      cv::v_int16x8 lo, hi;
+      cv::v_expand(cv::v_load(values+j), lo, hi);
+      cv::v_int32x4 quarters[4];
+      cv::v_expand(lo, quarters[0], quarters[1]);
+      cv::v_expand(hi, quarters[2], quarters[3]);
+      for (unsigned int q=0; q < 4; q++)
+      {
+        const cv::v_float32x4 level = cv::v_cvt_f32(quarters[q]);
+        const cv::v_float32x4 weight = cv::v_load(weights+j+4*q);
+        if (cosine)
+          acc = cv::v_muladd(weight, level, acc);
+        else
+        {
+          const cv::v_float32x4 residual = weight - cv::v_load(scales+j+4*q)*level;
+          acc = cv::v_muladd(residual, residual, acc);
+        }
+      }
+    }
+    sum = cv::v_reduce_sum(acc);
+#endif
+    if (cosine)
+    {
+      for (; j < m_dimension; j++)
+        sum += weights[j] * values[j];
+      output[i] = 1.0f - (table[2*m_dimension]+sum);
+    }
+    else
+    {
+      for (; j < m_dimension; j++)
+      {
+        const float residual = weights[j] - scales[j]*values[j];
+        sum += residual * residual;
+      }
+      output[i] = sum;
+    }
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: a code is one byte per subspace.
+//
+// -----------------------------------------------------------------------------
+ProductQuantizer::ProductQuantizer
+  (
+  unsigned int num_subspaces,
+  unsigned int num_centroids
+  ) :
+  m_num_subspaces(std::max(num_subspaces, 1U)),
+  m_num_centroids(std::max(std::min(num_centroids, 256U), 1U)),
+  m_subspace_dim(0),
+  m_metric(GalleryMetric::cosine)
+{
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: independent k-means++ per subspace. Fewer samples than
+// centroids reduce the number of centroids.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+ProductQuantizer::train
+  (
+  const cv::Mat &samples,
+  GalleryMetric metric
+  )
+{
+  if ((samples.rows == 0) or (samples.cols % m_num_subspaces != 0))
+  {
+    UPM_ERROR("ProductQuantizer: " << samples.rows << " samples of dimension " << samples.cols << " cannot be split in " << m_num_subspaces << " subspaces");
+    return false;
+  }
+  m_metric = metric;
+  m_subspace_dim = static_cast<unsigned int>(samples.cols) / m_num_subspaces;
+  m_num_centroids = std::min(m_num_centroids, static_cast<unsigned int>(samples.rows));
+  m_centroids.create(m_num_subspaces*m_num_centroids, m_subspace_dim, CV_32F);
+  for (unsigned int j=0; j < m_num_subspaces; j++)
+  {
+    cv::Mat subspace = samples.colRange(j*m_subspace_dim, (j+1)*m_subspace_dim).clone();
+    cv::Mat labels, centers;
+    cv::kmeans(subspace, m_num_centroids, labels, cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 25, 1e-4), 1, cv::KMEANS_PP_CENTERS, centers);
+    centers.copyTo(m_centroids.rowRange(j*m_num_centroids, (j+1)*m_num_centroids));
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ProductQuantizer::encode
+  (
+  const float *embedding,
+  unsigned char *code
+  ) const
+{
+  for (unsigned int j=0; j < m_num_subspaces; j++)
+  {
+    const float *chunk = embedding + j*m_subspace_dim;
+    float best = FLT_MAX;
+    for (unsigned int c=0; c < m_num_centroids; c++)
+    {
+      const float *centroid = m_centroids.ptr<float>(j*m_num_centroids+c);
+      float dist = 0.0f;
+      for (unsigned int d=0; d < m_subspace_dim; d++)
+        dist += (chunk[d]-centroid[d]) * (chunk[d]-centroid[d]);
+      if (dist < best)
+      {
+        best = dist;
+        code[j] = static_cast<unsigned char>(c);
+      }
+    }
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ProductQuantizer::decode
+  (
+  const unsigned char *code,
+  float *embedding
+  ) const
+{
+  for (unsigned int j=0; j < m_num_subspaces; j++)
+  {
+    const float *centroid = m_centroids.ptr<float>(j*m_num_centroids+code[j]);
+    std::copy(centroid, centroid+m_subspace_dim, embedding+j*m_subspace_dim);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ProductQuantizer::serialize
+  (
+  std::vector<unsigned char> &buffer
+  ) const
+{
+  const unsigned int header[5] = {product_tag, m_num_subspaces, m_num_centroids, m_subspace_dim, static_cast<unsigned int>(m_metric)};
+  appendValues(buffer, header, 5);
+  for (int i=0; i < m_centroids.rows; i++)
+    appendValues(buffer, m_centroids.ptr<float>(i), m_subspace_dim);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+ProductQuantizer::restore
+  (
+  const unsigned char *data,
+  size_t size
+  )
+{
+  unsigned int header[4];
+  if (not readValues(data, size, header, 4))
+    return false;
+  /// Codes are one byte per subspace, so at most 256 centroids
+  if ((header[0] == 0) or (header[1] == 0) or (header[1] > 256) or (header[3] > static_cast<unsigned int>(GalleryMetric::l2)))
+    return false;
+  if (static_cast<unsigned long long>(header[0])*header[2] > std::numeric_limits<int>::max())
+    return false;
+  if (size < static_cast<unsigned long long>(header[0])*header[1]*header[2]*sizeof(float))
+    return false;
+  m_num_subspaces = header[0];
+  m_num_centroids = header[1];
+  m_subspace_dim = header[2];
+  m_metric = static_cast<GalleryMetric>(header[3]);
+  m_centroids.create(m_num_subspaces*m_num_centroids, m_subspace_dim, CV_32F);
+  for (int i=0; i < m_centroids.rows; i++)
+    if (not readValues(data, size, m_centroids.ptr<float>(i), m_subspace_dim))
+      return false;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: entry (j,c) is the contribution of centroid c of
+// subspace j, the negated partial dot product for the cosine metric.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ProductQuantizer::prepare
+  (
+  const float *query,
+  std::vector<float> &table
+  ) const
+{
+  table.resize(m_num_subspaces*m_num_centroids);
+  for (unsigned int j=0; j < m_num_subspaces; j++)
+  {
+    const float *chunk = query + j*m_subspace_dim;
+    for (unsigned int c=0; c < m_num_centroids; c++)
+    {
+      const float *centroid = m_centroids.ptr<float>(j*m_num_centroids+c);
+      float value = 0.0f;
+      if (m_metric == GalleryMetric::cosine)
+        for (unsigned int d=0; d < m_subspace_dim; d++)
+          value -= chunk[d] * centroid[d];
+      else
+        for (unsigned int d=0; d < m_subspace_dim; d++)
+          value += (chunk[d]-centroid[d]) * (chunk[d]-centroid[d]);
+      table[j*m_num_centroids+c] = value;
+    }
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ProductQuantizer::distances
+  (
+  const float *table,
+  const unsigned char *codes,
+  unsigned int num_codes,
+  size_t stride,
+  float *output
+  ) const
+{
+  const float offset = (m_metric == GalleryMetric::cosine) ? 1.0f : 0.0f;
+  for (unsigned int i=0; i < num_codes; i++, codes+=stride)
+  {
+    float sum = offset;
+    const float *subtable = table;
+    for (unsigned int j=0; j < m_num_subspaces; j++, subtable+=m_num_centroids)
+      sum += subtable[codes[j]];
+    output[i] = sum;
+  }
+};
+
+} // namespace upm
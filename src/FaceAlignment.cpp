@@ -10,8 +10,11 @@
 // ----------------------- INCLUDES --------------------------------------------
 #include <trace.hpp>
 #include <utils.hpp>
+#include <LandmarkSchema.hpp>
 #include <FaceAlignment.hpp>
+#include <DatasetLoader.hpp>
 #include <numeric>
+#include <unordered_map>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
@@ -38,7 +41,9 @@ FaceAlignment::parseOptions
   po::options_description desc("FaceAlignment options");
   desc.add_options()
     ("measure", po::value<std::string>()->default_value("height"), "Select measure [pupils, corners, height, diagonal]")
-    ("database", po::value<std::string>()->default_value("aflw"), "Choose database [300w_public, 300w_private, cofw, aflw, wflw, ls3dw, 300wlp, menpo, 3dmenpo, all]");
+    ("database", po::value<std::string>()->default_value("aflw"), "Choose database [300w_public, 300w_private, cofw, aflw, wflw, ls3dw, 300wlp, menpo, 3dmenpo, all]")
+    ("annotations", po::value<std::string>()->default_value(""), "Directory with the annotations of the database")
+    ("annotations-cache", po::value<std::string>()->default_value(""), "Binary cache of the parsed annotations");
   UPM_PRINT(desc);
 
   // Process the command line parameters
@@ -56,6 +61,26 @@ FaceAlignment::parseOptions
 
   if (vm.count("database"))
     _database = vm["database"].as<std::string>();
+  _annotations_path = vm["annotations"].as<std::string>();
+  _annotations_cache = vm["annotations-cache"].as<std::string>();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+FaceAlignment::loadAnnotations
+  (
+  std::vector<FaceAnnotation> &anns
+  ) const
+{
+  return loadDatabase(_database, _annotations_path, _annotations_cache, anns);
 };
 
 // -----------------------------------------------------------------------------
@@ -106,6 +131,33 @@ FaceAlignment::show
       }
 };
 
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: occlusion of the landmarks 'indices' for databases
+// without schema, read from a feature id table filled once per annotation.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: every id in 'indices' must be labelled in 'ann'.
+//
+// -----------------------------------------------------------------------------
+static void
+getOcclusions
+  (
+  const FaceAnnotation &ann,
+  const std::vector<unsigned int> &indices,
+  std::vector<float> &occlusions
+  )
+{
+  std::unordered_map<unsigned int,float> occluded;
+  for (const FacePart &part : ann.parts)
+    for (const FaceLandmark &landmark : part.landmarks)
+      occluded.emplace(landmark.feature_idx, landmark.occluded);
+  occlusions.reserve(occlusions.size()+indices.size());
+  for (unsigned int idx : indices)
+    occlusions.push_back(occluded.at(idx));
+};
+
 // -----------------------------------------------------------------------------
 //
 // Purpose and Method:
@@ -129,30 +181,17 @@ FaceAlignment::evaluate
     *output << getComponentClass() << " " << ann.filename;
     std::vector<unsigned int> indices;
     std::vector<float> errors;
-    getNormalizedErrors(face, ann, _measure, indices, errors);
-    for (unsigned int j=0; j < indices.size(); j++)
+    if (not getNormalizedErrors(_database, face, ann, _measure, indices, errors))
+      getNormalizedErrors(face, ann, _measure, indices, errors);
+    std::vector<float> ann_occlusions, face_occlusions;
+    if (not (getOcclusions(_database, ann, indices, ann_occlusions) and getOcclusions(_database, face, indices, face_occlusions)))
     {
-      unsigned int idx = indices[j];
-      *output << " " << idx << " " << errors[j];
-      for (const FacePart &ann_part : ann.parts)
-      {
-        auto found = std::find_if(ann_part.landmarks.begin(), ann_part.landmarks.end(), [&idx](const FaceLandmark &obj){return obj.feature_idx == idx;});
-        if (found != ann_part.landmarks.end())
-        {
-          *output << " " << (*found).occluded;
-          break;
-        }
-      }
-      for (const FacePart &face_part : face.parts)
-      {
-        auto found = std::find_if(face_part.landmarks.begin(), face_part.landmarks.end(), [&idx](const FaceLandmark &obj){return obj.feature_idx == idx;});
-        if (found != face_part.landmarks.end())
-        {
-          *output << " " << (*found).occluded;
-          break;
-        }
-      }
+      ann_occlusions.clear();
+      getOcclusions(ann, indices, ann_occlusions);
+      getOcclusions(face, indices, face_occlusions);
     }
+    for (unsigned int j=0; j < indices.size(); j++)
+      *output << " " << indices[j] << " " << errors[j] << " " << ann_occlusions[j] << " " << face_occlusions[j];
     *output << std::endl;
   }
 };
@@ -170,6 +209,7 @@ void
 FaceAlignment::save
   (
   const std::string dirpath,
+  cv::Mat frame,
   const std::vector<FaceAnnotation> &faces,
   const FaceAnnotation &ann
   )
@@ -185,7 +225,7 @@ FaceAlignment::save
   const int radius = MAX(static_cast<int>(roundf(ann.bbox.pos.height*0.01f)), 3);
   const int thickness = MAX(static_cast<int>(roundf(ann.bbox.pos.height*0.005f)), 2);
   cv::Scalar cyan_color(255,122,0), blue_color(255,0,0), green_color(0,255,0), red_color(0,0,255);
-  cv::Mat image = cv::imread(ann.filename, cv::IMREAD_COLOR);
+  cv::Mat image = frame.clone();
   for (const FacePart &ann_part : ann.parts)
     for (auto it=ann_part.landmarks.begin(), next=std::next(it); it < ann_part.landmarks.end(); it++, next++)
     {
@@ -0,0 +1,464 @@
+/** ****************************************************************************
+ *  @file    FaceAnnotationCodec.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <FaceAnnotationCodec.hpp>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+
+namespace upm {
+
+const unsigned char ANNOTATIONS_MAGIC[8] = {'U','P','M','F','A','C','E','S'};
+/// Magic, version, count
+const size_t ANNOTATIONS_HEADER_SIZE = 16;
+/// Filename length, detector index, box, score, head pose and attributes
+const size_t RECORD_FIXED_SIZE = 4 + 4 + 4*4 + 4 + 3*4 + 7*4 + 1;
+/// Label and landmark count of a part
+const size_t PART_SIZE = 1 + 2;
+/// Feature id, position and occlusion of a landmark
+const size_t LANDMARK_SIZE = 2 + 3*4;
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: byte by byte little-endian stores and loads, which the
+// compiler turns into plain moves on little-endian hosts.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline unsigned char *
+putU16
+  (
+  unsigned char *out,
+  uint16_t value
+  )
+{
+  out[0] = static_cast<unsigned char>(value);
+  out[1] = static_cast<unsigned char>(value >> 8);
+  return out+2;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline unsigned char *
+putU32
+  (
+  unsigned char *out,
+  uint32_t value
+  )
+{
+  for (unsigned int i=0; i < 4; i++)
+    out[i] = static_cast<unsigned char>(value >> (8*i));
+  return out+4;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline unsigned char *
+putU64
+  (
+  unsigned char *out,
+  uint64_t value
+  )
+{
+  for (unsigned int i=0; i < 8; i++)
+    out[i] = static_cast<unsigned char>(value >> (8*i));
+  return out+8;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline unsigned char *
+putF32
+  (
+  unsigned char *out,
+  float value
+  )
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return putU32(out, bits);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline uint16_t
+getU16
+  (
+  const unsigned char *in
+  )
+{
+  return static_cast<uint16_t>(in[0] | (in[1] << 8));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline uint32_t
+getU32
+  (
+  const unsigned char *in
+  )
+{
+  uint32_t value = 0;
+  for (unsigned int i=0; i < 4; i++)
+    value |= static_cast<uint32_t>(in[i]) << (8*i);
+  return value;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline uint64_t
+getU64
+  (
+  const unsigned char *in
+  )
+{
+  uint64_t value = 0;
+  for (unsigned int i=0; i < 8; i++)
+    value |= static_cast<uint64_t>(in[i]) << (8*i);
+  return value;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline float
+getF32
+  (
+  const unsigned char *in
+  )
+{
+  const uint32_t bits = getU32(in);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+size_t
+getEncodedSize
+  (
+  const upm::FaceAnnotation &ann
+  )
+{
+  if ((ann.filename.size() > UINT32_MAX) or (ann.parts.size() > UINT8_MAX))
+    return 0;
+  size_t size = RECORD_FIXED_SIZE + ann.filename.size();
+  for (const FacePart &part : ann.parts)
+  {
+    if (part.landmarks.size() > UINT16_MAX)
+      return 0;
+    for (const FaceLandmark &landmark : part.landmarks)
+      if (landmark.feature_idx > UINT16_MAX)
+        return 0;
+    size += PART_SIZE + part.landmarks.size()*LANDMARK_SIZE;
+  }
+  return size;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: 'out' must hold getEncodedSize(ann) bytes.
+//
+// -----------------------------------------------------------------------------
+static unsigned char *
+writeRecord
+  (
+  const upm::FaceAnnotation &ann,
+  unsigned char *out
+  )
+{
+  out = putU32(out, static_cast<uint32_t>(ann.filename.size()));
+  memcpy(out, ann.filename.data(), ann.filename.size());
+  out += ann.filename.size();
+  out = putU32(out, ann.bbox.detector_idx);
+  out = putF32(out, ann.bbox.pos.x);
+  out = putF32(out, ann.bbox.pos.y);
+  out = putF32(out, ann.bbox.pos.width);
+  out = putF32(out, ann.bbox.pos.height);
+  out = putF32(out, ann.bbox.score);
+  out = putF32(out, ann.headpose.x);
+  out = putF32(out, ann.headpose.y);
+  out = putF32(out, ann.headpose.z);
+  const FaceAttribute &attribute = ann.attribute;
+  for (float value : {attribute.male, attribute.age, attribute.glasses, attribute.hat, attribute.moustache, attribute.beard, attribute.fake})
+    out = putF32(out, value);
+  *out++ = static_cast<unsigned char>(ann.parts.size());
+  for (const FacePart &part : ann.parts)
+  {
+    *out++ = static_cast<unsigned char>(part.label);
+    out = putU16(out, static_cast<uint16_t>(part.landmarks.size()));
+    for (const FaceLandmark &landmark : part.landmarks)
+    {
+      out = putU16(out, static_cast<uint16_t>(landmark.feature_idx));
+      out = putF32(out, landmark.pos.x);
+      out = putF32(out, landmark.pos.y);
+      out = putF32(out, landmark.occluded);
+    }
+  }
+  return out;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+encodeAnnotation
+  (
+  const upm::FaceAnnotation &ann,
+  std::vector<unsigned char> &buffer
+  )
+{
+  const size_t size = getEncodedSize(ann);
+  if (size == 0)
+  {
+    UPM_ERROR("Annotation of " << ann.filename << " cannot be encoded");
+    return false;
+  }
+  const size_t offset = buffer.size();
+  buffer.resize(offset+size);
+  writeRecord(ann, buffer.data()+offset);
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: sizes are checked before each variable-length section,
+// fixed fields are then read without further checks.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+decodeAnnotation
+  (
+  const unsigned char *&data,
+  size_t &size,
+  upm::FaceAnnotation &ann
+  )
+{
+  const unsigned char *in = data, *end = data+size;
+  if (size < RECORD_FIXED_SIZE)
+    return false;
+  const uint32_t length = getU32(in);
+  in += 4;
+  if (static_cast<size_t>(end-in) < length+RECORD_FIXED_SIZE-4)
+    return false;
+  ann.filename.assign(reinterpret_cast<const char*>(in), length);
+  in += length;
+  ann.bbox.detector_idx = getU32(in);
+  ann.bbox.pos = cv::Rect_<float>(getF32(in+4), getF32(in+8), getF32(in+12), getF32(in+16));
+  ann.bbox.score = getF32(in+20);
+  ann.headpose = cv::Point3f(getF32(in+24), getF32(in+28), getF32(in+32));
+  in += 36;
+  float row[7];
+  for (unsigned int i=0; i < 7; i++, in+=4)
+    row[i] = getF32(in);
+  ann.attribute = {row[0], row[1], row[2], row[3], row[4], row[5], row[6]};
+  ann.parts.resize(*in++);
+  for (FacePart &part : ann.parts)
+  {
+    if (static_cast<size_t>(end-in) < PART_SIZE)
+      return false;
+    if (in[0] > chin)
+      return false;
+    part.label = static_cast<FacePartLabel>(in[0]);
+    const uint16_t num_landmarks = getU16(in+1);
+    in += PART_SIZE;
+    if (static_cast<size_t>(end-in) < num_landmarks*LANDMARK_SIZE)
+      return false;
+    part.landmarks.resize(num_landmarks);
+    for (FaceLandmark &landmark : part.landmarks)
+    {
+      landmark.feature_idx = getU16(in);
+      landmark.pos = cv::Point2f(getF32(in+2), getF32(in+6));
+      landmark.occluded = getF32(in+10);
+      in += LANDMARK_SIZE;
+    }
+  }
+  size -= in-data;
+  data = in;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: record sizes are computed first, so the buffer is
+// allocated once and every record written in place by its own thread.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+encodeAnnotations
+  (
+  const std::vector<upm::FaceAnnotation> &anns,
+  std::vector<unsigned char> &buffer
+  )
+{
+  const size_t num_anns = anns.size();
+  if (num_anns > UINT32_MAX)
+    return false;
+  std::vector<uint64_t> offsets(num_anns+1, 0);
+  for (size_t i=0; i < num_anns; i++)
+  {
+    const size_t size = getEncodedSize(anns[i]);
+    if (size == 0)
+    {
+      UPM_ERROR("Annotation of " << anns[i].filename << " cannot be encoded");
+      return false;
+    }
+    offsets[i+1] = offsets[i] + size;
+  }
+  const size_t start = buffer.size();
+  const size_t table_size = (num_anns+1)*8;
+  buffer.resize(start+ANNOTATIONS_HEADER_SIZE+table_size+offsets[num_anns]);
+  unsigned char *out = buffer.data()+start;
+  memcpy(out, ANNOTATIONS_MAGIC, sizeof(ANNOTATIONS_MAGIC));
+  out = putU32(out+sizeof(ANNOTATIONS_MAGIC), ANNOTATION_CODEC_VERSION);
+  out = putU32(out, static_cast<uint32_t>(num_anns));
+  for (uint64_t offset : offsets)
+    out = putU64(out, offset);
+  cv::parallel_for_(cv::Range(0,static_cast<int>(num_anns)), [&](const cv::Range &range)
+  {
+    for (int i=range.start; i < range.end; i++)
+      writeRecord(anns[i], out+offsets[i]);
+  });
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: each record must be consumed exactly by its slot in the
+// offset table.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+decodeAnnotations
+  (
+  const unsigned char *data,
+  size_t size,
+  std::vector<upm::FaceAnnotation> &anns
+  )
+{
+  if ((size < ANNOTATIONS_HEADER_SIZE) or (memcmp(data, ANNOTATIONS_MAGIC, sizeof(ANNOTATIONS_MAGIC)) != 0) or (getU32(data+8) != ANNOTATION_CODEC_VERSION))
+    return false;
+  const size_t num_anns = getU32(data+12);
+  const size_t table_size = (num_anns+1)*8;
+  if (size-ANNOTATIONS_HEADER_SIZE < table_size)
+    return false;
+  const unsigned char *table = data+ANNOTATIONS_HEADER_SIZE;
+  const unsigned char *records = table+table_size;
+  const size_t records_size = size-ANNOTATIONS_HEADER_SIZE-table_size;
+  if ((getU64(table) != 0) or (getU64(table+num_anns*8) != records_size))
+    return false;
+
+  std::vector<FaceAnnotation> decoded(num_anns);
+  std::atomic<bool> corrupt(false);
+  cv::parallel_for_(cv::Range(0,static_cast<int>(num_anns)), [&](const cv::Range &range)
+  {
+    for (int i=range.start; (i < range.end) and (not corrupt); i++)
+    {
+      const uint64_t begin = getU64(table+i*8), end = getU64(table+(i+1)*8);
+      if ((begin > end) or (end > records_size))
+      {
+        corrupt = true;
+        break;
+      }
+      const unsigned char *record = records+begin;
+      size_t record_size = static_cast<size_t>(end-begin);
+      if ((not decodeAnnotation(record, record_size, decoded[i])) or (record_size != 0))
+        corrupt = true;
+    }
+  });
+  if (corrupt)
+    return false;
+  anns.swap(decoded);
+  return true;
+};
+
+} // namespace upm
@@ -0,0 +1,136 @@
+/** ****************************************************************************
+ *  @file    FaceCropBatch.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceCropBatch.hpp>
+#include <utils.hpp>
+
+namespace upm {
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: each face is warped with a single affine transformation
+// (crop, scale and zero padding outside the frame) and its channels are
+// converted straight into the planes of the blob.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the blob keeps the BGR order of the frame.
+//
+// -----------------------------------------------------------------------------
+void
+FaceCropBatch::extract
+  (
+  cv::Mat frame,
+  const std::vector<FaceAnnotation> &faces
+  )
+{
+  clear();
+  append(frame, faces);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: growing the buffer keeps the patches already extracted.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceCropBatch::append
+  (
+  cv::Mat frame,
+  const std::vector<FaceAnnotation> &faces
+  )
+{
+  const unsigned int first = m_num_faces;
+  m_num_faces += static_cast<unsigned int>(faces.size());
+  if (m_num_faces > m_capacity)
+  {
+    m_capacity = std::max(m_num_faces, m_capacity*2);
+    cv::Mat buffer(1, static_cast<int>(m_capacity*m_channels*m_size.area()), CV_32F);
+    if (first > 0)
+      m_buffer.colRange(0, static_cast<int>(first*m_channels*m_size.area())).copyTo(buffer.colRange(0, static_cast<int>(first*m_channels*m_size.area())));
+    m_buffer = buffer;
+  }
+  m_transforms.resize(m_num_faces);
+
+  cv::parallel_for_(cv::Range(first,m_num_faces), [&](const cv::Range &range)
+  {
+    cv::Mat patch, patch_gray, patch_float;
+    std::vector<cv::Mat> planes(m_channels);
+    for (int i=range.start; i < range.end; i++)
+    {
+      const cv::Rect_<float> roi = getEnlargedBbox(getBbox(faces[i-first]), m_bbox_scale);
+      const double sx = m_size.width / static_cast<double>(roi.width), sy = m_size.height / static_cast<double>(roi.height);
+      m_transforms[i] = (cv::Mat_<double>(2,3) << sx, 0.0, -roi.x*sx, 0.0, sy, -roi.y*sy);
+      cv::warpAffine(frame, patch, m_transforms[i], m_size, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+      for (int c=0; c < m_channels; c++)
+        planes[c] = getPatch(static_cast<unsigned int>(i), static_cast<unsigned int>(c));
+      if (patch.channels() == m_channels)
+      {
+        patch.convertTo(patch_float, CV_32F, 1.0/255.0);
+        cv::split(patch_float, planes);
+      }
+      else if (m_channels == 1)
+      {
+        cv::cvtColor(patch, patch_gray, cv::COLOR_BGR2GRAY);
+        patch_gray.convertTo(planes[0], CV_32F, 1.0/255.0);
+      }
+      else
+      {
+        cv::cvtColor(patch, patch_gray, cv::COLOR_GRAY2BGR);
+        patch_gray.convertTo(patch_float, CV_32F, 1.0/255.0);
+        cv::split(patch_float, planes);
+      }
+    }
+  });
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FaceCropBatch::getBlob() const
+{
+  if (m_num_faces == 0)
+    return cv::Mat();
+  const int sizes[] = {static_cast<int>(m_num_faces), m_channels, m_size.height, m_size.width};
+  return cv::Mat(4, sizes, CV_32F, m_buffer.data);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FaceCropBatch::getPatch
+  (
+  unsigned int idx,
+  unsigned int channel
+  ) const
+{
+  float *data = reinterpret_cast<float*>(m_buffer.data) + (idx*m_channels + channel)*m_size.area();
+  return cv::Mat(m_size, CV_32F, data);
+};
+
+} // namespace upm
@@ -11,6 +11,7 @@
 #include <trace.hpp>
 #include <utils.hpp>
 #include <FaceDetector.hpp>
+#include <DetectionUtils.hpp>
 
 namespace upm {
 
@@ -42,30 +43,6 @@ FaceDetector::show
     viewer->rectangle(face.bbox.pos.x, face.bbox.pos.y, face.bbox.pos.width, face.bbox.pos.height, thickness, green_color);
 };
 
-float
-areaIntersection
-  (
-  const cv::Rect &ann_rect,
-  const cv::Rect &face_rect
-  )
-{
-  const int max_x = MAX(ann_rect.x, face_rect.x);
-  const int max_y = MAX(ann_rect.y, face_rect.y);
-  const int min_w = MIN(ann_rect.x+ann_rect.width, face_rect.x+face_rect.width) - max_x;
-  const int min_h = MIN(ann_rect.y+ann_rect.height, face_rect.y+face_rect.height) - max_y;
-  return ((min_w < 0) or (min_h < 0)) ? 0 :  min_w*min_h;
-};
-
-float
-areaUnion
-  (
-  const cv::Rect &ann_rect,
-  const cv::Rect &face_rect
-  )
-{
-  return (ann_rect.width*ann_rect.height) + (face_rect.width*face_rect.height) - areaIntersection(ann_rect, face_rect);
-};
-
 // -----------------------------------------------------------------------------
 //
 // Purpose and Method:
@@ -86,9 +63,14 @@ FaceDetector::evaluate
   // Ratio of intersected areas
   for (const FaceAnnotation &face : faces)
   {
-    float ratio = areaIntersection(ann.bbox.pos, face.bbox.pos) / areaUnion(ann.bbox.pos, face.bbox.pos);
+    float ratio = computeIoU(ann.bbox.pos, face.bbox.pos);
     *output << getComponentClass() << " " << ann.filename << " " << ann.bbox.pos << " " << face.bbox.pos << " " << face.bbox.detector_idx << " " << ratio << std::endl;
   }
+  // Accumulate matches to compute precision/recall, AP and ROC in-process
+  std::vector<FaceAnnotation> anns;
+  if (ann.bbox.pos != FaceAnnotation().bbox.pos)
+    anns.push_back(ann);
+  m_evaluator.addImage(faces, anns);
 };
 
 // -----------------------------------------------------------------------------
@@ -104,6 +86,7 @@ void
 FaceDetector::save
   (
   const std::string dirpath,
+  cv::Mat frame,
   const std::vector<upm::FaceAnnotation> &faces,
   const upm::FaceAnnotation &ann
   )
@@ -113,13 +96,13 @@ FaceDetector::save
   int thickness = MAX(static_cast<int>(roundf(ann.bbox.pos.height*0.01f)), 3);
   cv::Scalar cyan_color(255,122,0), green_color(0,255,0), red_color(0,0,255);
   float max_ratio = FLT_MIN;
-  cv::Mat image = cv::imread(ann.filename, cv::IMREAD_COLOR);
+  cv::Mat image = frame.clone();
   cv::rectangle(image, ann.bbox.pos.tl(), ann.bbox.pos.br(), cyan_color, thickness);
   for (const FaceAnnotation &face : faces)
   {
     cv::rectangle(image, face.bbox.pos.tl(), face.bbox.pos.br(), green_color, thickness);
     // Ratio of intersected areas
-    float ratio = areaIntersection(ann.bbox.pos, face.bbox.pos) / areaUnion(ann.bbox.pos, face.bbox.pos);
+    float ratio = computeIoU(ann.bbox.pos, face.bbox.pos);
     if (ratio > max_ratio)
       max_ratio = ratio;
   }
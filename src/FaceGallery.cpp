@@ -0,0 +1,1128 @@
+/** ****************************************************************************
+ *  @file    FaceGallery.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FaceGallery.hpp>
+#include <EmbeddingCodec.hpp>
+#include <trace.hpp>
+#include <mutex>
+#include <queue>
+#include <cmath>
+#include <chrono>
+#include <iomanip>
+#include <functional>
+#include <boost/thread/locks.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace upm {
+
+const unsigned int SIMD_WIDTH = 4;
+/// Below this number of slots an exact scan is not worth splitting in threads
+const unsigned int PARALLEL_SCAN_SLOTS = 32768;
+const unsigned int MIN_CAPACITY = 64;
+/// Distances are computed a block of slots at a time
+const unsigned int SCAN_BLOCK = 256;
+/// Codecs are trained on an evenly spaced subset of large galleries
+const unsigned int MAX_TRAINING_SAMPLES = 65536;
+
+typedef std::pair<float,unsigned int> Candidate;
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: two accumulators hide the latency of the multiply-add.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static float
+dotKernel
+  (
+  const float *a,
+  const float *b,
+  unsigned int length
+  )
+{
+  unsigned int i = 0;
+  float sum = 0.0f;
+#if CV_SIMD128
+  cv::v_float32x4 acc0 = cv::v_setzero_f32(), acc1 = cv::v_setzero_f32();
+  for (; i+2*SIMD_WIDTH <= length; i+=2*SIMD_WIDTH)
+  {
+    acc0 = cv::v_muladd(cv::v_load(a+i), cv::v_load(b+i), acc0);
+    acc1 = cv::v_muladd(cv::v_load(a+i+SIMD_WIDTH), cv::v_load(b+i+SIMD_WIDTH), acc1);
+  }
+  for (; i+SIMD_WIDTH <= length; i+=SIMD_WIDTH)
+    acc0 = cv::v_muladd(cv::v_load(a+i), cv::v_load(b+i), acc0);
+  sum = cv::v_reduce_sum(acc0 + acc1);
+#endif
+  for (; i < length; i++)
+    sum += a[i] * b[i];
+  return sum;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static float
+l2Kernel
+  (
+  const float *a,
+  const float *b,
+  unsigned int length
+  )
+{
+  unsigned int i = 0;
+  float sum = 0.0f;
+#if CV_SIMD128
+  cv::v_float32x4 acc0 = cv::v_setzero_f32(), acc1 = cv::v_setzero_f32();
+  for (; i+2*SIMD_WIDTH <= length; i+=2*SIMD_WIDTH)
+  {
+    cv::v_float32x4 d0 = cv::v_load(a+i) - cv::v_load(b+i);
+    cv::v_float32x4 d1 = cv::v_load(a+i+SIMD_WIDTH) - cv::v_load(b+i+SIMD_WIDTH);
+    acc0 = cv::v_muladd(d0, d0, acc0);
+    acc1 = cv::v_muladd(d1, d1, acc1);
+  }
+  for (; i+SIMD_WIDTH <= length; i+=SIMD_WIDTH)
+  {
+    cv::v_float32x4 d = cv::v_load(a+i) - cv::v_load(b+i);
+    acc0 = cv::v_muladd(d, d, acc0);
+  }
+  sum = cv::v_reduce_sum(acc0 + acc1);
+#endif
+  for (; i < length; i++)
+    sum += (a[i]-b[i]) * (a[i]-b[i]);
+  return sum;
+};
+
+/** ****************************************************************************
+ * @class VisitedList
+ * @brief Visit marks of a graph search. Marks are epoch numbers so clearing
+ * them between searches is a single increment.
+ ******************************************************************************/
+class VisitedList
+{
+public:
+  VisitedList() : m_epoch(0) {};
+
+  void
+  reset
+    (
+    unsigned int num_nodes
+    )
+  {
+    if (m_tags.size() < num_nodes)
+      m_tags.resize(num_nodes, 0);
+    if (++m_epoch == 0)
+    {
+      std::fill(m_tags.begin(), m_tags.end(), 0);
+      m_epoch = 1;
+    }
+  };
+
+  /// Returns whether the node had already been visited
+  bool
+  visit
+    (
+    unsigned int node
+    )
+  {
+    if (m_tags[node] == m_epoch)
+      return true;
+    m_tags[node] = m_epoch;
+    return false;
+  };
+
+private:
+  unsigned int m_epoch;
+  std::vector<unsigned int> m_tags;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+FaceGallery::FaceGallery
+  (
+  unsigned int dimension,
+  GalleryMetric metric
+  ) :
+  m_dimension(dimension),
+  m_padded((dimension+SIMD_WIDTH-1) / SIMD_WIDTH * SIMD_WIDTH),
+  m_metric(metric),
+  m_has_embeddings(true),
+  m_capacity(0),
+  m_num_slots(0),
+  m_index_enabled(false),
+  m_M(16),
+  m_ef_construction(200),
+  m_ef_search(64),
+  m_level_mult(1.0/std::log(16.0)),
+  m_rng(0x9e3779b9),
+  m_entry(0),
+  m_max_level(-1),
+  m_rerank(0)
+{
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::enableIndex
+  (
+  unsigned int M,
+  unsigned int ef_construction,
+  unsigned int ef_search
+  )
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  if (not m_has_embeddings)
+  {
+    UPM_ERROR("FaceGallery: the HNSW index needs the float embeddings");
+    return;
+  }
+  m_index_enabled = true;
+  m_M = std::max(M, 2U);
+  m_ef_construction = std::max(ef_construction, m_M);
+  m_ef_search = std::max(ef_search, 1U);
+  m_level_mult = 1.0 / std::log(static_cast<double>(m_M));
+  m_links.assign(m_num_slots, std::vector< std::vector<unsigned int> >());
+  m_max_level = -1;
+  for (unsigned int slot=0; slot < m_num_slots; slot++)
+    if (not m_deleted[slot])
+      indexSlot(slot);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::setEfSearch
+  (
+  unsigned int ef_search
+  )
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  m_ef_search = std::max(ef_search, 1U);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the gallery must hold the float embeddings of the
+// identities the codec is trained on.
+//
+// -----------------------------------------------------------------------------
+bool
+FaceGallery::setCodec
+  (
+  const boost::shared_ptr<EmbeddingCodec> &codec,
+  bool keep_embeddings
+  )
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  if ((not m_has_embeddings) or m_slots.empty())
+  {
+    UPM_ERROR("FaceGallery: a codec must be trained on enrolled float embeddings");
+    return false;
+  }
+  std::vector<unsigned int> live;
+  for (unsigned int slot=0; slot < m_num_slots; slot++)
+    if (not m_deleted[slot])
+      live.push_back(slot);
+  const unsigned int num_samples = std::min(static_cast<unsigned int>(live.size()), MAX_TRAINING_SAMPLES);
+  cv::Mat samples(num_samples, m_padded, CV_32F);
+  for (unsigned int i=0; i < num_samples; i++)
+    m_embeddings.row(live[static_cast<unsigned long>(i)*live.size()/num_samples]).copyTo(samples.row(i));
+  if (not codec->train(samples, m_metric))
+    return false;
+  m_codec = codec;
+  m_codes = cv::Mat(m_capacity, m_codec->getCodeSize(), CV_8U);
+  for (unsigned int slot=0; slot < m_num_slots; slot++)
+    m_codec->encode(m_embeddings.ptr<float>(slot), m_codes.ptr<unsigned char>(slot));
+  if (not keep_embeddings)
+  {
+    m_embeddings.release();
+    m_has_embeddings = false;
+    m_index_enabled = false;
+    m_links.clear();
+    m_max_level = -1;
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::setRerank
+  (
+  unsigned int num_candidates
+  )
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  m_rerank = num_candidates;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::insert
+  (
+  int id,
+  const float *embedding
+  )
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  std::unordered_map<int,unsigned int>::iterator it = m_slots.find(id);
+  if (it != m_slots.end())
+    m_deleted[it->second] = 1;
+  const unsigned int slot = addSlot(id, embedding);
+  m_slots[id] = slot;
+  if (m_index_enabled)
+    indexSlot(slot);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+FaceGallery::remove
+  (
+  int id
+  )
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  std::unordered_map<int,unsigned int>::iterator it = m_slots.find(id);
+  if (it == m_slots.end())
+    return false;
+  m_deleted[it->second] = 1;
+  m_slots.erase(it);
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+FaceGallery::contains
+  (
+  int id
+  ) const
+{
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  return m_slots.find(id) != m_slots.end();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::search
+  (
+  const float *query,
+  unsigned int k,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  std::vector<float> padded(m_padded);
+  prepareQuery(query, padded.data());
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  if (m_index_enabled)
+    approximateSearch(padded.data(), k, matches);
+  else if (m_codec)
+    quantizedSearch(padded.data(), k, m_rerank, matches);
+  else
+    exactSearch(padded.data(), k, matches);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: scans the codes once the floats are released.
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::searchExact
+  (
+  const float *query,
+  unsigned int k,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  std::vector<float> padded(m_padded);
+  prepareQuery(query, padded.data());
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  if (m_has_embeddings)
+    exactSearch(padded.data(), k, matches);
+  else
+    quantizedSearch(padded.data(), k, 0, matches);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: falls back to an exact scan without index.
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::searchApproximate
+  (
+  const float *query,
+  unsigned int k,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  std::vector<float> padded(m_padded);
+  prepareQuery(query, padded.data());
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  if (m_index_enabled)
+    approximateSearch(padded.data(), k, matches);
+  else if (m_has_embeddings)
+    exactSearch(padded.data(), k, matches);
+  else
+    quantizedSearch(padded.data(), k, 0, matches);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: falls back to an exact scan without codec.
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::searchQuantized
+  (
+  const float *query,
+  unsigned int k,
+  unsigned int rerank,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  std::vector<float> padded(m_padded);
+  prepareQuery(query, padded.data());
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  if (m_codec)
+    quantizedSearch(padded.data(), k, rerank, matches);
+  else
+    exactSearch(padded.data(), k, matches);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: live slots are moved to the front keeping their order.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::compact()
+{
+  boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+  unsigned int num_live = 0;
+  for (unsigned int slot=0; slot < m_num_slots; slot++)
+  {
+    if (m_deleted[slot])
+      continue;
+    if (num_live != slot)
+    {
+      if (m_has_embeddings)
+        m_embeddings.row(slot).copyTo(m_embeddings.row(num_live));
+      if (m_codec)
+        m_codes.row(slot).copyTo(m_codes.row(num_live));
+    }
+    m_ids[num_live] = m_ids[slot];
+    m_slots[m_ids[num_live]] = num_live;
+    num_live++;
+  }
+  UPM_PRINT("Gallery compacted from " << m_num_slots << " to " << num_live << " slots");
+  m_num_slots = num_live;
+  reserve(std::max(num_live, MIN_CAPACITY));
+  m_ids.resize(num_live);
+  m_deleted.assign(num_live, 0);
+  m_links.assign(m_index_enabled ? num_live : 0, std::vector< std::vector<unsigned int> >());
+  m_max_level = -1;
+  if (m_index_enabled)
+    for (unsigned int slot=0; slot < m_num_slots; slot++)
+      indexSlot(slot);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+FaceGallery::distance
+  (
+  const float *a,
+  const float *b
+  ) const
+{
+  if (m_metric == GalleryMetric::l2)
+    return l2Kernel(a, b, m_dimension);
+  const float norm = std::sqrt(dotKernel(a, a, m_dimension) * dotKernel(b, b, m_dimension));
+  return 1.0f - dotKernel(a, b, m_dimension) / std::max(norm, FLT_EPSILON);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned int
+FaceGallery::size() const
+{
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  return getNumIdentities();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::getMemoryUsage
+  (
+  size_t &embeddings,
+  size_t &codes,
+  size_t &graph
+  ) const
+{
+  boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+  embeddings = m_has_embeddings ? static_cast<size_t>(m_capacity)*m_padded*sizeof(float) : 0;
+  codes = m_codec ? static_cast<size_t>(m_capacity)*m_codec->getCodeSize() : 0;
+  graph = 0;
+  for (const std::vector< std::vector<unsigned int> > &levels : m_links)
+    for (const std::vector<unsigned int> &links : levels)
+      graph += sizeof(links) + links.capacity()*sizeof(unsigned int);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::reserve
+  (
+  unsigned int capacity
+  )
+{
+  if (m_has_embeddings)
+  {
+    cv::Mat grown = cv::Mat::zeros(capacity, m_padded, CV_32F);
+    if (m_num_slots > 0)
+      m_embeddings.rowRange(0, m_num_slots).copyTo(grown.rowRange(0, m_num_slots));
+    m_embeddings = grown;
+  }
+  if (m_codec)
+  {
+    cv::Mat grown(capacity, m_codec->getCodeSize(), CV_8U);
+    if (m_num_slots > 0)
+      m_codes.rowRange(0, m_num_slots).copyTo(grown.rowRange(0, m_num_slots));
+    m_codes = grown;
+  }
+  m_capacity = capacity;
+  m_storage.reset();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: capacity doubles so inserts are amortized constant.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned int
+FaceGallery::addSlot
+  (
+  int id,
+  const float *embedding
+  )
+{
+  if (m_num_slots == m_capacity)
+    reserve(std::max(2*m_capacity, MIN_CAPACITY));
+  std::vector<float> padded;
+  float *row = m_has_embeddings ? m_embeddings.ptr<float>(m_num_slots) : (padded.resize(m_padded), padded.data());
+  prepareQuery(embedding, row);
+  if (m_codec)
+    m_codec->encode(row, m_codes.ptr<unsigned char>(m_num_slots));
+  m_ids.push_back(id);
+  m_deleted.push_back(0);
+  if (m_index_enabled)
+    m_links.push_back(std::vector< std::vector<unsigned int> >());
+  return m_num_slots++;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: a bounded max-heap per stripe keeps the k closest slots,
+// stripes are merged at the end.
+// Inputs:
+// Outputs: 'nearest' sorted by increasing distance.
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::scanSlots
+  (
+  const std::function<void(unsigned int,unsigned int,float*)> &kernel,
+  unsigned int k,
+  std::vector<Candidate> &nearest
+  ) const
+{
+  nearest.clear();
+  std::mutex nearest_mutex;
+  const unsigned int num_stripes = (m_num_slots < PARALLEL_SCAN_SLOTS) ? 1 : static_cast<unsigned int>(std::max(cv::getNumThreads(), 1));
+  cv::parallel_for_(cv::Range(0,num_stripes), [&](const cv::Range &range)
+  {
+    float dists[SCAN_BLOCK];
+    for (int stripe=range.start; stripe < range.end; stripe++)
+    {
+      const unsigned int begin = static_cast<unsigned int>(static_cast<unsigned long>(m_num_slots)*stripe/num_stripes);
+      const unsigned int end = static_cast<unsigned int>(static_cast<unsigned long>(m_num_slots)*(stripe+1)/num_stripes);
+      std::vector<Candidate> heap;
+      heap.reserve(k+1);
+      for (unsigned int block=begin; block < end; block+=SCAN_BLOCK)
+      {
+        const unsigned int num_dists = std::min(SCAN_BLOCK, end-block);
+        kernel(block, num_dists, dists);
+        for (unsigned int i=0; i < num_dists; i++)
+        {
+          if (m_deleted[block+i] or ((heap.size() == k) and (dists[i] >= heap.front().first)))
+            continue;
+          heap.push_back(Candidate(dists[i],block+i));
+          std::push_heap(heap.begin(), heap.end());
+          if (heap.size() > k)
+          {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock(nearest_mutex);
+      nearest.insert(nearest.end(), heap.begin(), heap.end());
+    }
+  }, num_stripes);
+  const unsigned int num_nearest = std::min(k, static_cast<unsigned int>(nearest.size()));
+  std::partial_sort(nearest.begin(), nearest.begin()+num_nearest, nearest.end());
+  nearest.resize(num_nearest);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::exactSearch
+  (
+  const float *padded_query,
+  unsigned int k,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  matches.clear();
+  k = std::min(k, getNumIdentities());
+  if (k == 0)
+    return;
+  std::vector<Candidate> nearest;
+  scanSlots([&](unsigned int begin, unsigned int num_slots, float *dists)
+  {
+    for (unsigned int i=0; i < num_slots; i++)
+      dists[i] = slotDistance(padded_query, begin+i);
+  }, k, nearest);
+  for (const Candidate &candidate : nearest)
+    matches.push_back({m_ids[candidate.second], candidate.first});
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: asymmetric distances to the codes select max(k, rerank)
+// candidates, whose float distances give the final order.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: without float embeddings the code distances are
+// returned as they are.
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::quantizedSearch
+  (
+  const float *padded_query,
+  unsigned int k,
+  unsigned int rerank,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  matches.clear();
+  k = std::min(k, getNumIdentities());
+  if (k == 0)
+    return;
+  if (not m_has_embeddings)
+    rerank = 0;
+  std::vector<float> table;
+  m_codec->prepare(padded_query, table);
+  std::vector<Candidate> nearest;
+  scanSlots([&](unsigned int begin, unsigned int num_slots, float *dists)
+  {
+    m_codec->distances(table.data(), m_codes.ptr<unsigned char>(begin), num_slots, m_codes.step1(), dists);
+  }, std::min(std::max(k, rerank), getNumIdentities()), nearest);
+  if (rerank > 0)
+  {
+    for (Candidate &candidate : nearest)
+      candidate.first = slotDistance(padded_query, candidate.second);
+    std::sort(nearest.begin(), nearest.end());
+  }
+  for (unsigned int i=0; i < k; i++)
+    matches.push_back({m_ids[nearest[i].second], nearest[i].first});
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: greedy descent through the upper layers, then a beam
+// search of width max(ef, k) on the base layer.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::approximateSearch
+  (
+  const float *padded_query,
+  unsigned int k,
+  std::vector<GalleryMatch> &matches
+  ) const
+{
+  matches.clear();
+  k = std::min(k, getNumIdentities());
+  if ((k == 0) or (m_max_level < 0))
+    return;
+  unsigned int entry = m_entry;
+  for (int level=m_max_level; level > 0; level--)
+    entry = greedyClosest(padded_query, entry, static_cast<unsigned int>(level));
+  std::vector<Candidate> nearest;
+  searchLayer(padded_query, entry, std::max(m_ef_search, k), 0, true, nearest);
+  for (unsigned int i=0; (i < k) and (i < nearest.size()); i++)
+    matches.push_back({m_ids[nearest[i].second], nearest[i].first});
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: copies the embedding into a padded row, normalized to
+// unit length for the cosine metric.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::prepareQuery
+  (
+  const float *query,
+  float *padded
+  ) const
+{
+  std::copy(query, query+m_dimension, padded);
+  std::fill(padded+m_dimension, padded+m_padded, 0.0f);
+  if (m_metric == GalleryMetric::cosine)
+  {
+    const float norm = std::sqrt(dotKernel(padded, padded, m_padded));
+    if (norm > FLT_EPSILON)
+      for (unsigned int i=0; i < m_dimension; i++)
+        padded[i] /= norm;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+FaceGallery::slotDistance
+  (
+  const float *padded_query,
+  unsigned int slot
+  ) const
+{
+  const float *row = m_embeddings.ptr<float>(slot);
+  if (m_metric == GalleryMetric::l2)
+    return l2Kernel(padded_query, row, m_padded);
+  return 1.0f - dotKernel(padded_query, row, m_padded);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: links the slot on every layer up to a random level
+// drawn from an exponential distribution of scale 1/ln(M).
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::indexSlot
+  (
+  unsigned int slot
+  )
+{
+  const float *query = m_embeddings.ptr<float>(slot);
+  const int level = static_cast<int>(-std::log(std::max(m_rng.uniform(0.0, 1.0), DBL_MIN)) * m_level_mult);
+  m_links[slot].assign(level+1, std::vector<unsigned int>());
+  if (m_max_level < 0)
+  {
+    m_entry = slot;
+    m_max_level = level;
+    return;
+  }
+  unsigned int entry = m_entry;
+  for (int l=m_max_level; l > level; l--)
+    entry = greedyClosest(query, entry, static_cast<unsigned int>(l));
+  std::vector<Candidate> nearest, neighbors;
+  for (int l=std::min(level,m_max_level); l >= 0; l--)
+  {
+    searchLayer(query, entry, m_ef_construction, static_cast<unsigned int>(l), false, nearest);
+    entry = nearest.front().second;
+    selectNeighbors(nearest, m_M);
+    const unsigned int max_links = (l == 0) ? 2*m_M : m_M;
+    for (const Candidate &candidate : nearest)
+    {
+      m_links[slot][l].push_back(candidate.second);
+      std::vector<unsigned int> &links = m_links[candidate.second][l];
+      links.push_back(slot);
+      if (links.size() <= max_links)
+        continue;
+      /// Shrink the neighbour list with the same heuristic
+      const float *center = m_embeddings.ptr<float>(candidate.second);
+      neighbors.clear();
+      for (unsigned int link : links)
+        neighbors.push_back(Candidate(slotDistance(center, link), link));
+      std::sort(neighbors.begin(), neighbors.end());
+      selectNeighbors(neighbors, max_links);
+      links.clear();
+      for (const Candidate &neighbor : neighbors)
+        links.push_back(neighbor.second);
+    }
+  }
+  if (level > m_max_level)
+  {
+    m_entry = slot;
+    m_max_level = level;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+unsigned int
+FaceGallery::greedyClosest
+  (
+  const float *padded_query,
+  unsigned int entry,
+  unsigned int level
+  ) const
+{
+  float best = slotDistance(padded_query, entry);
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (unsigned int neighbor : m_links[entry][level])
+    {
+      const float dist = slotDistance(padded_query, neighbor);
+      if (dist < best)
+      {
+        best = dist;
+        entry = neighbor;
+        changed = true;
+      }
+    }
+  }
+  return entry;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: best-first expansion from 'entry' keeping the ef closest
+// nodes found. Tombstones are expanded but not returned when 'skip_deleted'.
+// Inputs:
+// Outputs: 'nearest' sorted by increasing distance.
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::searchLayer
+  (
+  const float *padded_query,
+  unsigned int entry,
+  unsigned int ef,
+  unsigned int level,
+  bool skip_deleted,
+  std::vector<Candidate> &nearest
+  ) const
+{
+  thread_local VisitedList visited;
+  visited.reset(m_num_slots);
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > candidates;
+  nearest.clear();
+  const float dist = slotDistance(padded_query, entry);
+  visited.visit(entry);
+  candidates.push(Candidate(dist,entry));
+  if (not (skip_deleted and m_deleted[entry]))
+    nearest.push_back(Candidate(dist,entry));
+  while (not candidates.empty())
+  {
+    const Candidate current = candidates.top();
+    if ((nearest.size() >= ef) and (current.first > nearest.front().first))
+      break;
+    candidates.pop();
+    for (unsigned int neighbor : m_links[current.second][level])
+    {
+      if (visited.visit(neighbor))
+        continue;
+      const float neighbor_dist = slotDistance(padded_query, neighbor);
+      if ((nearest.size() >= ef) and (neighbor_dist >= nearest.front().first))
+        continue;
+      candidates.push(Candidate(neighbor_dist,neighbor));
+      if (skip_deleted and m_deleted[neighbor])
+        continue;
+      nearest.push_back(Candidate(neighbor_dist,neighbor));
+      std::push_heap(nearest.begin(), nearest.end());
+      if (nearest.size() > ef)
+      {
+        std::pop_heap(nearest.begin(), nearest.end());
+        nearest.pop_back();
+      }
+    }
+  }
+  std::sort_heap(nearest.begin(), nearest.end());
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: a candidate is kept only if it is closer to the node
+// than to every neighbour already kept, which preserves links towards distinct
+// directions and keeps the graph navigable on clustered data.
+// Inputs: 'candidates' sorted by increasing distance.
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceGallery::selectNeighbors
+  (
+  std::vector<Candidate> &candidates,
+  unsigned int max_links
+  ) const
+{
+  if (candidates.size() <= max_links)
+    return;
+  std::vector<Candidate> selected;
+  for (const Candidate &candidate : candidates)
+  {
+    if (selected.size() >= max_links)
+      break;
+    const float *row = m_embeddings.ptr<float>(candidate.second);
+    bool keep = true;
+    for (const Candidate &other : selected)
+      if (slotDistance(row, other.second) < candidate.first)
+      {
+        keep = false;
+        break;
+      }
+    if (keep)
+      selected.push_back(candidate);
+  }
+  candidates.swap(selected);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the exact scan of every query is the ground truth.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+reportGalleryTradeoffs
+  (
+  const FaceGallery &gallery,
+  const cv::Mat &queries,
+  unsigned int k,
+  std::ostream &output
+  )
+{
+  if (not gallery.hasEmbeddings())
+  {
+    UPM_ERROR("Gallery trade-offs need the float embeddings as ground truth");
+    return;
+  }
+  typedef std::function<void(const float*,std::vector<GalleryMatch>&)> SearchPath;
+  std::vector< std::pair<std::string,SearchPath> > paths;
+  paths.push_back(std::make_pair("exact", [&](const float *query, std::vector<GalleryMatch> &matches){gallery.searchExact(query, k, matches);}));
+  if (gallery.getCodec())
+  {
+    paths.push_back(std::make_pair(gallery.getCodec()->getName(), [&](const float *query, std::vector<GalleryMatch> &matches){gallery.searchQuantized(query, k, 0, matches);}));
+    if (gallery.getRerank() > 0)
+      paths.push_back(std::make_pair(gallery.getCodec()->getName() + "+rerank" + std::to_string(gallery.getRerank()), [&](const float *query, std::vector<GalleryMatch> &matches){gallery.searchQuantized(query, k, gallery.getRerank(), matches);}));
+  }
+  if (gallery.isIndexEnabled())
+    paths.push_back(std::make_pair("hnsw", [&](const float *query, std::vector<GalleryMatch> &matches){gallery.searchApproximate(query, k, matches);}));
+
+  std::vector< std::vector<GalleryMatch> > truth(queries.rows);
+  for (int i=0; i < queries.rows; i++)
+    gallery.searchExact(queries.ptr<float>(i), k, truth[i]);
+  const std::ios::fmtflags flags = output.flags();
+  const std::streamsize precision = output.precision();
+  output << std::fixed << std::setprecision(3);
+  for (const std::pair<std::string,SearchPath> &path : paths)
+  {
+    std::vector<GalleryMatch> matches;
+    unsigned int hits = 0, total = 0;
+    double seconds = 0.0;
+    for (int i=0; i < queries.rows; i++)
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      path.second(queries.ptr<float>(i), matches);
+      seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+      for (const GalleryMatch &expected : truth[i])
+        for (const GalleryMatch &match : matches)
+          hits += (match.id == expected.id) ? 1 : 0;
+      total += static_cast<unsigned int>(truth[i].size());
+    }
+    output << "gallery " << path.first;
+    output << " recall@" << k << "=" << ((total > 0) ? static_cast<double>(hits)/total : 0.0);
+    output << " latency=" << ((queries.rows > 0) ? seconds*1e6/queries.rows : 0.0) << " us" << std::endl;
+  }
+  size_t embeddings, codes, graph;
+  gallery.getMemoryUsage(embeddings, codes, graph);
+  const unsigned int num_identities = gallery.size();
+  const double identities = std::max(num_identities, 1U);
+  output << "gallery memory identities=" << num_identities;
+  output << " embeddings=" << embeddings/identities << " codes=" << codes/identities << " graph=" << graph/identities << " bytes/identity" << std::endl;
+  output.flags(flags);
+  output.precision(precision);
+};
+
+} // namespace upm
@@ -113,6 +113,7 @@ void
 FaceHeadPose::save
   (
   const std::string dirpath,
+  cv::Mat frame,
   const std::vector<upm::FaceAnnotation> &faces,
   const upm::FaceAnnotation &ann
   )
@@ -124,7 +125,7 @@ FaceHeadPose::save
   int thickness = MAX(static_cast<int>(roundf(ann.bbox.pos.height*0.01f)), 3);
   for (const FaceAnnotation &face : faces)
   {
-    cv::Mat image = cv::imread(face.filename, cv::IMREAD_COLOR);
+    cv::Mat image = frame.clone();
     cv::Mat ann_axis = projectAxis(ann.headpose) * length;
     cv::Point mid = (ann.bbox.pos.tl() + ann.bbox.pos.br()) * 0.5;
     cv::line(image, mid, cv::Point2f(mid.x+ann_axis.at<float>(1,0), mid.y-ann_axis.at<float>(0,0)), blue_color, thickness);
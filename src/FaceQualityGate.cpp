@@ -0,0 +1,291 @@
+/** ****************************************************************************
+ *  @file    FaceQualityGate.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <FaceQualityGate.hpp>
+#include <iomanip>
+#include <boost/program_options.hpp>
+
+namespace upm {
+
+static const char *const QUALITY_CHECK_NAMES[NUM_QUALITY_CHECKS+1] = {"size", "score", "yaw", "sharpness", "none"};
+
+/// Faces are resampled to this size before measuring their sharpness, so the
+/// threshold does not depend on the face resolution
+const cv::Size SHARPNESS_SIZE(64,64);
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::parseOptions
+  (
+  int argc,
+  char **argv
+  )
+{
+  namespace po = boost::program_options;
+  po::options_description desc("FaceQualityGate options");
+  desc.add_options()
+    ("quality-min-size", po::value<float>()->default_value(m_min_size), "Smallest face side in pixels")
+    ("quality-min-score", po::value<float>()->default_value(m_min_score), "Lowest detector score")
+    ("quality-max-yaw", po::value<float>()->default_value(m_max_yaw), "Largest absolute yaw in degrees")
+    ("quality-min-sharpness", po::value<float>()->default_value(m_min_sharpness), "Lowest Laplacian variance of the face in [0,1] units")
+    ("quality-drop", po::bool_switch()->default_value(false), "Drop rejected faces from the output");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).allow_unregistered().run(), vm);
+  po::notify(vm);
+  m_min_size = vm["quality-min-size"].as<float>();
+  m_min_score = vm["quality-min-score"].as<float>();
+  m_max_yaw = vm["quality-max-yaw"].as<float>();
+  m_min_sharpness = vm["quality-min-sharpness"].as<float>();
+  m_keep_rejected = not vm["quality-drop"].as<bool>();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: sharpness is the variance of the Laplacian of the gray
+// face resampled by the frame cache, shared with any later component asking
+// for the same crop.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: faces without estimated yaw pass the yaw check.
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::process
+  (
+  cv::Mat frame,
+  std::vector<upm::FaceAnnotation> &faces,
+  const upm::FaceAnnotation &ann
+  )
+{
+  m_num_frames++;
+  m_num_faces += faces.size();
+  m_qualities.resize(faces.size());
+  m_rejected.clear();
+  cv::Mat laplacian, mean, stddev;
+  for (unsigned int i=0; i < faces.size(); i++)
+  {
+    const FaceAnnotation &face = faces[i];
+    FaceQuality &quality = m_qualities[i];
+    quality.pos = face.bbox.pos;
+    quality.size = std::min(face.bbox.pos.width, face.bbox.pos.height);
+    quality.score = face.bbox.score;
+    quality.yaw = face.headpose.x;
+    quality.sharpness = -1.0f;
+    quality.failed = QualityCheck::none;
+    if (quality.size < m_min_size)
+      quality.failed = QualityCheck::size;
+    else if (quality.score < m_min_score)
+      quality.failed = QualityCheck::score;
+    else if ((quality.yaw != -FLT_MAX) and (std::abs(quality.yaw) > m_max_yaw))
+      quality.failed = QualityCheck::yaw;
+    else if (m_min_sharpness > 0.0f)
+    {
+      cv::Laplacian(getFrameCache()->getNormalizedCrop(face.bbox.pos, SHARPNESS_SIZE, true), laplacian, CV_32F);
+      cv::meanStdDev(laplacian, mean, stddev);
+      quality.sharpness = static_cast<float>(stddev.at<double>(0)*stddev.at<double>(0));
+      if (quality.sharpness < m_min_sharpness)
+        quality.failed = QualityCheck::sharpness;
+    }
+    if (quality.failed != QualityCheck::none)
+      m_num_skipped[static_cast<unsigned int>(quality.failed)]++;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the faces that pass are compacted in place keeping
+// their order.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::removeRejected
+  (
+  std::vector<upm::FaceAnnotation> &faces
+  )
+{
+  m_rejected.clear();
+  if (faces.size() != m_qualities.size())
+    return;
+  unsigned int kept = 0;
+  for (unsigned int i=0; i < faces.size(); i++)
+  {
+    if (m_qualities[i].failed != QualityCheck::none)
+      m_rejected.push_back(faces[i]);
+    else if (kept++ != i)
+      faces[kept-1] = faces[i];
+  }
+  faces.resize(kept);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::restoreRejected
+  (
+  std::vector<upm::FaceAnnotation> &faces
+  )
+{
+  if (m_rejected.empty() or (not m_keep_rejected))
+  {
+    m_accepted.assign(faces.size(), true);
+    m_rejected.clear();
+    return;
+  }
+  if (faces.size()+m_rejected.size() != m_qualities.size())
+  {
+    m_accepted.assign(faces.size(), true);
+    m_accepted.resize(faces.size()+m_rejected.size(), false);
+    faces.insert(faces.end(), m_rejected.begin(), m_rejected.end());
+    m_rejected.clear();
+    return;
+  }
+  const unsigned int num_kept = static_cast<unsigned int>(faces.size());
+  faces.resize(m_qualities.size());
+  m_accepted.resize(m_qualities.size());
+  int kept = static_cast<int>(num_kept)-1, rejected = static_cast<int>(m_rejected.size())-1;
+  for (int i=static_cast<int>(m_qualities.size())-1; i >= 0; i--)
+  {
+    m_accepted[i] = (m_qualities[i].failed == QualityCheck::none);
+    faces[i] = m_accepted[i] ? faces[kept--] : m_rejected[rejected--];
+  }
+  m_rejected.clear();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::keepAccepted
+  (
+  std::vector<upm::FaceAnnotation> &faces
+  ) const
+{
+  if (faces.size() != m_accepted.size())
+    return;
+  unsigned int kept = 0;
+  for (unsigned int i=0; i < faces.size(); i++)
+    if (m_accepted[i] and (kept++ != i))
+      faces[kept-1] = faces[i];
+  faces.resize(kept);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::show
+  (
+  const boost::shared_ptr<upm::Viewer> &viewer,
+  const std::vector<upm::FaceAnnotation> &faces,
+  const upm::FaceAnnotation &ann
+  )
+{
+  // Rejected faces with the failed check, also when they were dropped
+  cv::Scalar red_color(0,0,255);
+  for (unsigned int i=0; i < m_qualities.size(); i++)
+  {
+    if (m_qualities[i].failed == QualityCheck::none)
+      continue;
+    const cv::Rect_<float> &pos = m_qualities[i].pos;
+    int thickness = MAX(static_cast<int>(roundf(pos.height*0.01f)), 1);
+    viewer->rectangle(pos.x, pos.y, pos.width, pos.height, thickness, red_color);
+    viewer->text(QUALITY_CHECK_NAMES[static_cast<unsigned int>(m_qualities[i].failed)], static_cast<int>(pos.x), static_cast<int>(pos.y-5), red_color, 0.5f);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::evaluate
+  (
+  boost::shared_ptr<std::ostream> output,
+  const std::vector<upm::FaceAnnotation> &faces,
+  const upm::FaceAnnotation &ann
+  )
+{
+  for (unsigned int i=0; i < m_qualities.size(); i++)
+  {
+    const FaceQuality &quality = m_qualities[i];
+    *output << getComponentClass() << " " << ann.filename << " " << quality.pos << " " << quality.size << " " << quality.score << " " << quality.yaw << " " << quality.sharpness << " " << QUALITY_CHECK_NAMES[static_cast<unsigned int>(quality.failed)] << std::endl;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceQualityGate::report
+  (
+  std::ostream &output,
+  const std::string &prefix
+  ) const
+{
+  unsigned long skipped = 0;
+  for (unsigned long count : m_num_skipped)
+    skipped += count;
+  const std::ios::fmtflags flags = output.flags();
+  const std::streamsize precision = output.precision();
+  output << std::fixed << std::setprecision(3);
+  output << prefix << "quality frames=" << m_num_frames << " faces=" << m_num_faces << " skipped=" << skipped;
+  output << " skipped/face=" << ((m_num_faces > 0) ? static_cast<double>(skipped)/m_num_faces : 0.0);
+  for (unsigned int i=0; i < NUM_QUALITY_CHECKS; i++)
+    output << " " << QUALITY_CHECK_NAMES[i] << "=" << m_num_skipped[i];
+  output << std::endl;
+  output.flags(flags);
+  output.precision(precision);
+};
+
+} // namespace upm
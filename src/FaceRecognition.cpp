@@ -11,10 +11,70 @@
 #include <trace.hpp>
 #include <utils.hpp>
 #include <FaceRecognition.hpp>
+#include <DetectionUtils.hpp>
 #include <numeric>
+#include <boost/filesystem.hpp>
 
 namespace upm {
 
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: short label with the gender, the age and the binary
+// attributes present, e.g. "M 31 glasses beard".
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static std::string
+describeAttribute
+  (
+  const FaceAttribute &attribute
+  )
+{
+  float row[NUM_ATTRIBUTES];
+  attributeToRow(attribute, row);
+  std::string text = (row[male_attribute] >= 0.5f) ? "M" : "F";
+  text += " " + std::to_string(static_cast<int>(roundf(row[age_attribute])));
+  for (unsigned int label=glasses_attribute; label < NUM_ATTRIBUTES; label++)
+    if (row[label] >= 0.5f)
+      text += std::string(" ") + ATTRIBUTE_NAMES[label];
+  return text;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: face overlapping the annotation the most, or the
+// largest face when the annotation has no box.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: 'faces' must not be empty.
+//
+// -----------------------------------------------------------------------------
+static unsigned int
+findAnnotatedFace
+  (
+  const std::vector<upm::FaceAnnotation> &faces,
+  const upm::FaceAnnotation &ann
+  )
+{
+  const bool annotated = (ann.bbox.pos != FaceAnnotation().bbox.pos);
+  unsigned int best_idx = 0;
+  float best_value = -1.0f;
+  for (unsigned int i=0; i < faces.size(); i++)
+  {
+    const float value = annotated ? computeIoU(ann.bbox.pos, faces[i].bbox.pos) : faces[i].bbox.pos.area();
+    if (value > best_value)
+    {
+      best_idx = i;
+      best_value = value;
+    }
+  }
+  return best_idx;
+};
+
 // -----------------------------------------------------------------------------
 //
 // Purpose and Method:
@@ -32,16 +92,28 @@ FaceRecognition::show
   const upm::FaceAnnotation &ann
   )
 {
-
+  if (not m_estimates_attributes)
+    return;
+  // Estimated attributes over each face
+  cv::Scalar green_color(0,255,0);
+  for (const FaceAnnotation &face : faces)
+  {
+    float scale = MAX(face.bbox.pos.height*0.005f, 0.5f);
+    viewer->text(describeAttribute(face.attribute), static_cast<int>(face.bbox.pos.x), static_cast<int>(face.bbox.pos.y-5), green_color, scale);
+  }
 };
 
 // -----------------------------------------------------------------------------
 //
-// Purpose and Method:
+// Purpose and Method: recognition datasets keep the images of each identity
+// in a directory named after it (LFW, CASIA-WebFace, VGGFace2). The embedding
+// and attributes of the face matching the annotation are accumulated in the
+// evaluators.
 // Inputs:
 // Outputs:
 // Dependencies:
-// Restrictions and Caveats:
+// Restrictions and Caveats: the embeddings are scored when the component is
+// destroyed, after the whole dataset.
 //
 // -----------------------------------------------------------------------------
 void
@@ -52,7 +124,140 @@ FaceRecognition::evaluate
   const upm::FaceAnnotation &ann
   )
 {
+  if (faces.empty())
+    return;
+  const unsigned int best_idx = findAnnotatedFace(faces, ann);
+  const std::string identity = boost::filesystem::path(ann.filename).parent_path().filename().string();
+  *output << getComponentClass() << " " << ann.filename << " " << identity << " " << faces[best_idx].bbox.pos;
+  if (m_estimates_attributes)
+  {
+    float face_row[NUM_ATTRIBUTES], ann_row[NUM_ATTRIBUTES];
+    attributeToRow(faces[best_idx].attribute, face_row);
+    attributeToRow(ann.attribute, ann_row);
+    for (unsigned int label=0; label < NUM_ATTRIBUTES; label++)
+      *output << " " << ann_row[label] << " " << face_row[label];
+    m_attribute_evaluator.addFace(faces[best_idx].attribute, ann.attribute);
+  }
+  *output << std::endl;
 
+  if (m_embeddings.empty() or identity.empty())
+    return;
+  if (m_embeddings.rows != static_cast<int>(faces.size()))
+  {
+    UPM_LOG_RATE(upm::LogLevel::warning, 1, "FaceRecognition: " << m_embeddings.rows << " embeddings for " << faces.size() << " faces, frame not evaluated");
+    return;
+  }
+  m_evaluator.addEmbedding(identity, m_embeddings.row(best_idx));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceRecognition::processAttributes
+  (
+  cv::Mat frame,
+  std::vector<upm::FaceAnnotation> &faces
+  )
+{
+  m_crops.extract(frame, faces);
+  if (not runAttributes())
+    return;
+  for (unsigned int i=0; i < faces.size(); i++)
+    rowToAttribute(m_attributes.ptr<float>(i), faces[i].attribute);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the crops of every frame are appended to one batch, so
+// the estimator runs once for the whole shard.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceRecognition::processAttributes
+  (
+  const std::vector<cv::Mat> &frames,
+  std::vector< std::vector<upm::FaceAnnotation> > &faces
+  )
+{
+  if (frames.size() != faces.size())
+  {
+    UPM_ERROR("Attributes of " << frames.size() << " frames requested with faces of " << faces.size());
+    return;
+  }
+  m_crops.clear();
+  for (unsigned int i=0; i < frames.size(); i++)
+    m_crops.append(frames[i], faces[i]);
+  if (not runAttributes())
+    return;
+  unsigned int row = 0;
+  for (std::vector<FaceAnnotation> &frame_faces : faces)
+    for (FaceAnnotation &face : frame_faces)
+      rowToAttribute(m_attributes.ptr<float>(row++), face.attribute);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the output matrix keeps its largest size, the
+// estimator writes into a header over its first rows. Without an estimator
+// the faces keep their attributes and none are shown, evaluated or saved.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+FaceRecognition::runAttributes()
+{
+  const int num_faces = static_cast<int>(m_crops.size());
+  if (m_attributes.rows < num_faces)
+    m_attributes.create(std::max(num_faces, 2*m_attributes.rows), NUM_ATTRIBUTES, CV_32F);
+  if (num_faces == 0)
+    return false;
+  cv::Mat attributes = m_attributes.rowRange(0, num_faces);
+  attributes.setTo(cv::Scalar::all(0));
+  m_estimates_attributes = estimateAttributes(m_crops, attributes);
+  return m_estimates_attributes;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: called once per frame after process, tracks missing
+// from the frame age and are eventually dropped.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FaceRecognition::identifyTracks
+  (
+  const std::vector<int> &track_ids,
+  const std::vector<upm::FaceAnnotation> &faces,
+  std::vector<upm::GalleryMatch> &decisions
+  )
+{
+  decisions.assign(faces.size(), {-1, FLT_MAX});
+  if ((not m_gallery) or (track_ids.size() != faces.size()) or (m_embeddings.rows != static_cast<int>(faces.size())))
+  {
+    UPM_LOG_RATE(upm::LogLevel::warning, 1, "FaceRecognition: tracks, faces and embeddings do not match, or no gallery set");
+    return;
+  }
+  for (unsigned int i=0; i < faces.size(); i++)
+    decisions[i] = m_tracks.update(*m_gallery, track_ids[i], faces[i], m_embeddings.ptr<float>(i));
+  m_tracks.endFrame();
 };
 
 // -----------------------------------------------------------------------------
@@ -68,11 +273,36 @@ void
 FaceRecognition::save
   (
   const std::string dirpath,
+  cv::Mat frame,
   const std::vector<upm::FaceAnnotation> &faces,
   const upm::FaceAnnotation &ann
   )
 {
+  if ((not m_estimates_attributes) or faces.empty() or (not isAttributeAnnotated(ann.attribute)))
+    return;
+  // Save images whose annotated face has a wrong binary attribute or an age
+  // error greater than threshold
+  const float threshold = 10.0f;
+  const FaceAnnotation &face = faces[findAnnotatedFace(faces, ann)];
+  float face_row[NUM_ATTRIBUTES], ann_row[NUM_ATTRIBUTES];
+  attributeToRow(face.attribute, face_row);
+  attributeToRow(ann.attribute, ann_row);
+  bool failed = (ann_row[age_attribute] > 0.0f) and (fabsf(face_row[age_attribute]-ann_row[age_attribute]) > threshold);
+  for (unsigned int label=0; label < NUM_ATTRIBUTES; label++)
+    if (label != age_attribute)
+      failed |= ((face_row[label] >= 0.5f) != (ann_row[label] >= 0.5f));
+  if (not failed)
+    return;
 
+  int thickness = MAX(static_cast<int>(roundf(face.bbox.pos.height*0.01f)), 3);
+  cv::Scalar cyan_color(255,122,0), green_color(0,255,0);
+  cv::Mat image = frame.clone();
+  cv::rectangle(image, face.bbox.pos.tl(), face.bbox.pos.br(), green_color, thickness);
+  cv::putText(image, describeAttribute(face.attribute), cv::Point(10, image.rows-40), cv::FONT_HERSHEY_SIMPLEX, 1, green_color);
+  cv::putText(image, describeAttribute(ann.attribute), cv::Point(10, image.rows-10), cv::FONT_HERSHEY_SIMPLEX, 1, cyan_color);
+  std::size_t found = ann.filename.find_last_of('/');
+  std::string filepath = dirpath + ann.filename.substr(found+1);
+  cv::imwrite(filepath, image);
 };
 
 } // namespace upm
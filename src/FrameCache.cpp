@@ -0,0 +1,180 @@
+/** ****************************************************************************
+ *  @file    FrameCache.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <FrameCache.hpp>
+
+namespace upm {
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FrameCache::reset
+  (
+  cv::Mat frame
+  )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_frame = frame;
+  m_gray.release();
+  m_pyramids[0].clear();
+  m_pyramids[1].clear();
+  m_scaled.clear();
+  m_crops.clear();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FrameCache::getFrame()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_frame;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FrameCache::getGray()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return gray();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: builds the missing levels from the deepest one
+// already computed.
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FrameCache::getPyramidLevel
+  (
+  unsigned int level,
+  bool gray
+  )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<cv::Mat> &pyramid = m_pyramids[gray ? 1 : 0];
+  if (pyramid.empty())
+    pyramid.push_back(gray ? this->gray() : m_frame);
+  while (pyramid.size() <= level)
+  {
+    cv::Mat next;
+    cv::pyrDown(pyramid.back(), next);
+    pyramid.push_back(next);
+  }
+  return pyramid[level];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FrameCache::getScaled
+  (
+  double scale,
+  bool gray
+  )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  cv::Mat &scaled = m_scaled[std::make_pair(scale,gray)];
+  if (scaled.empty())
+    cv::resize(gray ? this->gray() : m_frame, scaled, cv::Size(), scale, scale, (scale < 1.0) ? cv::INTER_AREA : cv::INTER_LINEAR);
+  return scaled;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: a single affine warp crops, scales and pads the region.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: a frame with many faces starts over once the
+// cache is full, crops already returned stay valid.
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FrameCache::getNormalizedCrop
+  (
+  const cv::Rect_<float> &roi,
+  const cv::Size &size,
+  bool gray
+  )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const std::tuple<float,float,float,float,int,int,bool> key = std::make_tuple(roi.x,roi.y,roi.width,roi.height,size.width,size.height,gray);
+  if ((m_crops.size() >= MAX_CACHED_CROPS) and (m_crops.find(key) == m_crops.end()))
+    m_crops.clear();
+  cv::Mat &crop = m_crops[key];
+  if (crop.empty())
+  {
+    const double sx = size.width / static_cast<double>(roi.width), sy = size.height / static_cast<double>(roi.height);
+    cv::Mat warp = (cv::Mat_<double>(2,3) << sx, 0.0, -roi.x*sx, 0.0, sy, -roi.y*sy);
+    cv::Mat patch;
+    cv::warpAffine(gray ? this->gray() : m_frame, patch, warp, size, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    patch.convertTo(crop, CV_32F, 1.0/255.0);
+  }
+  return crop;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: caller must hold the mutex.
+//
+// -----------------------------------------------------------------------------
+cv::Mat
+FrameCache::gray()
+{
+  if (m_gray.empty())
+  {
+    if (m_frame.channels() == 1)
+      m_gray = m_frame;
+    else
+      cv::cvtColor(m_frame, m_gray, cv::COLOR_BGR2GRAY);
+  }
+  return m_gray;
+};
+
+} // namespace upm
@@ -0,0 +1,820 @@
+/** ****************************************************************************
+ *  @file    GalleryFile.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <GalleryFile.hpp>
+#include <EmbeddingCodec.hpp>
+#include <trace.hpp>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace upm {
+
+const char GALLERY_MAGIC[8] = {'U','P','M','G','A','L','R','Y'};
+const unsigned int GALLERY_VERSION = 1;
+/// Blocks start on a page boundary so mapped rows are aligned
+const unsigned long long GALLERY_ALIGNMENT = 4096;
+/// Rows reserved past the last slot for appends, at least 1/8 of the slots
+const unsigned int MIN_SPARE_SLOTS = 1024;
+/// Larger metadata in a log record means the record is corrupt
+const unsigned int MAX_METADATA_SIZE = 1U << 24;
+
+enum GalleryBlock { rows_block, codes_block, ids_block, deleted_block, metadata_offsets_block, metadata_block, codec_block, graph_block, NUM_GALLERY_BLOCKS };
+enum GalleryFlag { embeddings_flag = 1, codec_flag = 2, index_flag = 4 };
+enum LogOperation { insert_operation = 1, remove_operation = 2 };
+
+struct GalleryFileHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int dimension;
+  unsigned int padded;
+  unsigned int metric;
+  unsigned int flags;
+  unsigned int num_slots;
+  unsigned int capacity;
+  unsigned int code_size;
+  unsigned int M;
+  unsigned int ef_construction;
+  unsigned int ef_search;
+  unsigned int rerank;
+  unsigned int entry;
+  int max_level;
+  unsigned long long offsets[NUM_GALLERY_BLOCKS];
+  unsigned long long sizes[NUM_GALLERY_BLOCKS];
+};
+
+/// Followed by 'dimension' floats and 'metadata_size' bytes
+struct LogRecord
+{
+  unsigned int operation;
+  int id;
+  unsigned int dimension;
+  unsigned int metadata_size;
+  unsigned int checksum;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: FNV-1a, enough to tell a torn write from a record.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static unsigned int
+updateChecksum
+  (
+  unsigned int hash,
+  const void *data,
+  size_t size
+  )
+{
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i=0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 16777619U;
+  return hash;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static unsigned int
+getChecksum
+  (
+  const LogRecord &record,
+  const float *embedding,
+  const std::string &metadata
+  )
+{
+  unsigned int hash = 2166136261U;
+  hash = updateChecksum(hash, &record, offsetof(LogRecord, checksum));
+  hash = updateChecksum(hash, embedding, record.dimension*sizeof(float));
+  return updateChecksum(hash, metadata.data(), metadata.size());
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static unsigned long long
+alignOffset
+  (
+  unsigned long long offset
+  )
+{
+  return (offset + GALLERY_ALIGNMENT - 1) / GALLERY_ALIGNMENT * GALLERY_ALIGNMENT;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: directories are synced too, so a rename inside them is
+// on disk when it returns.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+syncPath
+  (
+  const std::string &path
+  )
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  const bool synced = (fsync(fd) == 0);
+  ::close(fd);
+  return synced;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: every process with the gallery open holds a shared
+// flock on its log, rewriting the file takes it exclusively. Readers open the
+// log read-only and never create it, writers create it. The lock is taken
+// again if the log was replaced while waiting for it.
+// Inputs:
+// Outputs: descriptor of the locked log, -1 if it cannot be locked or, with
+// errno ENOENT, if a reader finds no log
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static int
+lockLog
+  (
+  const std::string &wal_path,
+  int operation,
+  bool create
+  )
+{
+  for (;;)
+  {
+    const int fd = create ? ::open(wal_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644) : ::open(wal_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      const int error = errno;
+      if (create or (error != ENOENT))
+        UPM_ERROR("Error opening the write-ahead log " << wal_path);
+      errno = error;
+      return -1;
+    }
+    if (flock(fd, operation | LOCK_NB) != 0)
+    {
+      UPM_ERROR("Write-ahead log " << wal_path << " is locked by another process");
+      ::close(fd);
+      errno = EWOULDBLOCK;
+      return -1;
+    }
+    struct stat locked, current;
+    if ((fstat(fd, &locked) == 0) and (stat(wal_path.c_str(), &current) == 0) and (locked.st_dev == current.st_dev) and (locked.st_ino == current.st_ino))
+      return fd;
+    ::close(fd);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: fails while another process has the file open.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::write
+  (
+  const std::string &path,
+  const FaceGallery &gallery,
+  const std::unordered_map<int,std::string> &metadata
+  )
+{
+  const int wal = lockLog(path + ".wal", LOCK_EX, true);
+  if (wal < 0)
+    return false;
+  const bool written = writeSnapshot(path, gallery, metadata);
+  ::close(wal);
+  return written;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: rows and codes are streamed from the gallery, the small
+// blocks are built in memory first to know every offset before writing. The
+// new file and its directory entry are synced before the log is emptied, so
+// a crash leaves either the old file with its log or the new one.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the caller holds the log exclusively.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::writeSnapshot
+  (
+  const std::string &path,
+  const FaceGallery &gallery,
+  const std::unordered_map<int,std::string> &metadata
+  )
+{
+  boost::shared_lock<boost::shared_mutex> lock(gallery.m_mutex);
+  const unsigned int num_slots = gallery.m_num_slots;
+  GalleryFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, GALLERY_MAGIC, sizeof(GALLERY_MAGIC));
+  header.version = GALLERY_VERSION;
+  header.dimension = gallery.m_dimension;
+  header.padded = gallery.m_padded;
+  header.metric = static_cast<unsigned int>(gallery.m_metric);
+  header.flags = (gallery.m_has_embeddings ? embeddings_flag : 0) | (gallery.m_codec ? codec_flag : 0) | (gallery.m_index_enabled ? index_flag : 0);
+  header.num_slots = num_slots;
+  header.capacity = num_slots + std::max(num_slots/8, MIN_SPARE_SLOTS);
+  header.code_size = gallery.m_codec ? gallery.m_codec->getCodeSize() : 0;
+  header.M = gallery.m_M;
+  header.ef_construction = gallery.m_ef_construction;
+  header.ef_search = gallery.m_ef_search;
+  header.rerank = gallery.m_rerank;
+  header.entry = gallery.m_entry;
+  header.max_level = gallery.m_max_level;
+
+  std::vector<unsigned char> blocks[NUM_GALLERY_BLOCKS];
+  const unsigned char *ids = reinterpret_cast<const unsigned char*>(gallery.m_ids.data());
+  blocks[ids_block].assign(ids, ids+num_slots*sizeof(int));
+  blocks[deleted_block].assign(gallery.m_deleted.begin(), gallery.m_deleted.end());
+  std::vector<unsigned long long> metadata_offsets(1, 0);
+  for (unsigned int slot=0; slot < num_slots; slot++)
+  {
+    std::unordered_map<int,std::string>::const_iterator it = metadata.find(gallery.m_ids[slot]);
+    if ((not gallery.m_deleted[slot]) and (it != metadata.end()))
+      blocks[metadata_block].insert(blocks[metadata_block].end(), it->second.begin(), it->second.end());
+    metadata_offsets.push_back(blocks[metadata_block].size());
+  }
+  const unsigned char *offsets = reinterpret_cast<const unsigned char*>(metadata_offsets.data());
+  blocks[metadata_offsets_block].assign(offsets, offsets+metadata_offsets.size()*sizeof(unsigned long long));
+  if (gallery.m_codec)
+    gallery.m_codec->serialize(blocks[codec_block]);
+  for (unsigned int slot=0; slot < gallery.m_links.size(); slot++)
+  {
+    const std::vector< std::vector<unsigned int> > &levels = gallery.m_links[slot];
+    const unsigned int num_levels = static_cast<unsigned int>(levels.size());
+    const unsigned char *value = reinterpret_cast<const unsigned char*>(&num_levels);
+    blocks[graph_block].insert(blocks[graph_block].end(), value, value+sizeof(unsigned int));
+    for (const std::vector<unsigned int> &links : levels)
+    {
+      const unsigned int num_links = static_cast<unsigned int>(links.size());
+      value = reinterpret_cast<const unsigned char*>(&num_links);
+      blocks[graph_block].insert(blocks[graph_block].end(), value, value+sizeof(unsigned int));
+      value = reinterpret_cast<const unsigned char*>(links.data());
+      blocks[graph_block].insert(blocks[graph_block].end(), value, value+num_links*sizeof(unsigned int));
+    }
+  }
+  const size_t row_bytes = gallery.m_padded*sizeof(float);
+  header.sizes[rows_block] = gallery.m_has_embeddings ? static_cast<unsigned long long>(header.capacity)*row_bytes : 0;
+  header.sizes[codes_block] = static_cast<unsigned long long>(header.capacity)*header.code_size;
+  for (unsigned int b=ids_block; b < NUM_GALLERY_BLOCKS; b++)
+    header.sizes[b] = blocks[b].size();
+  unsigned long long offset = alignOffset(sizeof(header));
+  for (unsigned int b=0; b < NUM_GALLERY_BLOCKS; b++)
+  {
+    header.offsets[b] = offset;
+    offset = alignOffset(offset + header.sizes[b]);
+  }
+
+  /// Spare rows are never written and stay as holes in the file
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream ofs(tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (gallery.m_has_embeddings)
+  {
+    ofs.seekp(header.offsets[rows_block]);
+    for (unsigned int slot=0; slot < num_slots; slot++)
+      ofs.write(gallery.m_embeddings.ptr<char>(slot), row_bytes);
+  }
+  if (gallery.m_codec)
+  {
+    ofs.seekp(header.offsets[codes_block]);
+    for (unsigned int slot=0; slot < num_slots; slot++)
+      ofs.write(gallery.m_codes.ptr<char>(slot), header.code_size);
+  }
+  for (unsigned int b=ids_block; b < NUM_GALLERY_BLOCKS; b++)
+  {
+    ofs.seekp(header.offsets[b]);
+    ofs.write(reinterpret_cast<const char*>(blocks[b].data()), blocks[b].size());
+  }
+  ofs.seekp(offset-1);
+  ofs.put(0);
+  ofs.close();
+  if ((not ofs) or (not syncPath(tmp_path)))
+  {
+    UPM_ERROR("Error writing gallery file " << tmp_path);
+    return false;
+  }
+  boost::system::error_code error;
+  boost::filesystem::rename(tmp_path, path, error);
+  const boost::filesystem::path parent = boost::filesystem::absolute(path).parent_path();
+  if (error or (not syncPath(parent.string())))
+  {
+    UPM_ERROR("Error replacing gallery file " << path << ": " << error.message());
+    return false;
+  }
+  // An empty log replaces the folded one, so readers always have one to lock
+  const std::string wal_tmp_path = path + ".wal.tmp";
+  std::ofstream(wal_tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+  boost::filesystem::rename(wal_tmp_path, path + ".wal", error);
+  if (error)
+  {
+    UPM_ERROR("Error replacing the write-ahead log of " << path << ": " << error.message());
+    return false;
+  }
+  UPM_PRINT("Gallery file " << path << " written with " << gallery.getNumIdentities() << " identities");
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the log is locked read-only before mapping the file,
+// so a concurrent compaction either finished or has not started. Files are
+// written with an empty log, one without log is opened unlocked.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: only appends need write access to the directory.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::open
+  (
+  const std::string &path
+  )
+{
+  close();
+  m_wal_lock = lockLog(path + ".wal", LOCK_SH, false);
+  if ((m_wal_lock < 0) and (errno != ENOENT))
+    return false;
+  if (not load(path))
+  {
+    close();
+    return false;
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the mapping is private so modified pages are copied for
+// this process only and never reach the file.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the caller holds the log, so the file is not
+// replaced meanwhile.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::load
+  (
+  const std::string &path
+  )
+{
+  namespace bip = boost::interprocess;
+  boost::shared_ptr<bip::mapped_region> region;
+  try
+  {
+    bip::file_mapping mapping(path.c_str(), bip::read_only);
+    region.reset(new bip::mapped_region(mapping, bip::copy_on_write));
+  }
+  catch (const bip::interprocess_exception &e)
+  {
+    UPM_ERROR("Error mapping gallery file " << path << ": " << e.what());
+    return false;
+  }
+  unsigned char *data = static_cast<unsigned char*>(region->get_address());
+  const size_t size = region->get_size();
+  GalleryFileHeader header;
+  bool valid = (size >= sizeof(header));
+  if (valid)
+  {
+    std::memcpy(&header, data, sizeof(header));
+    valid = (std::memcmp(header.magic, GALLERY_MAGIC, sizeof(GALLERY_MAGIC)) == 0) and (header.version == GALLERY_VERSION) and (header.num_slots <= header.capacity);
+    for (unsigned int b=0; valid and (b < NUM_GALLERY_BLOCKS); b++)
+      valid = (header.offsets[b] <= size) and (header.sizes[b] <= size-header.offsets[b]);
+    valid = valid and (header.sizes[ids_block] == header.num_slots*sizeof(int)) and (header.sizes[deleted_block] == header.num_slots);
+    valid = valid and (header.sizes[metadata_offsets_block] == (header.num_slots+1)*sizeof(unsigned long long));
+    valid = valid and (header.metric <= static_cast<unsigned int>(GalleryMetric::l2));
+    /// Rows and codes are used in place, the blocks must hold every reserved row
+    if (header.flags & embeddings_flag)
+      valid = valid and (header.sizes[rows_block] >= static_cast<unsigned long long>(header.capacity)*header.padded*sizeof(float));
+    if (header.flags & codec_flag)
+      valid = valid and (header.sizes[codes_block] >= static_cast<unsigned long long>(header.capacity)*header.code_size);
+    /// The HNSW index searches the float rows
+    if (header.flags & index_flag)
+      valid = valid and (header.flags & embeddings_flag);
+  }
+  if (valid)
+  {
+    const unsigned long long *metadata_offsets = reinterpret_cast<const unsigned long long*>(data+header.offsets[metadata_offsets_block]);
+    for (unsigned int slot=0; valid and (slot < header.num_slots); slot++)
+      valid = (metadata_offsets[slot] <= metadata_offsets[slot+1]);
+    valid = valid and (metadata_offsets[header.num_slots] <= header.sizes[metadata_block]);
+  }
+  if (not valid)
+  {
+    UPM_ERROR("Invalid gallery file " << path);
+    return false;
+  }
+
+  boost::shared_ptr<FaceGallery> gallery(new FaceGallery(header.dimension, static_cast<GalleryMetric>(header.metric)));
+  if (gallery->m_padded != header.padded)
+  {
+    UPM_ERROR("Gallery file " << path << " has an incompatible row padding");
+    return false;
+  }
+  gallery->m_capacity = header.capacity;
+  gallery->m_num_slots = header.num_slots;
+  gallery->m_has_embeddings = (header.flags & embeddings_flag) != 0;
+  if (gallery->m_has_embeddings)
+    gallery->m_embeddings = cv::Mat(header.capacity, header.padded, CV_32F, data+header.offsets[rows_block]);
+  if (header.flags & codec_flag)
+  {
+    gallery->m_codec = EmbeddingCodec::deserialize(data+header.offsets[codec_block], header.sizes[codec_block]);
+    if ((not gallery->m_codec) or (gallery->m_codec->getCodeSize() != header.code_size))
+    {
+      UPM_ERROR("Invalid codec in gallery file " << path);
+      return false;
+    }
+    gallery->m_codes = cv::Mat(header.capacity, header.code_size, CV_8U, data+header.offsets[codes_block]);
+  }
+  gallery->m_rerank = header.rerank;
+  const int *ids = reinterpret_cast<const int*>(data+header.offsets[ids_block]);
+  const unsigned char *deleted = data+header.offsets[deleted_block];
+  gallery->m_ids.assign(ids, ids+header.num_slots);
+  gallery->m_deleted.assign(deleted, deleted+header.num_slots);
+  for (unsigned int slot=0; slot < header.num_slots; slot++)
+    if (not deleted[slot])
+    {
+      gallery->m_slots[ids[slot]] = slot;
+      m_file_slots[ids[slot]] = slot;
+    }
+  m_metadata_offsets = reinterpret_cast<const unsigned long long*>(data+header.offsets[metadata_offsets_block]);
+  m_metadata = reinterpret_cast<const char*>(data+header.offsets[metadata_block]);
+  if (header.flags & index_flag)
+  {
+    const unsigned int *graph = reinterpret_cast<const unsigned int*>(data+header.offsets[graph_block]);
+    const unsigned int *graph_end = graph + header.sizes[graph_block]/sizeof(unsigned int);
+    gallery->m_links.resize(header.num_slots);
+    for (unsigned int slot=0; (slot < header.num_slots) and valid; slot++)
+    {
+      valid = (graph < graph_end);
+      const unsigned int num_levels = valid ? *graph++ : 0;
+      gallery->m_links[slot].resize(num_levels);
+      for (unsigned int level=0; (level < num_levels) and valid; level++)
+      {
+        const unsigned int num_links = (graph < graph_end) ? *graph++ : 0;
+        valid = (static_cast<size_t>(graph_end-graph) >= num_links);
+        if (valid)
+          gallery->m_links[slot][level].assign(graph, graph+num_links);
+        graph += valid ? num_links : 0;
+      }
+    }
+    /// Searches follow the links at every level from the entry down
+    int max_level = -1;
+    for (unsigned int slot=0; valid and (slot < header.num_slots); slot++)
+    {
+      const std::vector< std::vector<unsigned int> > &levels = gallery->m_links[slot];
+      max_level = std::max(max_level, static_cast<int>(levels.size())-1);
+      for (unsigned int level=0; valid and (level < levels.size()); level++)
+        for (unsigned int link : levels[level])
+          valid = valid and (link < header.num_slots) and (gallery->m_links[link].size() > level);
+    }
+    valid = valid and (header.max_level == max_level);
+    valid = valid and ((max_level < 0) or ((header.entry < header.num_slots) and (gallery->m_links[header.entry].size() == static_cast<size_t>(max_level)+1)));
+    if (not valid)
+    {
+      UPM_ERROR("Invalid gallery file " << path);
+      return false;
+    }
+    gallery->m_index_enabled = true;
+    gallery->m_M = header.M;
+    gallery->m_ef_construction = header.ef_construction;
+    gallery->m_ef_search = header.ef_search;
+    gallery->m_level_mult = 1.0 / std::log(static_cast<double>(std::max(header.M, 2U)));
+    gallery->m_entry = header.entry;
+    gallery->m_max_level = header.max_level;
+  }
+  gallery->m_storage = region;
+  m_mapping = region;
+  m_gallery = gallery;
+  m_path = path;
+  return replayLog();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the gallery stays usable, it owns the mapping.
+//
+// -----------------------------------------------------------------------------
+void
+GalleryFile::close()
+{
+  std::lock_guard<std::mutex> lock(m_wal_mutex);
+  if (m_wal != NULL)
+    std::fclose(m_wal);
+  m_wal = NULL;
+  if (m_wal_lock >= 0)
+    ::close(m_wal_lock);
+  m_wal_lock = -1;
+  m_log_size = 0;
+  m_log_torn = false;
+  m_gallery.reset();
+  m_mapping.reset();
+  m_file_slots.clear();
+  m_appended.clear();
+  m_metadata_offsets = NULL;
+  m_metadata = NULL;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+std::string
+GalleryFile::getMetadata
+  (
+  int id
+  ) const
+{
+  std::lock_guard<std::mutex> lock(m_wal_mutex);
+  std::unordered_map<int,std::string>::const_iterator appended = m_appended.find(id);
+  if (appended != m_appended.end())
+    return appended->second;
+  std::unordered_map<int,unsigned int>::const_iterator it = m_file_slots.find(id);
+  if (it == m_file_slots.end())
+    return std::string();
+  return std::string(m_metadata+m_metadata_offsets[it->second], m_metadata+m_metadata_offsets[it->second+1]);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::append
+  (
+  int id,
+  const float *embedding,
+  const std::string &metadata
+  )
+{
+  std::lock_guard<std::mutex> lock(m_wal_mutex);
+  if (not logRecord(insert_operation, id, embedding, metadata))
+    return false;
+  m_gallery->insert(id, embedding);
+  m_file_slots.erase(id);
+  m_appended[id] = metadata;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::remove
+  (
+  int id
+  )
+{
+  std::lock_guard<std::mutex> lock(m_wal_mutex);
+  if (not logRecord(remove_operation, id, NULL, std::string()))
+    return false;
+  m_gallery->remove(id);
+  m_file_slots.erase(id);
+  m_appended.erase(id);
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: locks the log exclusively, loads the file replaying
+// the log, drops the tombstones and writes a new snapshot over it.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: fails while another process has the file open,
+// instead of losing the records it would append to the replaced log.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::compact
+  (
+  const std::string &path
+  )
+{
+  const int wal = lockLog(path + ".wal", LOCK_EX, true);
+  if (wal < 0)
+  {
+    UPM_ERROR("Gallery file " << path << " is open in another process, not compacted");
+    return false;
+  }
+  GalleryFile file;
+  bool compacted = file.load(path);
+  if (compacted)
+  {
+    boost::shared_ptr<FaceGallery> gallery = file.getGallery();
+    gallery->compact();
+    std::unordered_map<int,std::string> metadata;
+    for (int id : gallery->m_ids)
+      metadata[id] = file.getMetadata(id);
+    compacted = writeSnapshot(path, *gallery, metadata);
+  }
+  ::close(wal);
+  return compacted;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the log is created and locked for writing on the first
+// append, dropping the torn record found when it was replayed.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the caller holds the log mutex.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::openLog()
+{
+  const std::string wal_path = m_path + ".wal";
+  const int wal = lockLog(wal_path, LOCK_SH, true);
+  if (wal < 0)
+    return false;
+  if (m_log_torn and (ftruncate(wal, static_cast<off_t>(m_log_size)) != 0))
+  {
+    UPM_ERROR("Error truncating " << wal_path);
+    ::close(wal);
+    return false;
+  }
+  m_log_torn = false;
+  m_wal = fdopen(wal, "ab");
+  if (m_wal == NULL)
+  {
+    UPM_ERROR("Error opening the write-ahead log " << wal_path);
+    ::close(wal);
+    return false;
+  }
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the record is flushed and synced before returning.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the caller holds the log mutex.
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::logRecord
+  (
+  unsigned int operation,
+  int id,
+  const float *embedding,
+  const std::string &metadata
+  )
+{
+  if (not m_gallery)
+  {
+    UPM_ERROR("Gallery file not open");
+    return false;
+  }
+  if ((m_wal == NULL) and (not openLog()))
+    return false;
+  LogRecord record;
+  record.operation = operation;
+  record.id = id;
+  record.dimension = (operation == insert_operation) ? m_gallery->getDimension() : 0;
+  record.metadata_size = static_cast<unsigned int>(metadata.size());
+  record.checksum = getChecksum(record, embedding, metadata);
+  bool written = (std::fwrite(&record, sizeof(record), 1, m_wal) == 1);
+  written = written and (std::fwrite(embedding, sizeof(float), record.dimension, m_wal) == record.dimension);
+  written = written and (std::fwrite(metadata.data(), 1, metadata.size(), m_wal) == metadata.size());
+  written = written and (std::fflush(m_wal) == 0) and (fsync(fileno(m_wal)) == 0);
+  if (not written)
+    UPM_ERROR("Error writing the write-ahead log of " << m_path);
+  return written;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: records are applied until the first one that is
+// incomplete or fails its checksum. The log is truncated there before the
+// next append, opening it stays read-only.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+GalleryFile::replayLog()
+{
+  const std::string wal_path = m_path + ".wal";
+  std::FILE *file = std::fopen(wal_path.c_str(), "rb");
+  if (file == NULL)
+    return true;
+  const unsigned int dimension = m_gallery->getDimension();
+  long valid_size = 0;
+  unsigned int num_records = 0;
+  LogRecord record;
+  std::vector<float> embedding;
+  std::string metadata;
+  while (std::fread(&record, sizeof(record), 1, file) == 1)
+  {
+    const bool known = (record.operation == insert_operation) or (record.operation == remove_operation);
+    if ((not known) or (record.dimension != ((record.operation == insert_operation) ? dimension : 0)) or (record.metadata_size > MAX_METADATA_SIZE))
+      break;
+    embedding.resize(record.dimension);
+    metadata.resize(record.metadata_size);
+    if ((std::fread(embedding.data(), sizeof(float), record.dimension, file) != record.dimension) or (std::fread(&metadata[0], 1, record.metadata_size, file) != record.metadata_size))
+      break;
+    if (getChecksum(record, embedding.data(), metadata) != record.checksum)
+      break;
+    if (record.operation == insert_operation)
+    {
+      m_gallery->insert(record.id, embedding.data());
+      m_appended[record.id] = metadata;
+    }
+    else
+    {
+      m_gallery->remove(record.id);
+      m_appended.erase(record.id);
+    }
+    m_file_slots.erase(record.id);
+    valid_size = std::ftell(file);
+    num_records++;
+  }
+  std::fclose(file);
+  boost::system::error_code error;
+  const boost::uintmax_t size = boost::filesystem::file_size(wal_path, error);
+  m_log_size = static_cast<unsigned long long>(valid_size);
+  m_log_torn = (not error) and (size > static_cast<boost::uintmax_t>(valid_size));
+  if (m_log_torn)
+    UPM_WARNING("Ignoring " << size-valid_size << " bytes of a torn record at the end of " << wal_path);
+  UPM_PRINT("Replayed " << num_records << " write-ahead log records of " << m_path);
+  return true;
+};
+
+} // namespace upm
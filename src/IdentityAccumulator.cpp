@@ -0,0 +1,235 @@
+/** ****************************************************************************
+ *  @file    IdentityAccumulator.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <IdentityAccumulator.hpp>
+#include <cmath>
+#include <cfloat>
+
+namespace upm {
+
+/// Face height in pixels above which the size does not lower the quality
+const float QUALITY_FACE_SIZE = 112.0f;
+
+/// Every face contributes a little, so a track of poor faces still gets an identity
+const float MIN_QUALITY = 0.05f;
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: product of three factors in [0,1]: face height over
+// QUALITY_FACE_SIZE, cosine of yaw times cosine of pitch, and the mean
+// visibility of the landmarks. Unknown head-pose or landmarks do not lower
+// the quality.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+IdentityAccumulator::computeQuality
+  (
+  const FaceAnnotation &face
+  )
+{
+  const float size = std::min(std::max(face.bbox.pos.height/QUALITY_FACE_SIZE, 0.0f), 1.0f);
+  float pose = 1.0f;
+  if (face.headpose.x != -FLT_MAX)
+  {
+    const float to_radians = static_cast<float>(CV_PI/180.0);
+    pose = std::max(std::cos(face.headpose.x*to_radians)*std::cos(face.headpose.y*to_radians), 0.0f);
+  }
+  float occluded = 0.0f;
+  unsigned int num_landmarks = 0;
+  for (const FacePart &part : face.parts)
+    for (const FaceLandmark &landmark : part.landmarks)
+    {
+      occluded += std::min(std::max(landmark.occluded, 0.0f), 1.0f);
+      num_landmarks++;
+    }
+  const float visible = (num_landmarks > 0) ? 1.0f-occluded/static_cast<float>(num_landmarks) : 1.0f;
+  return std::max(size*pose*visible, MIN_QUALITY);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: cosine galleries pool unit embeddings so that every
+// face weights by its quality only, L2 galleries pool them as they are.
+// Older faces are scaled by m_decay on every update, so the pool spans about
+// 1/(1-m_decay) faces and the drift of a long track does not vanish. The
+// drift is the cosine distance between the current pooled direction and the
+// one of the last query.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: not thread-safe, one accumulator per stream.
+//
+// -----------------------------------------------------------------------------
+GalleryMatch
+IdentityAccumulator::update
+  (
+  const FaceGallery &gallery,
+  int track_id,
+  const FaceAnnotation &face,
+  const float *embedding
+  )
+{
+  const unsigned int dimension = gallery.getDimension();
+  Track &track = m_tracks[track_id];
+  if (track.pooled.size() != dimension)
+  {
+    track.pooled.assign(dimension, 0.0f);
+    track.weight = 0.0f;
+    track.queried.assign(dimension, 0.0f);
+    track.decision = {-1, FLT_MAX};
+    track.decided = false;
+  }
+  track.idle_frames = 0;
+  m_num_updates++;
+
+  float weight = computeQuality(face);
+  if (gallery.getMetric() == GalleryMetric::cosine)
+  {
+    float norm = 0.0f;
+    for (unsigned int i=0; i < dimension; i++)
+      norm += embedding[i]*embedding[i];
+    if (norm <= FLT_EPSILON)
+      return track.decision;
+    weight /= std::sqrt(norm);
+  }
+  for (unsigned int i=0; i < dimension; i++)
+    track.pooled[i] = m_decay*track.pooled[i] + weight*embedding[i];
+  track.weight = m_decay*track.weight + weight;
+
+  float norm = 0.0f, dot = 0.0f;
+  for (unsigned int i=0; i < dimension; i++)
+  {
+    norm += track.pooled[i]*track.pooled[i];
+    dot += track.pooled[i]*track.queried[i];
+  }
+  if (norm <= FLT_EPSILON)
+    return track.decision;
+  norm = std::sqrt(norm);
+  if (track.decided and (1.0f-dot/norm <= m_max_drift))
+    return track.decision;
+
+  for (unsigned int i=0; i < dimension; i++)
+    track.queried[i] = track.pooled[i]/norm;
+  if (gallery.getMetric() == GalleryMetric::cosine)
+    gallery.search(track.queried.data(), 1, m_matches);
+  else
+  {
+    std::vector<float> mean(track.pooled);
+    for (float &value : mean)
+      value /= track.weight;
+    gallery.search(mean.data(), 1, m_matches);
+  }
+  m_num_queries++;
+  track.decision = m_matches.empty() ? GalleryMatch({-1, FLT_MAX}) : m_matches[0];
+  track.decided = true;
+  return track.decision;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+IdentityAccumulator::getDecision
+  (
+  int track_id,
+  GalleryMatch &decision
+  ) const
+{
+  std::unordered_map<int,Track>::const_iterator it = m_tracks.find(track_id);
+  if ((it == m_tracks.end()) or (not it->second.decided))
+    return false;
+  decision = it->second.decision;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+IdentityAccumulator::endFrame()
+{
+  for (std::unordered_map<int,Track>::iterator it=m_tracks.begin(); it != m_tracks.end();)
+  {
+    if (++it->second.idle_frames > m_max_idle_frames)
+      it = m_tracks.erase(it);
+    else
+      ++it;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+IdentityAccumulator::endTrack
+  (
+  int track_id
+  )
+{
+  m_tracks.erase(track_id);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+IdentityAccumulator::invalidate()
+{
+  for (std::pair<const int,Track> &track : m_tracks)
+    track.second.decided = false;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+IdentityAccumulator::clear()
+{
+  m_tracks.clear();
+  m_num_updates = 0;
+  m_num_queries = 0;
+};
+
+} // namespace upm
@@ -0,0 +1,454 @@
+/** ****************************************************************************
+ *  @file    ImageLoader.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <ImageLoader.hpp>
+#include <csetjmp>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <jpeglib.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+namespace upm {
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: libjpeg scales by 1/2, 1/4 and 1/8 while decoding, the
+// largest factor keeping the smallest side of the box above the minimum wins.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: unknown boxes and other formats are decoded at
+// full resolution.
+//
+// -----------------------------------------------------------------------------
+static int
+getReducedFlags
+  (
+  const upm::FaceAnnotation &ann,
+  float min_face_size,
+  int flags,
+  float &scale
+  )
+{
+  scale = 1.0f;
+  const float face_size = std::min(ann.bbox.pos.width, ann.bbox.pos.height);
+  if ((min_face_size <= 0.0f) or (face_size <= 0.0f) or ((flags != cv::IMREAD_COLOR) and (flags != cv::IMREAD_GRAYSCALE)))
+    return flags;
+  const std::string extension = boost::algorithm::to_lower_copy(boost::filesystem::extension(ann.filename));
+  if ((extension != ".jpg") and (extension != ".jpeg"))
+    return flags;
+  const bool color = (flags == cv::IMREAD_COLOR);
+  if (face_size/8.0f >= min_face_size)
+  {
+    scale = 0.125f;
+    return color ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_REDUCED_GRAYSCALE_8;
+  }
+  if (face_size/4.0f >= min_face_size)
+  {
+    scale = 0.25f;
+    return color ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_GRAYSCALE_4;
+  }
+  if (face_size/2.0f >= min_face_size)
+  {
+    scale = 0.5f;
+    return color ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_REDUCED_GRAYSCALE_2;
+  }
+  return flags;
+};
+
+/// libjpeg error handler able to jump back to the decoder
+struct JpegErrorManager
+{
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: libjpeg errors jump back to decodeJpeg instead of
+// exiting, warnings about corrupt data are not printed.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static void
+onJpegError
+  (
+  j_common_ptr cinfo
+  )
+{
+  longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static void
+onJpegMessage
+  (
+  j_common_ptr cinfo
+  )
+{
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: libjpeg decodes straight into 'image', which keeps its
+// buffer when the size and type do not change, scaling by 1/'denom' inside
+// the IDCT.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: no object with a destructor may live in this
+// frame, longjmp would skip it. EXIF orientation is not applied, as with
+// cv::IMREAD_IGNORE_ORIENTATION, annotations refer to the stored pixels.
+//
+// -----------------------------------------------------------------------------
+static bool
+decodeJpeg
+  (
+  const std::vector<unsigned char> &bytes,
+  unsigned int denom,
+  bool color,
+  cv::Mat &image
+  )
+{
+  jpeg_decompress_struct cinfo;
+  JpegErrorManager error;
+  cinfo.err = jpeg_std_error(&error.pub);
+  error.pub.error_exit = onJpegError;
+  error.pub.output_message = onJpegMessage;
+  if (setjmp(error.jump))
+  {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(bytes.data()), static_cast<unsigned long>(bytes.size()));
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+#ifdef JCS_EXTENSIONS
+  cinfo.out_color_space = color ? JCS_EXT_BGR : JCS_GRAYSCALE;
+#else
+  cinfo.out_color_space = color ? JCS_RGB : JCS_GRAYSCALE;
+#endif
+  jpeg_start_decompress(&cinfo);
+  image.create(static_cast<int>(cinfo.output_height), static_cast<int>(cinfo.output_width), color ? CV_8UC3 : CV_8UC1);
+  while (cinfo.output_scanline < cinfo.output_height)
+  {
+    JSAMPROW row = image.ptr<unsigned char>(static_cast<int>(cinfo.output_scanline));
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+#ifndef JCS_EXTENSIONS
+  if (color)
+    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+#endif
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: JPEG colour and grayscale images go through libjpeg into
+// the pooled buffer; other formats, other flags and JPEG files libjpeg cannot
+// convert (CMYK) fall back to cv::imdecode into a new matrix.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static void
+decodeImage
+  (
+  const std::vector<unsigned char> &bytes,
+  int flags,
+  float scale,
+  cv::Mat &image
+  )
+{
+  const bool jpeg = (bytes.size() > 2) and (bytes[0] == 0xFF) and (bytes[1] == 0xD8);
+  const bool color = (flags == cv::IMREAD_COLOR) or (flags == cv::IMREAD_REDUCED_COLOR_2) or (flags == cv::IMREAD_REDUCED_COLOR_4) or (flags == cv::IMREAD_REDUCED_COLOR_8);
+  const bool gray = (flags == cv::IMREAD_GRAYSCALE) or (flags == cv::IMREAD_REDUCED_GRAYSCALE_2) or (flags == cv::IMREAD_REDUCED_GRAYSCALE_4) or (flags == cv::IMREAD_REDUCED_GRAYSCALE_8);
+  if (jpeg and (color or gray) and decodeJpeg(bytes, static_cast<unsigned int>(roundf(1.0f/scale)), color, image))
+    return;
+  image = cv::imdecode(bytes, (flags < 0) ? flags : (flags | cv::IMREAD_IGNORE_ORIENTATION));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+ImageLoader::ImageLoader
+  (
+  unsigned int num_threads,
+  unsigned int prefetch,
+  bool ordered
+  ) :
+  m_prefetch(std::max(prefetch, 1U)),
+  m_ordered(ordered),
+  m_min_face_size(0.0f),
+  m_next_job(0),
+  m_consumed(0),
+  m_in_flight(0),
+  m_num_reduced(0),
+  m_wait_ticks(0.0),
+  m_stop(false)
+{
+  m_ready.reserve(m_prefetch);
+  for (unsigned int i=0; i < std::max(num_threads, 1U); i++)
+    m_threads.emplace_back(&ImageLoader::run, this);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+ImageLoader::~ImageLoader()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_work.notify_all();
+  for (std::thread &thread : m_threads)
+    thread.join();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the reduction of each image is chosen here, from its
+// annotated box, so decoders only see file names and flags.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ImageLoader::start
+  (
+  const std::vector<upm::FaceAnnotation> &anns,
+  int flags
+  )
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  cancel(lock);
+  m_jobs.resize(anns.size());
+  m_num_reduced = 0;
+  for (unsigned int i=0; i < anns.size(); i++)
+  {
+    m_jobs[i].filename = anns[i].filename;
+    m_jobs[i].flags = getReducedFlags(anns[i], m_min_face_size, flags, m_jobs[i].scale);
+    m_num_reduced += (m_jobs[i].scale < 1.0f);
+  }
+  m_next_job = 0;
+  m_consumed = 0;
+  m_wait_ticks = 0.0;
+  lock.unlock();
+  m_work.notify_all();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: in order, the image awaited is the one following the
+// last delivered; otherwise any decoded image is delivered.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+ImageLoader::next
+  (
+  upm::LoadedImage &image
+  )
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_consumed >= m_jobs.size())
+    return false;
+  const cv::int64 ticks = cv::getTickCount();
+  std::vector<LoadedImage>::iterator found;
+  m_done.wait(lock, [&]
+  {
+    found = m_ordered ? std::find_if(m_ready.begin(), m_ready.end(), [&](const LoadedImage &ready) {return ready.index == m_consumed;}) : m_ready.begin();
+    return found != m_ready.end();
+  });
+  m_wait_ticks += static_cast<double>(cv::getTickCount()-ticks);
+  image = std::move(*found);
+  *found = std::move(m_ready.back());
+  m_ready.pop_back();
+  m_consumed++;
+  lock.unlock();
+  m_work.notify_one();
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the pool keeps enough buffers for every image that can
+// be in flight, extra ones are freed.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: a buffer still referenced elsewhere, e.g. by a
+// frame cache, is left to its holders instead of being overwritten.
+//
+// -----------------------------------------------------------------------------
+void
+ImageLoader::release
+  (
+  upm::LoadedImage &image
+  )
+{
+  if (image.image.empty())
+    return;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if ((m_pool.size() < m_prefetch) and image.image.u and (image.image.u->refcount == 1))
+    m_pool.push_back(image.image);
+  image.image = cv::Mat();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: stops handing out jobs, waits for the decoders busy with
+// the old list and recycles the images nobody consumed.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: called with the mutex held through 'lock'.
+//
+// -----------------------------------------------------------------------------
+void
+ImageLoader::cancel
+  (
+  std::unique_lock<std::mutex> &lock
+  )
+{
+  m_jobs.resize(m_next_job);
+  m_done.wait(lock, [this] {return m_in_flight == 0;});
+  for (LoadedImage &ready : m_ready)
+    if ((not ready.image.empty()) and (m_pool.size() < m_prefetch))
+      m_pool.push_back(ready.image);
+  m_ready.clear();
+  m_jobs.clear();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: a job is taken only while fewer than 'prefetch' images
+// are in flight or waiting, counted from the last one consumed. The file is
+// read and decoded without holding the mutex.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+ImageLoader::run()
+{
+  std::vector<unsigned char> bytes;
+  for (;;)
+  {
+    Job job;
+    LoadedImage loaded;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_work.wait(lock, [this] {return m_stop or ((m_next_job < m_jobs.size()) and (m_next_job < m_consumed+m_prefetch));});
+      if (m_stop)
+        return;
+      loaded.index = m_next_job++;
+      job = m_jobs[loaded.index];
+      if (not m_pool.empty())
+      {
+        loaded.image = m_pool.back();
+        m_pool.pop_back();
+      }
+      m_in_flight++;
+    }
+
+    loaded.scale = job.scale;
+    std::ifstream ifs(job.filename.c_str(), std::ios::binary);
+    if (ifs.is_open())
+    {
+      ifs.seekg(0, std::ios::end);
+      bytes.resize(static_cast<size_t>(ifs.tellg()));
+      ifs.seekg(0, std::ios::beg);
+      ifs.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    }
+    if ((not ifs.is_open()) or ifs.fail() or bytes.empty())
+      loaded.image = cv::Mat();
+    else
+      decodeImage(bytes, job.flags, job.scale, loaded.image);
+    if (loaded.image.empty())
+      UPM_LOG_RATE(upm::LogLevel::warning, 1, "ImageLoader: could not read " << job.filename);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_in_flight--;
+      m_ready.push_back(std::move(loaded));
+    }
+    m_done.notify_all();
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: missing boxes and head poses are kept as they are.
+//
+// -----------------------------------------------------------------------------
+void
+scaleAnnotation
+  (
+  const upm::FaceAnnotation &ann,
+  float scale,
+  upm::FaceAnnotation &scaled
+  )
+{
+  scaled = ann;
+  if (scale == 1.0f)
+    return;
+  if (ann.bbox.pos.width > 0.0f)
+    scaled.bbox.pos = cv::Rect_<float>(ann.bbox.pos.x*scale, ann.bbox.pos.y*scale, ann.bbox.pos.width*scale, ann.bbox.pos.height*scale);
+  for (FacePart &part : scaled.parts)
+    for (FaceLandmark &landmark : part.landmarks)
+      landmark.pos *= scale;
+};
+
+} // namespace upm
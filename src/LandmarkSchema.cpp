@@ -0,0 +1,89 @@
+/** ****************************************************************************
+ *  @file    LandmarkSchema.cpp
+ *  @brief   Compile-time landmark layout of each annotated database
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <LandmarkSchema.hpp>
+
+namespace upm {
+
+/// Out-of-class definitions of the arrays indexed at runtime
+constexpr unsigned int AflwSchema::landmarks[];
+constexpr unsigned int AflwSchema::part_offsets[];
+constexpr unsigned int CofwSchema::landmarks[];
+constexpr unsigned int CofwSchema::part_offsets[];
+constexpr unsigned int Ibug300WSchema::landmarks[];
+constexpr unsigned int Ibug300WSchema::part_offsets[];
+constexpr unsigned int WflwSchema::landmarks[];
+constexpr unsigned int WflwSchema::part_offsets[];
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+getNormalizedErrors
+  (
+  const std::string &database,
+  const FaceAnnotation &face,
+  const FaceAnnotation &ann,
+  const ErrorMeasure &measure,
+  std::vector<unsigned int> &indices,
+  std::vector<float> &errors
+  )
+{
+  if (database == "aflw")
+    getNormalizedErrors<AflwSchema>(face, ann, measure, indices, errors);
+  else if (database == "cofw")
+    getNormalizedErrors<CofwSchema>(face, ann, measure, indices, errors);
+  else if ((database == "300w_public") or (database == "300w_private"))
+    getNormalizedErrors<Ibug300WSchema>(face, ann, measure, indices, errors);
+  else if (database == "wflw")
+    getNormalizedErrors<WflwSchema>(face, ann, measure, indices, errors);
+  else
+    return false;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+getOcclusions
+  (
+  const std::string &database,
+  const FaceAnnotation &ann,
+  const std::vector<unsigned int> &indices,
+  std::vector<float> &occlusions
+  )
+{
+  if (database == "aflw")
+    getOcclusions<AflwSchema>(ann, indices, occlusions);
+  else if (database == "cofw")
+    getOcclusions<CofwSchema>(ann, indices, occlusions);
+  else if ((database == "300w_public") or (database == "300w_private"))
+    getOcclusions<Ibug300WSchema>(ann, indices, occlusions);
+  else if (database == "wflw")
+    getOcclusions<WflwSchema>(ann, indices, occlusions);
+  else
+    return false;
+  return true;
+};
+
+} // namespace upm
@@ -0,0 +1,245 @@
+/** ****************************************************************************
+ *  @file    Logger.cpp
+ *  @brief   Asynchronous leveled logging behind the trace macros
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <Logger.hpp>
+#include <cstdlib>
+#include <iostream>
+
+namespace upm {
+
+static const char *const LOG_LEVEL_PREFIXES[] = {"[DEBUG] ", "", "[WARNING] ", ""};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: built on first use and never destroyed, so components
+// destroyed during static destruction can still log. The writer is stopped
+// at exit, and later messages are written by the caller.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+Logger &
+Logger::getInstance()
+{
+  static Logger *logger = []{
+    Logger *instance = new Logger();
+    std::atexit(&Logger::shutdown);
+    return instance;
+  }();
+  return *logger;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the queue always holds a stub node, the last message
+// written, so producers never see it empty.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+Logger::Logger() :
+  m_level(LogLevel::info),
+  m_head(new Node()),
+  m_pushed(0),
+  m_written(0),
+  m_sleeping(false),
+  m_stop(false),
+  m_writer_stopped(false)
+{
+  m_head.load()->next.store(nullptr);
+  m_tail = m_head.load();
+  m_writer = std::thread(&Logger::run, this);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+Logger::shutdown()
+{
+  Logger &logger = getInstance();
+  {
+    std::lock_guard<std::mutex> lock(logger.m_mutex);
+    logger.m_stop.store(true);
+  }
+  logger.m_wakeup.notify_one();
+  logger.m_writer.join();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: once the writer is stopped the queue is drained by the
+// logging threads, one at a time under the mutex.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+Logger::drain()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  LogLevel level;
+  std::string message;
+  while (pop(level, message))
+    ((level == LogLevel::error) ? std::cerr : std::cout) << LOG_LEVEL_PREFIXES[static_cast<int>(level)] << message << '\n';
+  std::cout.flush();
+  std::cerr.flush();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: Vyukov's intrusive MPSC queue, a single atomic exchange
+// per message. The writer is only woken up when it went to sleep, under the
+// mutex so the notification cannot fall between its last check of the queue
+// and its wait. Errors are written before returning, a crash right after
+// them must not lose them. A message pushed after the writer stopped is
+// written by its caller: the writer raises the flag only after finding the
+// queue empty, so either it or the caller sees the message.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+Logger::log
+  (
+  LogLevel level,
+  std::string message
+  )
+{
+  Node *node = new Node();
+  node->next.store(nullptr, std::memory_order_relaxed);
+  node->level = level;
+  node->message = std::move(message);
+  m_pushed.fetch_add(1, std::memory_order_relaxed);
+  Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node);
+  if (m_writer_stopped.load())
+  {
+    drain();
+    return;
+  }
+  if (m_sleeping.load())
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wakeup.notify_one();
+  }
+  if (level == LogLevel::error)
+    flush();
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+Logger::flush()
+{
+  if (m_writer_stopped.load())
+    return;
+  const unsigned long pushed = m_pushed.load(std::memory_order_acquire);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_wakeup.notify_one();
+  m_drained.wait_for(lock, std::chrono::seconds(5), [this, pushed]{return m_written.load() >= pushed;});
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: writer thread only.
+//
+// -----------------------------------------------------------------------------
+bool
+Logger::pop
+  (
+  LogLevel &level,
+  std::string &message
+  )
+{
+  Node *tail = m_tail;
+  Node *next = tail->next.load(std::memory_order_acquire);
+  if (next == nullptr)
+    return false;
+  level = next->level;
+  message = std::move(next->message);
+  m_tail = next;
+  delete tail;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: drains the queue, flushes the streams once and sleeps
+// until a producer wakes it up. The sleeping flag is raised before checking
+// the queue again, so a producer either finds the writer awake or sees the
+// flag and notifies it.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+Logger::run()
+{
+  LogLevel level;
+  std::string message;
+  for (;;)
+  {
+    unsigned long written = 0;
+    while (pop(level, message))
+    {
+      std::ostream &output = (level == LogLevel::error) ? std::cerr : std::cout;
+      output << LOG_LEVEL_PREFIXES[static_cast<int>(level)] << message << '\n';
+      written++;
+    }
+    if (written > 0)
+    {
+      std::cout.flush();
+      std::cerr.flush();
+      m_written.fetch_add(written, std::memory_order_release);
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_drained.notify_all();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_sleeping.store(true);
+    if (m_stop.load() and (m_tail->next.load() == nullptr))
+    {
+      m_writer_stopped.store(true);
+      break;
+    }
+    m_wakeup.wait(lock, [this]{return m_stop.load() or (m_tail->next.load() != nullptr);});
+    m_sleeping.store(false, std::memory_order_relaxed);
+  }
+};
+
+} // namespace upm
@@ -0,0 +1,147 @@
+/** ****************************************************************************
+ *  @file    PerfCounters.cpp
+ *  @brief   Hardware performance counters around profiled calls
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <PerfCounters.hpp>
+#include <trace.hpp>
+#include <mutex>
+#include <cerrno>
+#include <cstring>
+#if defined(UPM_PERF_COUNTERS) and defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace upm {
+
+static const char *const PERF_COUNTER_NAMES[NUM_PERF_COUNTERS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+
+#if defined(UPM_PERF_COUNTERS) and defined(__linux__)
+const unsigned long long PERF_COUNTER_CONFIGS[NUM_PERF_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+/** ****************************************************************************
+ * @class PerfEventGroup
+ * @brief Events of one thread. The first event opened leads the group, so
+ * all of them are scheduled together and read at once.
+ ******************************************************************************/
+class PerfEventGroup
+{
+public:
+  PerfEventGroup() : m_leader(-1), m_num_events(0)
+  {
+    int error = 0;
+    for (unsigned int i=0; i < NUM_PERF_COUNTERS; i++)
+    {
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNTER_CONFIGS[i];
+      attr.disabled = (m_leader < 0) ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, m_leader, 0));
+      if (fd < 0)
+      {
+        error = errno;
+        continue;
+      }
+      if (m_leader < 0)
+        m_leader = fd;
+      m_fds[m_num_events] = fd;
+      m_counters[m_num_events] = i;
+      m_num_events++;
+    }
+    if (m_leader >= 0)
+    {
+      ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    static std::once_flag warned;
+    if (m_num_events < NUM_PERF_COUNTERS)
+      std::call_once(warned, [&]{UPM_WARNING("Hardware performance counters unavailable (" << m_num_events << "/" << NUM_PERF_COUNTERS << " opened): " << std::strerror(error));});
+  };
+
+  ~PerfEventGroup()
+  {
+    for (unsigned int i=0; i < m_num_events; i++)
+      close(m_fds[i]);
+  };
+
+  PerfCounterValues
+  read() const
+  {
+    PerfCounterValues counters;
+    if (m_leader < 0)
+      return counters;
+    /// Layout of PERF_FORMAT_GROUP: nr, time_enabled, time_running, values[nr]
+    unsigned long long buffer[3+NUM_PERF_COUNTERS];
+    if (::read(m_leader, buffer, sizeof(buffer)) < static_cast<ssize_t>((3+m_num_events)*sizeof(unsigned long long)))
+      return counters;
+    const double scale = (buffer[2] > 0) ? static_cast<double>(buffer[1])/buffer[2] : 1.0;
+    for (unsigned int i=0; i < m_num_events; i++)
+      counters.values[m_counters[i]] = static_cast<unsigned long long>(buffer[3+i]*scale);
+    counters.valid = true;
+    return counters;
+  };
+
+private:
+  int m_leader;
+  unsigned int m_num_events;
+  int m_fds[NUM_PERF_COUNTERS];
+  unsigned int m_counters[NUM_PERF_COUNTERS];
+};
+#endif
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: perf events count a single thread, so each thread
+// opens its own group the first time it reads.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+PerfCounterValues
+PerfCounters::read()
+{
+#if defined(UPM_PERF_COUNTERS) and defined(__linux__)
+  thread_local PerfEventGroup group;
+  return group.read();
+#else
+  static std::once_flag warned;
+  if (isEnabled())
+    std::call_once(warned, []{UPM_WARNING("Hardware performance counters are only supported on Linux");});
+  return PerfCounterValues();
+#endif
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+const char *
+PerfCounters::getName
+  (
+  PerfCounter counter
+  )
+{
+  return PERF_COUNTER_NAMES[static_cast<unsigned int>(counter)];
+};
+
+} // namespace upm
@@ -0,0 +1,179 @@
+/** ****************************************************************************
+ *  @file    PoseBuckets.cpp
+ *  @brief   Grouping of faces by yaw bin for pose-conditioned models
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <PoseBuckets.hpp>
+#include <trace.hpp>
+#include <utils.hpp>
+#include <iterator>
+
+namespace upm {
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+PoseBuckets::PoseBuckets() :
+  m_offsets(HP_LABELS.size()+2, 0)
+{
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+PoseBuckets::assign
+  (
+  const std::vector<FaceAnnotation> &faces
+  )
+{
+  m_yaws.resize(faces.size());
+  for (unsigned int i=0; i < faces.size(); i++)
+    m_yaws[i] = faces[i].headpose.x;
+  assign(m_yaws.data(), static_cast<unsigned int>(m_yaws.size()));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: histogram, exclusive prefix sum and stable placement,
+// so each bucket keeps the original relative order.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+PoseBuckets::assign
+  (
+  const float *yaws,
+  unsigned int num_items
+  )
+{
+  const unsigned int unknown = static_cast<unsigned int>(HP_LABELS.size());
+  m_bins.resize(num_items);
+  getHeadposeIdx(yaws, num_items, m_bins.data());
+  for (unsigned int i=0; i < num_items; i++)
+    if (yaws[i] == -FLT_MAX)
+      m_bins[i] = static_cast<int>(unknown);
+
+  std::fill(m_offsets.begin(), m_offsets.end(), 0);
+  for (unsigned int i=0; i < num_items; i++)
+    m_offsets[m_bins[i]+1]++;
+  for (unsigned int b=1; b < m_offsets.size(); b++)
+    m_offsets[b] += m_offsets[b-1];
+  m_order.resize(num_items);
+  std::vector<unsigned int> next(m_offsets.begin(), m_offsets.end()-1);
+  for (unsigned int i=0; i < num_items; i++)
+    m_order[next[m_bins[i]]++] = i;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+FacePoseBatcher::process
+  (
+  cv::Mat frame,
+  std::vector<upm::FaceAnnotation> &faces,
+  const upm::FaceAnnotation &ann
+  )
+{
+  m_buckets.assign(faces);
+  m_results.clear();
+  bool same_size = true;
+  for (unsigned int b=0; b < m_buckets.getNumBuckets(); b++)
+  {
+    if (m_buckets.begin(b) == m_buckets.end(b))
+      continue;
+    /// Gather
+    m_batch.clear();
+    for (const unsigned int *it=m_buckets.begin(b); it != m_buckets.end(b); it++)
+      m_batch.push_back(std::move(faces[*it]));
+    const size_t num_faces = m_batch.size();
+    m_component->process(frame, m_batch, ann);
+    same_size = same_size and (m_batch.size() == num_faces);
+    m_results.insert(m_results.end(), std::make_move_iterator(m_batch.begin()), std::make_move_iterator(m_batch.end()));
+  }
+  if (not same_size)
+  {
+    UPM_LOG_RATE(upm::LogLevel::warning, 1, "FacePoseBatcher: component changed the number of faces, output kept in bucket order");
+    faces.swap(m_results);
+    return;
+  }
+  /// Scatter, buckets are contiguous in the permutation
+  const unsigned int *order = m_buckets.begin(0);
+  for (unsigned int i=0; i < m_results.size(); i++)
+    faces[order[i]] = std::move(m_results[i]);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the shared FrameCache is reset once per image, before
+// its buckets, so every call on that image reuses the same pyramids and crops.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: batches whose number of faces the component
+// changed are left unprocessed, the other batches still run.
+//
+// -----------------------------------------------------------------------------
+void
+processByPose
+  (
+  const boost::shared_ptr<FaceComponent> &component,
+  const std::vector<cv::Mat> &frames,
+  std::vector< std::vector<FaceAnnotation> > &faces,
+  const std::vector<FaceAnnotation> &anns
+  )
+{
+  PoseBuckets buckets;
+  std::vector<FaceAnnotation> batch;
+  for (unsigned int i=0; i < faces.size(); i++)
+  {
+    if (faces[i].empty())
+      continue;
+    component->getFrameCache()->reset(frames[i]);
+    buckets.assign(faces[i]);
+    for (unsigned int b=0; b < buckets.getNumBuckets(); b++)
+    {
+      if (buckets.begin(b) == buckets.end(b))
+        continue;
+      batch.clear();
+      for (const unsigned int *it=buckets.begin(b); it != buckets.end(b); it++)
+        batch.push_back(faces[i][*it]);
+      component->process(frames[i], batch, anns[i]);
+      /// The input faces stay untouched when the batch does not match
+      if (batch.size() == static_cast<unsigned int>(buckets.end(b)-buckets.begin(b)))
+        for (unsigned int k=0; k < batch.size(); k++)
+          faces[i][buckets.begin(b)[k]] = std::move(batch[k]);
+      else
+        UPM_LOG_RATE(upm::LogLevel::warning, 1, "processByPose: component changed the number of faces of image " << i << ", faces kept unprocessed");
+    }
+  }
+};
+
+} // namespace upm
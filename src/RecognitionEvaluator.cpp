@@ -0,0 +1,414 @@
+/** ****************************************************************************
+ *  @file    RecognitionEvaluator.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <trace.hpp>
+#include <RecognitionEvaluator.hpp>
+#include <mutex>
+#include <cmath>
+#include <cfloat>
+#include <iomanip>
+
+namespace upm {
+
+/// Samples per side of the score tiles, 512x512 floats stay in L2 cache
+const int SCORE_BLOCK = 512;
+
+/// FARs reported when there are enough impostor pairs to measure them
+const std::vector<float> REPORTED_FARS = {1e-6f, 1e-5f, 1e-4f, 1e-3f, 1e-2f, 1e-1f};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static inline unsigned int
+scoreBin
+  (
+  float score
+  )
+{
+  const int bin = static_cast<int>((score+1.0f)*(0.5f*RecognitionEvaluator::NUM_BINS));
+  return static_cast<unsigned int>(std::min(std::max(bin, 0), static_cast<int>(RecognitionEvaluator::NUM_BINS)-1));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the embedding is stored L2 normalised so that dot
+// products are cosine similarities.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+RecognitionEvaluator::addEmbedding
+  (
+  const std::string &identity,
+  const cv::Mat &embedding
+  )
+{
+  if ((embedding.type() != CV_32F) or (embedding.total() == 0) or (not embedding.isContinuous()))
+  {
+    UPM_ERROR("Recognition evaluation expects a continuous float embedding");
+    return false;
+  }
+  cv::Mat row = embedding.reshape(1,1).clone();
+  if ((not m_embeddings.empty()) and (row.cols != m_embeddings.cols))
+  {
+    UPM_ERROR("Embedding of dimension " << row.cols << " evaluated with " << m_embeddings.cols);
+    return false;
+  }
+  float *values = row.ptr<float>(0);
+  double sum = 0.0;
+  for (int j=0; j < row.cols; j++)
+    sum += static_cast<double>(values[j])*values[j];
+  if (sum <= FLT_EPSILON)
+  {
+    UPM_ERROR("Null embedding of identity " << identity << " ignored");
+    return false;
+  }
+  const float scale = static_cast<float>(1.0/std::sqrt(sum));
+  for (int j=0; j < row.cols; j++)
+    values[j] *= scale;
+
+  std::unordered_map<std::string,int>::const_iterator it = m_identities.find(identity);
+  if (it == m_identities.end())
+  {
+    it = m_identities.insert(std::make_pair(identity, static_cast<int>(m_names.size()))).first;
+    m_names.push_back(identity);
+  }
+  m_embeddings.push_back(row);
+  m_labels.push_back(it->second);
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: identities are matched by name, so evaluators filled on
+// different shards of a dataset can be merged before scoring.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+RecognitionEvaluator::merge
+  (
+  const RecognitionEvaluator &evaluator
+  )
+{
+  for (int i=0; i < evaluator.m_embeddings.rows; i++)
+    addEmbedding(evaluator.m_names[evaluator.m_labels[i]], evaluator.m_embeddings.row(i));
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+RecognitionEvaluator::clear()
+{
+  m_embeddings.release();
+  m_labels.clear();
+  m_names.clear();
+  m_identities.clear();
+  m_genuine.clear();
+  m_impostor.clear();
+  m_num_genuine = 0;
+  m_num_impostor = 0;
+  m_ranks.clear();
+  m_num_probes = 0;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: each task owns a block of rows and multiplies it against
+// every column block, so the best genuine score and the sorted max_rank best
+// impostor scores of its rows are updated without locks. Each pair enters the
+// histograms once, from the row with the lowest index; the local histograms
+// are merged once per task.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the whole matrix is computed, twice the products
+// of the upper triangle, because ranking needs every row complete. 100k
+// samples of 128 floats are 1.3 Tflop, about a minute on an 8-core CPU.
+//
+// -----------------------------------------------------------------------------
+void
+RecognitionEvaluator::score()
+{
+  const int num_samples = m_embeddings.rows;
+  m_genuine.assign(NUM_BINS, 0);
+  m_impostor.assign(NUM_BINS, 0);
+  m_ranks.assign(m_max_rank+1, 0);
+  m_num_genuine = 0;
+  m_num_impostor = 0;
+  m_num_probes = 0;
+  if (num_samples < 2)
+    return;
+
+  const int num_blocks = (num_samples+SCORE_BLOCK-1) / SCORE_BLOCK;
+  const unsigned int max_rank = m_max_rank;
+  std::vector<float> best_genuine(num_samples, -FLT_MAX);
+  std::vector<float> best_impostors(static_cast<size_t>(num_samples)*max_rank, -FLT_MAX);
+  std::mutex mutex;
+  cv::parallel_for_(cv::Range(0,num_blocks), [&](const cv::Range &range)
+  {
+    std::vector<unsigned long long> genuine(NUM_BINS, 0), impostor(NUM_BINS, 0);
+    cv::Mat tile;
+    for (int block=range.start; block < range.end; block++)
+    {
+      const int row_start = block*SCORE_BLOCK;
+      const int row_end = std::min(row_start+SCORE_BLOCK, num_samples);
+      const cv::Mat rows = m_embeddings.rowRange(row_start, row_end);
+      for (int col_start=0; col_start < num_samples; col_start+=SCORE_BLOCK)
+      {
+        const int col_end = std::min(col_start+SCORE_BLOCK, num_samples);
+        cv::gemm(rows, m_embeddings.rowRange(col_start, col_end), 1.0, cv::noArray(), 0.0, tile, cv::GEMM_2_T);
+        for (int i=row_start; i < row_end; i++)
+        {
+          const float *scores = tile.ptr<float>(i-row_start);
+          const int label = m_labels[i];
+          float *top = &best_impostors[static_cast<size_t>(i)*max_rank];
+          for (int j=col_start; j < col_end; j++)
+          {
+            if (j == i)
+              continue;
+            const float score = scores[j-col_start];
+            if (m_labels[j] == label)
+            {
+              best_genuine[i] = std::max(best_genuine[i], score);
+              if (j > i)
+                genuine[scoreBin(score)]++;
+              continue;
+            }
+            if (j > i)
+              impostor[scoreBin(score)]++;
+            if (score <= top[0])
+              continue;
+            // Ascending insertion dropping the lowest impostor
+            unsigned int k = 0;
+            while ((k+1 < max_rank) and (top[k+1] < score))
+            {
+              top[k] = top[k+1];
+              k++;
+            }
+            top[k] = score;
+          }
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (unsigned int bin=0; bin < NUM_BINS; bin++)
+    {
+      m_genuine[bin] += genuine[bin];
+      m_impostor[bin] += impostor[bin];
+    }
+  }, num_blocks);
+
+  for (unsigned int bin=0; bin < NUM_BINS; bin++)
+  {
+    m_num_genuine += m_genuine[bin];
+    m_num_impostor += m_impostor[bin];
+  }
+  for (int i=0; i < num_samples; i++)
+  {
+    if (best_genuine[i] == -FLT_MAX)
+      continue;
+    const float *top = &best_impostors[static_cast<size_t>(i)*max_rank];
+    unsigned int above = 0;
+    while ((above < max_rank) and (top[max_rank-1-above] > best_genuine[i]))
+      above++;
+    m_ranks[above]++;
+    m_num_probes++;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: accepting every pair at or above a bin threshold, the
+// rates are the cumulative histogram counts from the highest bin down.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+RecognitionEvaluator::getRoc
+  (
+  std::vector<float> &false_accept_rates,
+  std::vector<float> &true_accept_rates,
+  std::vector<float> &thresholds
+  ) const
+{
+  false_accept_rates.clear();
+  true_accept_rates.clear();
+  thresholds.clear();
+  const double num_genuine = static_cast<double>(std::max(m_num_genuine, 1ULL));
+  const double num_impostor = static_cast<double>(std::max(m_num_impostor, 1ULL));
+  unsigned long long accepted_genuine = 0, accepted_impostor = 0;
+  for (int bin=static_cast<int>(m_genuine.size())-1; bin >= 0; bin--)
+  {
+    if ((m_genuine[bin] == 0) and (m_impostor[bin] == 0))
+      continue;
+    accepted_genuine += m_genuine[bin];
+    accepted_impostor += m_impostor[bin];
+    false_accept_rates.push_back(static_cast<float>(accepted_impostor/num_impostor));
+    true_accept_rates.push_back(static_cast<float>(accepted_genuine/num_genuine));
+    thresholds.push_back(getBinScore(static_cast<unsigned int>(bin)));
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the threshold is 1 when no pair can be accepted.
+//
+// -----------------------------------------------------------------------------
+float
+RecognitionEvaluator::getTrueAcceptRate
+  (
+  float false_accept_rate,
+  float &threshold
+  ) const
+{
+  threshold = 1.0f;
+  float true_accept_rate = 0.0f;
+  std::vector<float> fars, tars, thresholds;
+  getRoc(fars, tars, thresholds);
+  for (unsigned int i=0; (i < fars.size()) and (fars[i] <= false_accept_rate); i++)
+  {
+    true_accept_rate = tars[i];
+    threshold = thresholds[i];
+  }
+  return true_accept_rate;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+RecognitionEvaluator::getCmc
+  (
+  std::vector<float> &identification_rates
+  ) const
+{
+  identification_rates.clear();
+  if (m_ranks.empty())
+    return;
+  const float num_probes = static_cast<float>(std::max(m_num_probes, 1U));
+  unsigned int identified = 0;
+  for (unsigned int rank=0; rank < m_max_rank; rank++)
+  {
+    identified += m_ranks[rank];
+    identification_rates.push_back(static_cast<float>(identified) / num_probes);
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: ranks above max_rank are clamped to it.
+//
+// -----------------------------------------------------------------------------
+float
+RecognitionEvaluator::getIdentificationRate
+  (
+  unsigned int rank
+  ) const
+{
+  std::vector<float> identification_rates;
+  getCmc(identification_rates);
+  if ((rank == 0) or identification_rates.empty())
+    return 0.0f;
+  return identification_rates[std::min(rank, m_max_rank)-1];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+float
+RecognitionEvaluator::getBinScore
+  (
+  unsigned int bin
+  )
+{
+  return -1.0f + 2.0f*static_cast<float>(bin)/static_cast<float>(NUM_BINS);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: a FAR is only reported when at least one impostor pair
+// can be accepted at that rate.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+reportVerification
+  (
+  const RecognitionEvaluator &evaluator,
+  std::ostream &output
+  )
+{
+  const std::ios::fmtflags flags = output.flags();
+  const std::streamsize precision = output.precision();
+  output << std::setprecision(4);
+  output << "verification samples=" << evaluator.getNumSamples() << " identities=" << evaluator.getNumIdentities();
+  output << " genuine=" << evaluator.getNumGenuine() << " impostor=" << evaluator.getNumImpostor() << std::endl;
+  for (float far : REPORTED_FARS)
+  {
+    if (static_cast<double>(evaluator.getNumImpostor())*far < 1.0)
+      continue;
+    float threshold;
+    const float tar = evaluator.getTrueAcceptRate(far, threshold);
+    output << "verification far=" << far << " tar=" << tar << " threshold=" << threshold << std::endl;
+  }
+  output << "identification probes=" << evaluator.getNumProbes();
+  output << " rank1=" << evaluator.getIdentificationRate(1);
+  output << " rank" << evaluator.getMaxRank() << "=" << evaluator.getIdentificationRate(evaluator.getMaxRank()) << std::endl;
+  output.flags(flags);
+  output.precision(precision);
+};
+
+} // namespace upm
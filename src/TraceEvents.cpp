@@ -0,0 +1,222 @@
+/** ****************************************************************************
+ *  @file    TraceEvents.cpp
+ *  @brief   Structured tracing of begin/end/counter events
+ *  @author  Roberto Valle Fernandez
+ *  @date    2015/06
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <TraceEvents.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+
+namespace upm {
+
+const unsigned long long TRACE_BUFFER_SIZE = 1 << 16; // power of two
+
+struct TraceEvent
+{
+  const char *name;
+  char phase; // 'B'egin, 'E'nd or 'C'ounter
+  long long timestamp; // nanoseconds
+  double value;
+};
+
+/// Ring entry, atomic so the exporter may read it while the owner overwrites
+struct TraceSlot
+{
+  std::atomic<const char *> name;
+  std::atomic<char> phase;
+  std::atomic<long long> timestamp;
+  std::atomic<double> value;
+};
+
+struct TraceBuffer
+{
+  TraceBuffer
+    (
+    unsigned int id
+    ) : tid(id), head(0), events(TRACE_BUFFER_SIZE) {};
+
+  unsigned int tid;
+  std::atomic<unsigned long long> head; // number of events ever written
+  std::vector<TraceSlot> events;
+};
+
+/// Buffers outlive their threads so events can be exported after a join
+static std::mutex trace_mutex;
+static std::vector< std::shared_ptr<TraceBuffer> > trace_buffers;
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the registry lock is only taken the first time each
+// thread records an event.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static TraceBuffer &
+getThreadBuffer()
+{
+  thread_local TraceBuffer *buffer = nullptr;
+  if (not buffer)
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_buffers.push_back(std::make_shared<TraceBuffer>(static_cast<unsigned int>(trace_buffers.size())));
+    buffer = trace_buffers.back().get();
+  }
+  return *buffer;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: single producer ring, the release store of the head
+// publishes the event to the exporting thread. The release fence orders the
+// previous head before the overwrite of the slot, so an exporter reading the
+// new values also sees that head and discards the entry.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static void
+pushTraceEvent
+  (
+  const char *name,
+  char phase,
+  double value
+  )
+{
+  TraceBuffer &buffer = getThreadBuffer();
+  const unsigned long long head = buffer.head.load(std::memory_order_relaxed);
+  TraceSlot &slot = buffer.events[head & (TRACE_BUFFER_SIZE-1)];
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.phase.store(phase, std::memory_order_relaxed);
+  slot.timestamp.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+  slot.value.store(value, std::memory_order_relaxed);
+  buffer.head.store(head+1, std::memory_order_release);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+TraceEvents::begin
+  (
+  const char *name
+  )
+{
+  pushTraceEvent(name, 'B', 0.0);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+TraceEvents::end
+  (
+  const char *name
+  )
+{
+  pushTraceEvent(name, 'E', 0.0);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+TraceEvents::counter
+  (
+  const char *name,
+  double value
+  )
+{
+  pushTraceEvent(name, 'C', value);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: copies the live window of every ring and discards the
+// entries the producer overwrote meanwhile, including the one aliasing the
+// slot it may be writing (index new_head).
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+bool
+TraceEvents::exportChromeJson
+  (
+  const std::string &path
+  )
+{
+  std::ofstream ofs(path);
+  if (not ofs.is_open())
+    return false;
+  std::vector< std::shared_ptr<TraceBuffer> > buffers;
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    buffers = trace_buffers;
+  }
+  ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  std::vector<TraceEvent> events;
+  for (const std::shared_ptr<TraceBuffer> &buffer : buffers)
+  {
+    const unsigned long long head = buffer->head.load(std::memory_order_acquire);
+    unsigned long long tail = (head > TRACE_BUFFER_SIZE) ? head-TRACE_BUFFER_SIZE : 0;
+    events.clear();
+    for (unsigned long long i=tail; i < head; i++)
+    {
+      const TraceSlot &slot = buffer->events[i & (TRACE_BUFFER_SIZE-1)];
+      events.push_back({slot.name.load(std::memory_order_relaxed), slot.phase.load(std::memory_order_relaxed), slot.timestamp.load(std::memory_order_relaxed), slot.value.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const unsigned long long new_head = buffer->head.load(std::memory_order_relaxed);
+    const unsigned long long overwritten = (new_head >= TRACE_BUFFER_SIZE) ? new_head+1-TRACE_BUFFER_SIZE : 0;
+    for (unsigned long long i=std::max(tail,overwritten); i < head; i++)
+    {
+      const TraceEvent &event = events[i-tail];
+      ofs << (first ? "\n" : ",\n");
+      ofs << "{\"name\":\"" << event.name << "\",\"ph\":\"" << event.phase << "\",\"ts\":" << (event.timestamp/1000) << "." << (event.timestamp%1000)/100;
+      ofs << ",\"pid\":1,\"tid\":" << buffer->tid;
+      if (event.phase == 'C')
+        ofs << ",\"args\":{\"value\":" << event.value << "}";
+      ofs << "}";
+      first = false;
+    }
+  }
+  ofs << "\n]}" << std::endl;
+  return ofs.good();
+};
+
+} // namespace upm
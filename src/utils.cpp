@@ -12,7 +12,6 @@
 #include <trace.hpp>
 #include <ModernPosit.h>
 #include <iomanip>
-#include <boost/algorithm/cxx11/iota.hpp>
 
 namespace upm {
 
@@ -37,6 +36,7 @@ processFrame
   const FaceAnnotation &ann
   )
 {
+  UPM_TRACE_SCOPE("processFrame");
   double ticks = static_cast<double>(cv::getTickCount());
   composite->process(frame, faces, ann);
   return static_cast<double>(cv::getTickCount()) - ticks;
@@ -104,6 +104,36 @@ intersection
   return intersect;
 };
 
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: the bin of a label is the number of thresholds below
+// it. Each threshold is the midpoint between two consecutive HP_LABELS,
+// nudged one ulp down when a tie must go to the upper bin, so a single
+// strict comparison keeps the lower absolute index rule (i.e. if [0, 30] are
+// 15 then 0).
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static const std::vector<float> &
+getHeadposeThresholds()
+{
+  static const std::vector<float> thresholds = []{
+    const int half = (static_cast<int>(HP_LABELS.size())-1) / 2;
+    std::vector<float> edges;
+    for (int i=0; i < static_cast<int>(HP_LABELS.size())-1; i++)
+    {
+      const float edge = (HP_LABELS[i] + HP_LABELS[i+1]) * 0.5f;
+      const bool upper_wins = std::abs(i+1-half) < std::abs(i-half);
+      edges.push_back(upper_wins ? std::nextafter(edge, -FLT_MAX) : edge);
+    }
+    return edges;
+  }();
+  return thresholds;
+};
+
 // -----------------------------------------------------------------------------
 //
 // Purpose and Method:
@@ -119,24 +149,36 @@ getHeadposeIdx
   float label
   )
 {
-  cv::Mat diff = cv::abs(cv::Mat(HP_LABELS)-label);
-  float minimum = *std::min_element(diff.begin<float>(), diff.end<float>());
-  /// In case of draw use lower angle interval (i.e. if [0, 30] are 15 then 0)
-  const int num_headposes = static_cast<int>(HP_LABELS.size());
-  const int half = (num_headposes-1) / 2;
-  std::vector<int> indices(num_headposes);
-  boost::algorithm::iota(indices.begin(), indices.end(), -half);
-  int best_idx, best_min = INT_MAX;
-  for (auto it = diff.begin<float>(); it < diff.end<float>(); it++)
-  {
-    int idx = static_cast<int>(std::distance(diff.begin<float>(),it));
-    if (((*it) == minimum) and (abs(indices[idx]) < best_min))
-    {
-      best_idx = idx;
-      best_min = abs(indices[idx]);
-    }
-  }
-  return best_idx;
+  const std::vector<float> &thresholds = getHeadposeThresholds();
+  int idx = 0;
+  for (float threshold : thresholds)
+    idx += (label > threshold);
+  return idx;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: thresholds in the outer loop so the inner loop over the
+// labels vectorizes.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+getHeadposeIdx
+  (
+  const float *labels,
+  unsigned int num_labels,
+  int *indices
+  )
+{
+  const std::vector<float> &thresholds = getHeadposeThresholds();
+  std::fill(indices, indices+num_labels, 0);
+  for (float threshold : thresholds)
+    for (unsigned int i=0; i < num_labels; i++)
+      indices[i] += (labels[i] > threshold);
 };
 
 // -----------------------------------------------------------------------------
@@ -166,6 +208,74 @@ getBbox
   return ann.bbox.pos;
 };
 
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: enlarges each side by 'scale' times the box size and
+// returns the square with the enlarged height centered on the box.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Rect_<float>
+getEnlargedBbox
+  (
+  const cv::Rect_<float> &bbox,
+  float scale
+  )
+{
+  cv::Point2f shift(bbox.width*scale, bbox.height*scale);
+  cv::Rect_<float> bbox_enlarged = cv::Rect_<float>(bbox.x-shift.x, bbox.y-shift.y, bbox.width+(shift.x*2), bbox.height+(shift.y*2));
+  bbox_enlarged.x = bbox_enlarged.x+(bbox_enlarged.width*0.5f)-(bbox_enlarged.height*0.5f);
+  bbox_enlarged.width = bbox_enlarged.height;
+  return bbox_enlarged;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+cv::Point3f
+estimateHeadpose
+  (
+  const std::vector<cv::Point3f> &world_pts,
+  const std::vector<cv::Point2f> &image_pts,
+  const cv::Rect_<float> &bbox
+  )
+{
+  /// Intrinsic parameters (image -> camera)
+  const float BBOX_SCALE = 0.3f;
+  cv::Rect_<float> bbox_enlarged = getEnlargedBbox(bbox, BBOX_SCALE);
+  double focal_length = static_cast<double>(bbox_enlarged.width) * 1.5;
+  cv::Point2f face_center = (bbox_enlarged.tl() + bbox_enlarged.br()) * 0.5f;
+  cv::Mat cam_matrix;
+  cam_matrix = (cv::Mat_<float>(3,3) << focal_length,0,face_center.x, 0,focal_length,face_center.y, 0,0,1);
+  /// Extrinsic parameters (camera -> 3D world)
+  cv::Mat rot_matrix, trl_matrix;
+  ModernPosit::run(world_pts, image_pts, cam_matrix, 100, rot_matrix, trl_matrix);
+//  cv::Mat rot_matrix1 = (cv::Mat_<float>(3,4) << rot_matrix.at<float>(0,0),rot_matrix.at<float>(0,1),rot_matrix.at<float>(0,2),trl_matrix.at<float>(0), rot_matrix.at<float>(1,0),rot_matrix.at<float>(1,1),rot_matrix.at<float>(1,2),trl_matrix.at<float>(1), rot_matrix.at<float>(2,0),rot_matrix.at<float>(2,1),rot_matrix.at<float>(2,2),trl_matrix.at<float>(2));
+//  std::cout << rot_matrix1 << std::endl;
+//  cv::Mat rmat2, rvec2, tvec2;
+//  cv::solvePnP(world_pts, image_pts, cam_matrix, cv::Mat(), rvec2, tvec2, false, cv::SOLVEPNP_ITERATIVE);
+//  cv::Rodrigues(rvec2, rmat2);
+//  cv::Mat rot_matrix2 = (cv::Mat_<float>(3,4) << rmat2.at<float>(0,0),rmat2.at<float>(0,1),rmat2.at<float>(0,2),tvec2.at<float>(0), rmat2.at<float>(1,0),rmat2.at<float>(1,1),rmat2.at<float>(1,2),tvec2.at<float>(1), rmat2.at<float>(2,0),rmat2.at<float>(2,1),rmat2.at<float>(2,2),tvec2.at<float>(2));
+//  std::cout << rot_matrix2 << std::endl;
+//  cv::Mat rmat3, rvec3, tvec3, inliers;
+//  cv::solvePnPRansac(world_pts, image_pts, cam_matrix, cv::Mat(), rvec3, tvec3, false, 100, 15.0f, 0.995, inliers, cv::SOLVEPNP_ITERATIVE);
+//  cv::Rodrigues(rvec3, rmat3);
+//  cv::Mat rot_matrix3 = (cv::Mat_<float>(3,4) << rmat3.at<float>(0,0),rmat3.at<float>(0,1),rmat3.at<float>(0,2),tvec3.at<float>(0), rmat3.at<float>(1,0),rmat3.at<float>(1,1),rmat3.at<float>(1,2),tvec3.at<float>(1), rmat3.at<float>(2,0),rmat3.at<float>(2,1),rmat3.at<float>(2,2),tvec3.at<float>(2));
+//  std::cout << rot_matrix3 << std::endl;
+
+  /// Decomposition of a rotation matrix into three Euler angles
+  return ModernPosit::rotationMatrixToEuler(rot_matrix);
+};
+
 // -----------------------------------------------------------------------------
 //
 // Purpose and Method:
@@ -187,41 +297,13 @@ getHeadpose
     /// Load 3D face shape
     std::vector<cv::Point3f> world_all;
     std::vector<unsigned int> index_all;
-    ModernPosit::loadWorldShape("faces_framework/headpose/posit/data/", DB_LANDMARKS, world_all, index_all);
+    ModernPosit::loadWorldShape(POSIT_DATA_PATH, DB_LANDMARKS, world_all, index_all);
     /// Robust correspondences
     std::vector<cv::Point3f> world_pts;
     std::vector<cv::Point2f> image_pts;
     const std::vector<unsigned int> mask = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24};
     ModernPosit::setCorrespondences(world_all, index_all, ann, mask, world_pts, image_pts);
-
-    /// Intrinsic parameters (image -> camera)
-    const float BBOX_SCALE = 0.3f;
-    cv::Point2f shift(ann.bbox.pos.width*BBOX_SCALE, ann.bbox.pos.height*BBOX_SCALE);
-    cv::Rect_<float> bbox_enlarged = cv::Rect_<float>(ann.bbox.pos.x-shift.x, ann.bbox.pos.y-shift.y, ann.bbox.pos.width+(shift.x*2), ann.bbox.pos.height+(shift.y*2));
-    bbox_enlarged.x = bbox_enlarged.x+(bbox_enlarged.width*0.5f)-(bbox_enlarged.height*0.5f);
-    bbox_enlarged.width = bbox_enlarged.height;
-    double focal_length = static_cast<double>(bbox_enlarged.width) * 1.5;
-    cv::Point2f face_center = (bbox_enlarged.tl() + bbox_enlarged.br()) * 0.5f;
-    cv::Mat cam_matrix;
-    cam_matrix = (cv::Mat_<float>(3,3) << focal_length,0,face_center.x, 0,focal_length,face_center.y, 0,0,1);
-    /// Extrinsic parameters (camera -> 3D world)
-    cv::Mat rot_matrix, trl_matrix;
-    ModernPosit::run(world_pts, image_pts, cam_matrix, 100, rot_matrix, trl_matrix);
-//    cv::Mat rot_matrix1 = (cv::Mat_<float>(3,4) << rot_matrix.at<float>(0,0),rot_matrix.at<float>(0,1),rot_matrix.at<float>(0,2),trl_matrix.at<float>(0), rot_matrix.at<float>(1,0),rot_matrix.at<float>(1,1),rot_matrix.at<float>(1,2),trl_matrix.at<float>(1), rot_matrix.at<float>(2,0),rot_matrix.at<float>(2,1),rot_matrix.at<float>(2,2),trl_matrix.at<float>(2));
-//    std::cout << rot_matrix1 << std::endl;
-//    cv::Mat rmat2, rvec2, tvec2;
-//    cv::solvePnP(world_pts, image_pts, cam_matrix, cv::Mat(), rvec2, tvec2, false, cv::SOLVEPNP_ITERATIVE);
-//    cv::Rodrigues(rvec2, rmat2);
-//    cv::Mat rot_matrix2 = (cv::Mat_<float>(3,4) << rmat2.at<float>(0,0),rmat2.at<float>(0,1),rmat2.at<float>(0,2),tvec2.at<float>(0), rmat2.at<float>(1,0),rmat2.at<float>(1,1),rmat2.at<float>(1,2),tvec2.at<float>(1), rmat2.at<float>(2,0),rmat2.at<float>(2,1),rmat2.at<float>(2,2),tvec2.at<float>(2));
-//    std::cout << rot_matrix2 << std::endl;
-//    cv::Mat rmat3, rvec3, tvec3, inliers;
-//    cv::solvePnPRansac(world_pts, image_pts, cam_matrix, cv::Mat(), rvec3, tvec3, false, 100, 15.0f, 0.995, inliers, cv::SOLVEPNP_ITERATIVE);
-//    cv::Rodrigues(rvec3, rmat3);
-//    cv::Mat rot_matrix3 = (cv::Mat_<float>(3,4) << rmat3.at<float>(0,0),rmat3.at<float>(0,1),rmat3.at<float>(0,2),tvec3.at<float>(0), rmat3.at<float>(1,0),rmat3.at<float>(1,1),rmat3.at<float>(1,2),tvec3.at<float>(1), rmat3.at<float>(2,0),rmat3.at<float>(2,1),rmat3.at<float>(2,2),tvec3.at<float>(2));
-//    std::cout << rot_matrix3 << std::endl;
-
-    /// Decomposition of a rotation matrix into three Euler angles
-    return ModernPosit::rotationMatrixToEuler(rot_matrix);
+    return estimateHeadpose(world_pts, image_pts, ann.bbox.pos);
   }
   return ann.headpose;
 };
@@ -0,0 +1,339 @@
+/** ****************************************************************************
+ *  @file    faces_framework_benchmark.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2017/05
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <boost/shared_ptr.hpp>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <opencv2/opencv.hpp>
+#include <trace.hpp>
+#include <FaceAnnotation.hpp>
+#include <FaceComposite.hpp>
+#include <FaceQualityGate.hpp>
+#include <DatasetLoader.hpp>
+#include <ImageLoader.hpp>
+#include <utils.hpp>
+#include <AllocationTracker.hpp>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <algorithm>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <sys/resource.h>
+
+/** ****************************************************************************
+ * @class FrameCacheBenchmark
+ * @brief Component requesting the grayscale frame and a 4-level pyramid, the
+ * usual preprocessing of a detector, to measure the shared frame cache.
+ ******************************************************************************/
+class FrameCacheBenchmark : public upm::FaceComponent
+{
+public:
+  FrameCacheBenchmark() : FaceComponent(0) {};
+
+  void parseOptions(int argc, char **argv) {};
+  void train(const std::vector<upm::FaceAnnotation> &anns_train, const std::vector<upm::FaceAnnotation> &anns_valid) {};
+  void load() {};
+  void show(const boost::shared_ptr<upm::Viewer> &viewer, const std::vector<upm::FaceAnnotation> &faces, const upm::FaceAnnotation &ann) {};
+  void evaluate(boost::shared_ptr<std::ostream> output, const std::vector<upm::FaceAnnotation> &faces, const upm::FaceAnnotation &ann) {};
+  void save(const std::string dirpath, cv::Mat frame, const std::vector<upm::FaceAnnotation> &faces, const upm::FaceAnnotation &ann) {};
+
+  void
+  process
+    (
+    cv::Mat frame,
+    std::vector<upm::FaceAnnotation> &faces,
+    const upm::FaceAnnotation &ann
+    )
+  {
+    getFrameCache()->getGray();
+    getFrameCache()->getPyramidLevel(3);
+  };
+};
+
+/// Components selectable with --components, submodules register their own factories here
+const std::map< std::string,std::function<boost::shared_ptr<upm::FaceComponent>()> > BENCHMARK_COMPONENTS = {
+  {"cache", []{return boost::shared_ptr<upm::FaceComponent>(new FrameCacheBenchmark());}},
+  {"quality", []{return boost::shared_ptr<upm::FaceComponent>(new upm::FaceQualityGate());}}
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+double
+getPercentile
+  (
+  const std::vector<double> &sorted,
+  double percentile
+  )
+{
+  if (sorted.empty())
+    return 0.0;
+  const std::size_t rank = static_cast<std::size_t>(std::ceil(percentile*0.01*sorted.size()));
+  return sorted[std::min(std::max(rank,static_cast<std::size_t>(1)),sorted.size())-1];
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: quotes, backslashes and control characters are escaped
+// so any path or component name yields valid JSON.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+std::string
+escapeJson
+  (
+  const std::string &text
+  )
+{
+  std::string escaped;
+  for (const char c : text)
+  {
+    if ((c == '"') or (c == '\\'))
+      escaped += std::string("\\") + c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+    {
+      char code[8];
+      std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(c));
+      escaped += code;
+    }
+    else
+      escaped += c;
+  }
+  return escaped;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: decodes the whole video up-front so that only the
+// composite is measured, then runs 'workers' independent pipelines over the
+// frames and reports throughput, latency percentiles, peak RSS and, when built
+// with UPM_ALLOC_TRACKING, heap allocations per frame as JSON.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+int
+main
+  (
+  int argc,
+  char **argv
+  )
+{
+  // Declare the supported program options
+  namespace po = boost::program_options;
+  po::options_description desc("faces_framework_benchmark options");
+  desc.add_options()
+    ("video", po::value<std::string>()->default_value("test/000909960.avi"), "Input video file")
+    ("components", po::value<std::string>()->default_value(""), "Comma separated components [cache, quality]")
+    ("warmup", po::value<unsigned int>()->default_value(10), "Frames processed before measuring")
+    ("repetitions", po::value<unsigned int>()->default_value(3), "Passes over the video")
+    ("threads", po::value<int>()->default_value(-1), "OpenCV threads (-1 keeps the default)")
+    ("workers", po::value<unsigned int>()->default_value(1), "Concurrent pipelines sharing the frames")
+    ("database", po::value<std::string>()->default_value("300w_public"), "Database of the annotations streamed through the first pipeline")
+    ("annotations", po::value<std::string>()->default_value(""), "Annotations directory, empty skips the streaming pass")
+    ("decoders", po::value<unsigned int>()->default_value(4), "Image decoding threads of the streaming pass")
+    ("prefetch", po::value<unsigned int>()->default_value(16), "Images decoded ahead of the streaming pipeline")
+    ("min-face-size", po::value<float>()->default_value(0.0f), "Decode JPEG images at reduced resolution keeping faces above this size")
+    ("output", po::value<std::string>()->default_value(""), "JSON report file (default standard output)");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).allow_unregistered().run(), vm);
+  po::notify(vm);
+  const std::string video = vm["video"].as<std::string>();
+  const unsigned int warmup = vm["warmup"].as<unsigned int>();
+  const unsigned int repetitions = vm["repetitions"].as<unsigned int>();
+  if (repetitions == 0)
+  {
+    UPM_ERROR("At least one repetition is needed to measure the video");
+    return EXIT_FAILURE;
+  }
+  /// The report is the only standard output, diagnostics go to stderr
+  const std::string output = vm["output"].as<std::string>();
+  std::streambuf *stdout_buf = std::cout.rdbuf();
+  if (output.empty())
+    std::cout.rdbuf(std::cerr.rdbuf());
+  const unsigned int workers = std::max(vm["workers"].as<unsigned int>(), 1U);
+  if (vm["threads"].as<int>() >= 0)
+    cv::setNumThreads(vm["threads"].as<int>());
+  std::vector<std::string> names;
+  if (not vm["components"].as<std::string>().empty())
+    boost::split(names, vm["components"].as<std::string>(), boost::is_any_of(","));
+
+  // Decode every frame before measuring
+  cv::VideoCapture capture;
+  capture.open(video);
+  if (not capture.isOpened())
+  {
+    UPM_ERROR("Could not grab images from video");
+    return EXIT_FAILURE;
+  }
+  std::vector<cv::Mat> frames;
+  cv::Mat frame;
+  while (capture.read(frame) and (not frame.empty()))
+    frames.push_back(frame.clone());
+  if (frames.empty())
+  {
+    UPM_ERROR("Empty video " << video);
+    return EXIT_FAILURE;
+  }
+
+  // Load face components, one composite per worker
+  std::vector< boost::shared_ptr<upm::FaceComposite> > composites;
+  for (unsigned int i=0; i < workers; i++)
+  {
+    boost::shared_ptr<upm::FaceComposite> composite(new upm::FaceComposite());
+    for (const std::string &name : names)
+    {
+      auto found = BENCHMARK_COMPONENTS.find(name);
+      if (found == BENCHMARK_COMPONENTS.end())
+      {
+        UPM_ERROR("Unknown component " << name);
+        return EXIT_FAILURE;
+      }
+      composite->addComponent(found->second());
+    }
+    composite->load();
+    composites.push_back(composite);
+  }
+
+  // Warm-up
+  upm::FaceAnnotation ann;
+  for (unsigned int i=0; i < warmup; i++)
+    for (unsigned int w=0; w < workers; w++)
+    {
+      std::vector<upm::FaceAnnotation> faces;
+      upm::processFrame(frames[i % frames.size()], composites[w], faces, ann);
+    }
+
+  // Measure
+  const unsigned int num_frames = repetitions * static_cast<unsigned int>(frames.size());
+  std::vector< std::vector<double> > latencies(workers);
+  upm::AllocationScope allocs;
+  const double ticks = static_cast<double>(cv::getTickCount());
+  std::vector<std::thread> threads;
+  for (unsigned int w=0; w < workers; w++)
+    threads.emplace_back([&, w]
+    {
+      std::vector<upm::FaceAnnotation> faces;
+      latencies[w].reserve(num_frames/workers + 1);
+      for (unsigned int i=w; i < num_frames; i+=workers)
+      {
+        faces.clear();
+        double frame_ticks = upm::processFrame(frames[i % frames.size()], composites[w], faces, ann);
+        latencies[w].push_back(frame_ticks / cv::getTickFrequency());
+      }
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+  const double seconds = (static_cast<double>(cv::getTickCount()) - ticks) / cv::getTickFrequency();
+  const upm::AllocationStats alloc_stats = allocs.getStats();
+
+  // Stream an annotated database, decoding ahead of the first pipeline
+  std::vector<upm::FaceAnnotation> anns;
+  const std::string annotations = vm["annotations"].as<std::string>();
+  if ((not annotations.empty()) and (not upm::loadDatabase(vm["database"].as<std::string>(), annotations, anns)))
+    return EXIT_FAILURE;
+  double stream_seconds = 0.0, stream_wait_seconds = 0.0;
+  unsigned int stream_reduced = 0;
+  if (not anns.empty())
+  {
+    upm::ImageLoader loader(vm["decoders"].as<unsigned int>(), vm["prefetch"].as<unsigned int>());
+    loader.setMinFaceSize(vm["min-face-size"].as<float>());
+    const double stream_ticks = static_cast<double>(cv::getTickCount());
+    loader.start(anns);
+    upm::LoadedImage loaded;
+    upm::FaceAnnotation scaled;
+    std::vector<upm::FaceAnnotation> faces;
+    while (loader.next(loaded))
+    {
+      faces.clear();
+      if (not loaded.image.empty())
+      {
+        upm::scaleAnnotation(anns[loaded.index], loaded.scale, scaled);
+        upm::processFrame(loaded.image, composites[0], faces, scaled);
+        composites[0]->releaseFrame();
+      }
+      loader.release(loaded);
+    }
+    stream_seconds = (static_cast<double>(cv::getTickCount()) - stream_ticks) / cv::getTickFrequency();
+    stream_wait_seconds = loader.getWaitSeconds();
+    stream_reduced = loader.getNumReduced();
+  }
+
+  std::vector<double> sorted;
+  for (const std::vector<double> &worker_latencies : latencies)
+    sorted.insert(sorted.end(), worker_latencies.begin(), worker_latencies.end());
+  std::sort(sorted.begin(), sorted.end());
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  // Report
+  std::ostringstream json;
+  json << "{" << std::endl;
+  json << "  \"video\": \"" << escapeJson(video) << "\"," << std::endl;
+  json << "  \"components\": [";
+  for (unsigned int i=0; i < names.size(); i++)
+    json << (i > 0 ? ", " : "") << "\"" << escapeJson(names[i]) << "\"";
+  json << "]," << std::endl;
+  json << "  \"threads\": " << cv::getNumThreads() << "," << std::endl;
+  json << "  \"workers\": " << workers << "," << std::endl;
+  json << "  \"warmup_frames\": " << warmup << "," << std::endl;
+  json << "  \"repetitions\": " << repetitions << "," << std::endl;
+  json << "  \"frames\": " << num_frames << "," << std::endl;
+  json << "  \"seconds\": " << seconds << "," << std::endl;
+  json << "  \"throughput_fps\": " << num_frames/seconds << "," << std::endl;
+  json << "  \"latency_ms\": {\"mean\": " << std::accumulate(sorted.begin(),sorted.end(),0.0)*1e3/sorted.size();
+  json << ", \"p50\": " << getPercentile(sorted,50)*1e3 << ", \"p90\": " << getPercentile(sorted,90)*1e3;
+  json << ", \"p95\": " << getPercentile(sorted,95)*1e3 << ", \"p99\": " << getPercentile(sorted,99)*1e3;
+  json << ", \"max\": " << sorted.back()*1e3 << "}," << std::endl;
+  if (not anns.empty())
+  {
+    json << "  \"stream\": {\"images\": " << anns.size() << ", \"seconds\": " << stream_seconds << ", \"fps\": " << anns.size()/stream_seconds;
+    json << ", \"decode_wait_seconds\": " << stream_wait_seconds << ", \"reduced\": " << stream_reduced << "}," << std::endl;
+  }
+  json << "  \"peak_rss_kb\": " << usage.ru_maxrss << "," << std::endl;
+  if (upm::AllocationTracker::isEnabled())
+  {
+    json << "  \"allocations_per_frame\": " << static_cast<double>(alloc_stats.allocations)/num_frames << "," << std::endl;
+    json << "  \"allocated_bytes_per_frame\": " << static_cast<double>(alloc_stats.bytes)/num_frames << "," << std::endl;
+    json << "  \"peak_live_bytes\": " << alloc_stats.peak_bytes << std::endl;
+  }
+  else
+    json << "  \"allocations_per_frame\": null" << std::endl;
+  json << "}";
+  /// Profiles are printed when the composites are destroyed
+  composites.clear();
+  upm::Logger::getInstance().flush();
+  if (output.empty())
+  {
+    std::cout.rdbuf(stdout_buf);
+    std::cout << json.str() << std::endl;
+  }
+  else
+  {
+    std::ofstream ofs(output);
+    ofs << json.str() << std::endl;
+  }
+  return EXIT_SUCCESS;
+};
@@ -0,0 +1,520 @@
+/** ****************************************************************************
+ *  @file    faces_framework_microbenchmark.cpp
+ *  @brief   Face detection and recognition framework
+ *  @author  Roberto Valle Fernandez
+ *  @date    2017/05
+ *  @copyright All rights reserved.
+ *  Software developed by UPM PCR Group: http://www.dia.fi.upm.es/~pcr
+ ******************************************************************************/
+
+// ----------------------- INCLUDES --------------------------------------------
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <opencv2/opencv.hpp>
+#include <trace.hpp>
+#include <FaceAnnotation.hpp>
+#include <FaceAlignment.hpp>
+#include <ModernPosit.h>
+#include <LandmarkSchema.hpp>
+#include <FaceGallery.hpp>
+#include <EmbeddingCodec.hpp>
+#include <RecognitionEvaluator.hpp>
+#include <FaceAnnotationCodec.hpp>
+#include <Viewer.hpp>
+#include <utils.hpp>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+
+/// Landmark counts of the shipped mean-face files
+const std::vector<unsigned int> BENCHMARK_LANDMARKS = {21, 24, 29, 68, 84, 98};
+const std::vector<unsigned int> BENCHMARK_BATCHES = {1, 16, 256};
+
+/// Gallery lookups, 'batch' is the number of queries
+const unsigned int BENCHMARK_EMBEDDING_DIM = 128;
+const unsigned int BENCHMARK_GALLERY_SIZE = 16384;
+const unsigned int BENCHMARK_EVALUATION_SIZE = 4096;
+
+/// Results are accumulated here so the compiler cannot discard the kernels
+volatile double bench_sink = 0.0;
+
+/** ****************************************************************************
+ * @class OffscreenViewer
+ * @brief Viewer drawing into its canvas without opening a window, so the
+ * primitives can be measured without a display.
+ ******************************************************************************/
+class OffscreenViewer : public upm::Viewer
+{
+public:
+  void
+  init
+    (
+    int width,
+    int height,
+    std::string window_title
+    )
+  {
+    m_canvas = cv::Mat(cv::Size(width,height), CV_8UC3, cv::Scalar::all(0));
+    m_initialised = true;
+    m_drawing = true;
+    m_window_title = window_title;
+    m_width = width;
+    m_height = height;
+  };
+};
+
+/** ****************************************************************************
+ * @class SyntheticFaces
+ * @brief Mean-face landmarks projected with random head poses, bounding boxes
+ * and pixel noise. Each annotation comes with a perturbed copy playing the
+ * role of the estimated face.
+ ******************************************************************************/
+struct SyntheticFaces
+{
+  std::vector<unsigned int> ids;
+  std::vector<cv::Point3f> world;
+  std::vector<upm::FaceAnnotation> anns;
+  std::vector<upm::FaceAnnotation> faces;
+  std::vector<cv::Point3f> headposes;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: ids are read from the mean-face file itself since the
+// landmark numbering differs between databases.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+loadMeanFaceIds
+  (
+  const std::string &path,
+  unsigned int num_landmarks,
+  std::vector<unsigned int> &ids
+  )
+{
+  std::ifstream ifs(path + "mean_face_3D_" + std::to_string(num_landmarks) + ".txt");
+  std::string line;
+  while (std::getline(ifs, line))
+  {
+    if (line.empty())
+      continue;
+    std::vector<std::string> data;
+    boost::split(data, line, boost::is_any_of("|"));
+    ids.push_back(static_cast<unsigned int>(std::stoi(data[0])));
+  }
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: landmarks are spread over the ten face parts in file
+// order, the eye corners 7 and 12 being forced into the eyes so every error
+// measure finds its normalization landmarks.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+void
+generateFaces
+  (
+  const std::string &path,
+  unsigned int num_landmarks,
+  unsigned int num_faces,
+  cv::RNG &rng,
+  SyntheticFaces &data
+  )
+{
+  loadMeanFaceIds(path, num_landmarks, data.ids);
+  std::vector<unsigned int> index_all;
+  ModernPosit::loadWorldShape(path, data.ids, data.world, index_all);
+  const unsigned int num_parts = static_cast<unsigned int>(upm::FaceAnnotation().parts.size());
+  for (unsigned int i=0; i < num_faces; i++)
+  {
+    cv::Point3f headpose(rng.uniform(-90.0f,90.0f), rng.uniform(-30.0f,30.0f), rng.uniform(-20.0f,20.0f));
+    cv::Mat rot_matrix = ModernPosit::eulerToRotationMatrix(headpose);
+    const float size = rng.uniform(40.0f, 400.0f);
+    const cv::Point2f center(rng.uniform(size,1920.0f-size), rng.uniform(size,1080.0f-size));
+    upm::FaceAnnotation ann, face;
+    for (unsigned int j=0; j < data.world.size(); j++)
+    {
+      cv::Mat pt = rot_matrix * (cv::Mat_<float>(3,1) << data.world[j].x, data.world[j].y, data.world[j].z);
+      const float depth = 10.0f + pt.at<float>(2);
+      cv::Point2f pos = center + cv::Point2f(pt.at<float>(0), pt.at<float>(1)) * (5.0f*size/depth);
+      unsigned int part = (j*num_parts) / static_cast<unsigned int>(data.world.size());
+      if (data.ids[j] == 7)
+        part = upm::FacePartLabel::leye;
+      else if (data.ids[j] == 12)
+        part = upm::FacePartLabel::reye;
+      ann.parts[part].landmarks.push_back({data.ids[j], pos, 0.0f});
+      face.parts[part].landmarks.push_back({data.ids[j], pos + cv::Point2f(rng.gaussian(2.0), rng.gaussian(2.0)), 0.0f});
+    }
+    ann.bbox.pos = upm::getBbox(ann);
+    face.bbox.pos = upm::getBbox(face);
+    data.anns.push_back(ann);
+    data.faces.push_back(face);
+    data.headposes.push_back(headpose);
+  }
+};
+
+/** ****************************************************************************
+ * @class MicroBenchmark
+ * @brief Calibrates the repetitions of a kernel to a minimum sample time and
+ * keeps the median and best time per processed item over several samples.
+ ******************************************************************************/
+class MicroBenchmark
+{
+public:
+  MicroBenchmark
+    (
+    const std::string &filter,
+    double min_time,
+    unsigned int num_samples
+    ) : m_filter(filter), m_min_time(min_time), m_num_samples(num_samples) {};
+
+  /// The kernel processes 'items' elements per call
+  void
+  run
+    (
+    const std::string &name,
+    unsigned int num_landmarks,
+    unsigned int items,
+    const std::function<void()> &kernel
+    )
+  {
+    std::ostringstream label;
+    label << name << "/" << num_landmarks << "/" << items;
+    if ((not m_filter.empty()) and (label.str().find(m_filter) == std::string::npos))
+      return;
+    unsigned long iters = 1;
+    for (;;)
+    {
+      const double seconds = measure(kernel, iters);
+      if ((seconds >= m_min_time) or (iters >= (1UL << 30)))
+        break;
+      iters = (seconds > 0.0) ? std::max(iters*2, static_cast<unsigned long>(iters*1.2*m_min_time/seconds)) : iters*10;
+    }
+    std::vector<double> samples;
+    for (unsigned int i=0; i < m_num_samples; i++)
+      samples.push_back(measure(kernel, iters) * 1e9 / (static_cast<double>(iters)*items));
+    std::sort(samples.begin(), samples.end());
+    m_results.push_back({label.str(), name, num_landmarks, items, iters, samples[samples.size()/2], samples.front()});
+    UPM_PRINT(label.str() << ": " << samples[samples.size()/2] << " ns/item (best " << samples.front() << ")");
+  };
+
+  std::string
+  toJson() const
+  {
+    std::ostringstream json;
+    json << "[";
+    for (unsigned int i=0; i < m_results.size(); i++)
+    {
+      const Result &res = m_results[i];
+      json << (i > 0 ? "," : "") << std::endl;
+      json << "  {\"name\": \"" << res.name << "\", \"landmarks\": " << res.num_landmarks << ", \"batch\": " << res.items;
+      json << ", \"iterations\": " << res.iters << ", \"median_ns\": " << res.median << ", \"min_ns\": " << res.best << "}";
+    }
+    json << std::endl << "]";
+    return json.str();
+  };
+
+private:
+  struct Result
+  {
+    std::string label;
+    std::string name;
+    unsigned int num_landmarks;
+    unsigned int items;
+    unsigned long iters;
+    double median;
+    double best;
+  };
+
+  static double
+  measure
+    (
+    const std::function<void()> &kernel,
+    unsigned long iters
+    )
+  {
+    const double ticks = static_cast<double>(cv::getTickCount());
+    for (unsigned long i=0; i < iters; i++)
+      kernel();
+    return (static_cast<double>(cv::getTickCount()) - ticks) / cv::getTickFrequency();
+  };
+
+  std::string m_filter;
+  double m_min_time;
+  unsigned int m_num_samples;
+  std::vector<Result> m_results;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: times every geometry and evaluation kernel over
+// synthetic faces for each shipped landmark count and batch size. Names are
+// 'kernel/landmarks/batch', use --filter to run a subset.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+int
+main
+  (
+  int argc,
+  char **argv
+  )
+{
+  // Declare the supported program options
+  namespace po = boost::program_options;
+  po::options_description desc("faces_framework_microbenchmark options");
+  desc.add_options()
+    ("data", po::value<std::string>()->default_value("headpose/posit/data/"), "Mean-face files directory")
+    ("filter", po::value<std::string>()->default_value(""), "Only run benchmarks containing this substring")
+    ("min-time", po::value<double>()->default_value(0.05), "Minimum seconds per sample")
+    ("samples", po::value<unsigned int>()->default_value(5), "Samples per benchmark")
+    ("output", po::value<std::string>()->default_value(""), "JSON report file");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).allow_unregistered().run(), vm);
+  po::notify(vm);
+  const std::string path = vm["data"].as<std::string>();
+  MicroBenchmark bench(vm["filter"].as<std::string>(), vm["min-time"].as<double>(), std::max(vm["samples"].as<unsigned int>(), 1U));
+
+  cv::RNG rng(0);
+  const unsigned int max_batch = BENCHMARK_BATCHES.back();
+  OffscreenViewer viewer;
+  viewer.init(1920, 1080, "microbenchmark");
+  cv::Mat frame(480, 640, CV_8UC3);
+  rng.fill(frame, cv::RNG::UNIFORM, 0, 255);
+
+  // Landmark independent kernels
+  std::vector<float> labels(max_batch);
+  std::vector<cv::Rect_<float>> rects(2*max_batch);
+  std::vector<cv::Mat> rot_matrices(max_batch);
+  std::vector<cv::Point3f> headposes(max_batch);
+  for (unsigned int i=0; i < max_batch; i++)
+  {
+    labels[i] = rng.uniform(-100.0f, 100.0f);
+    rects[2*i] = cv::Rect_<float>(rng.uniform(0.0f,1000.0f), rng.uniform(0.0f,1000.0f), rng.uniform(20.0f,400.0f), rng.uniform(20.0f,400.0f));
+    rects[2*i+1] = cv::Rect_<float>(rects[2*i].x+rng.uniform(-200.0f,200.0f), rects[2*i].y+rng.uniform(-200.0f,200.0f), rng.uniform(20.0f,400.0f), rng.uniform(20.0f,400.0f));
+    headposes[i] = cv::Point3f(rng.uniform(-90.0f,90.0f), rng.uniform(-60.0f,60.0f), rng.uniform(-45.0f,45.0f));
+    rot_matrices[i] = ModernPosit::eulerToRotationMatrix(headposes[i]);
+  }
+  for (unsigned int batch : BENCHMARK_BATCHES)
+  {
+    bench.run("getHeadposeIdx", 0, batch, [&]{
+      int sum = 0;
+      for (unsigned int i=0; i < batch; i++)
+        sum += upm::getHeadposeIdx(labels[i]);
+      bench_sink = bench_sink + sum;
+    });
+    bench.run("getHeadposeIdx/batch", 0, batch, [&]{
+      std::vector<int> indices(batch);
+      upm::getHeadposeIdx(labels.data(), batch, indices.data());
+      bench_sink = bench_sink + indices[0];
+    });
+    bench.run("intersection", 0, batch, [&]{
+      int sum = 0;
+      for (unsigned int i=0; i < batch; i++)
+        sum += upm::intersection(rects[2*i], rects[2*i+1]).area();
+      bench_sink = bench_sink + sum;
+    });
+    bench.run("eulerToRotationMatrix", 0, batch, [&]{
+      float sum = 0.0f;
+      for (unsigned int i=0; i < batch; i++)
+        sum += ModernPosit::eulerToRotationMatrix(headposes[i]).at<float>(0,0);
+      bench_sink = bench_sink + sum;
+    });
+    bench.run("rotationMatrixToEuler", 0, batch, [&]{
+      float sum = 0.0f;
+      for (unsigned int i=0; i < batch; i++)
+        sum += ModernPosit::rotationMatrixToEuler(rot_matrices[i]).x;
+      bench_sink = bench_sink + sum;
+    });
+    bench.run("viewer/rectangle", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        viewer.rectangle(static_cast<int>(rects[i].x), static_cast<int>(rects[i].y), static_cast<int>(rects[i].width), static_cast<int>(rects[i].height), 2, cv::Scalar(0,255,0));
+    });
+    bench.run("viewer/text", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        viewer.text("Face 0.97", static_cast<int>(rects[i].x), static_cast<int>(rects[i].y), cv::Scalar(0,255,0), 0.5f);
+    });
+    bench.run("viewer/image", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        viewer.image(frame, 0, 0, 1920, 1080);
+    });
+  }
+
+  // Kernels depending on the number of landmarks
+  const std::vector<upm::ErrorMeasure> measures = {upm::ErrorMeasure::pupils, upm::ErrorMeasure::corners, upm::ErrorMeasure::height, upm::ErrorMeasure::diagonal};
+  const std::vector<std::string> measure_names = {"pupils", "corners", "height", "diagonal"};
+  for (unsigned int num_landmarks : BENCHMARK_LANDMARKS)
+  {
+    SyntheticFaces data;
+    generateFaces(path, num_landmarks, max_batch, rng, data);
+    if (data.ids.size() != num_landmarks)
+    {
+      UPM_ERROR("Mean-face file with " << num_landmarks << " landmarks not found in " << path);
+      return EXIT_FAILURE;
+    }
+    std::vector< std::vector<cv::Point3f> > world_pts(max_batch);
+    std::vector< std::vector<cv::Point2f> > image_pts(max_batch);
+    std::vector<cv::Mat> cam_matrices(max_batch);
+    for (unsigned int i=0; i < max_batch; i++)
+    {
+      ModernPosit::setCorrespondences(data.world, data.ids, data.anns[i], data.ids, world_pts[i], image_pts[i]);
+      cv::Rect_<float> bbox_enlarged = upm::getEnlargedBbox(data.anns[i].bbox.pos, 0.3f);
+      const float focal_length = bbox_enlarged.width * 1.5f;
+      cv::Point2f face_center = (bbox_enlarged.tl() + bbox_enlarged.br()) * 0.5f;
+      cam_matrices[i] = (cv::Mat_<float>(3,3) << focal_length,0,face_center.x, 0,focal_length,face_center.y, 0,0,1);
+    }
+    for (unsigned int batch : BENCHMARK_BATCHES)
+    {
+      bench.run("getBbox", num_landmarks, batch, [&]{
+        float sum = 0.0f;
+        for (unsigned int i=0; i < batch; i++)
+          sum += upm::getBbox(data.anns[i]).width;
+        bench_sink = bench_sink + sum;
+      });
+      for (unsigned int j=0; j < measures.size(); j++)
+        bench.run("getNormalizedErrors/" + measure_names[j], num_landmarks, batch, [&]{
+          std::vector<unsigned int> indices;
+          std::vector<float> errors;
+          for (unsigned int i=0; i < batch; i++)
+            upm::getNormalizedErrors(data.faces[i], data.anns[i], measures[j], indices, errors);
+          bench_sink = bench_sink + errors.size();
+        });
+      const std::string database = (num_landmarks == 21) ? "aflw" : (num_landmarks == 29) ? "cofw" : (num_landmarks == 68) ? "300w_public" : (num_landmarks == 98) ? "wflw" : "";
+      if (not database.empty())
+        for (unsigned int j=0; j < measures.size(); j++)
+          bench.run("getNormalizedErrors<" + database + ">/" + measure_names[j], num_landmarks, batch, [&]{
+            std::vector<unsigned int> indices;
+            std::vector<float> errors;
+            for (unsigned int i=0; i < batch; i++)
+              upm::getNormalizedErrors(database, data.faces[i], data.anns[i], measures[j], indices, errors);
+            bench_sink = bench_sink + errors.size();
+          });
+      bench.run("ModernPosit::setCorrespondences", num_landmarks, batch, [&]{
+        std::vector<cv::Point3f> world;
+        std::vector<cv::Point2f> image;
+        for (unsigned int i=0; i < batch; i++)
+        {
+          world.clear();
+          image.clear();
+          ModernPosit::setCorrespondences(data.world, data.ids, data.anns[i], data.ids, world, image);
+        }
+        bench_sink = bench_sink + image.size();
+      });
+      bench.run("ModernPosit::run", num_landmarks, batch, [&]{
+        cv::Mat rot_matrix, trl_matrix;
+        float sum = 0.0f;
+        for (unsigned int i=0; i < batch; i++)
+        {
+          ModernPosit::run(world_pts[i], image_pts[i], cam_matrices[i], 100, rot_matrix, trl_matrix);
+          sum += trl_matrix.at<float>(2);
+        }
+        bench_sink = bench_sink + sum;
+      });
+      const std::vector<upm::FaceAnnotation> batch_anns(data.anns.begin(), data.anns.begin()+batch);
+      std::vector<unsigned char> encoded;
+      upm::encodeAnnotations(batch_anns, encoded);
+      bench.run("encodeAnnotations", num_landmarks, batch, [&]{
+        encoded.clear();
+        upm::encodeAnnotations(batch_anns, encoded);
+        bench_sink = bench_sink + encoded.size();
+      });
+      bench.run("decodeAnnotations", num_landmarks, batch, [&]{
+        std::vector<upm::FaceAnnotation> decoded;
+        upm::decodeAnnotations(encoded.data(), encoded.size(), decoded);
+        bench_sink = bench_sink + decoded.size();
+      });
+      bench.run("viewer/landmarks", num_landmarks, batch, [&]{
+        for (unsigned int i=0; i < batch; i++)
+          for (const upm::FacePart &part : data.faces[i].parts)
+            for (const upm::FaceLandmark &landmark : part.landmarks)
+              viewer.circle(static_cast<int>(landmark.pos.x), static_cast<int>(landmark.pos.y), 3, -1, cv::Scalar(0,255,0));
+      });
+    }
+  }
+
+  // Identity lookup against a gallery of random unit embeddings
+  cv::Mat embeddings(BENCHMARK_GALLERY_SIZE+max_batch, BENCHMARK_EMBEDDING_DIM, CV_32F);
+  rng.fill(embeddings, cv::RNG::NORMAL, 0, 1);
+  upm::FaceGallery exact(BENCHMARK_EMBEDDING_DIM), approximate(BENCHMARK_EMBEDDING_DIM);
+  upm::FaceGallery scalar(BENCHMARK_EMBEDDING_DIM), product(BENCHMARK_EMBEDDING_DIM);
+  approximate.enableIndex();
+  for (unsigned int i=0; i < BENCHMARK_GALLERY_SIZE; i++)
+  {
+    exact.insert(static_cast<int>(i), embeddings.ptr<float>(i));
+    approximate.insert(static_cast<int>(i), embeddings.ptr<float>(i));
+    scalar.insert(static_cast<int>(i), embeddings.ptr<float>(i));
+    product.insert(static_cast<int>(i), embeddings.ptr<float>(i));
+  }
+  scalar.setCodec(boost::shared_ptr<upm::EmbeddingCodec>(new upm::ScalarQuantizer()));
+  product.setCodec(boost::shared_ptr<upm::EmbeddingCodec>(new upm::ProductQuantizer(16)));
+  std::vector<upm::GalleryMatch> matches;
+  for (unsigned int batch : BENCHMARK_BATCHES)
+  {
+    bench.run("FaceGallery::searchExact/top10", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        exact.searchExact(embeddings.ptr<float>(BENCHMARK_GALLERY_SIZE+i), 10, matches);
+      bench_sink = bench_sink + matches[0].distance;
+    });
+    bench.run("FaceGallery::searchApproximate/top10", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        approximate.searchApproximate(embeddings.ptr<float>(BENCHMARK_GALLERY_SIZE+i), 10, matches);
+      bench_sink = bench_sink + matches[0].distance;
+    });
+    bench.run("FaceGallery::searchQuantized/int8/top10", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        scalar.searchQuantized(embeddings.ptr<float>(BENCHMARK_GALLERY_SIZE+i), 10, 0, matches);
+      bench_sink = bench_sink + matches[0].distance;
+    });
+    bench.run("FaceGallery::searchQuantized/pq16/top10", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        product.searchQuantized(embeddings.ptr<float>(BENCHMARK_GALLERY_SIZE+i), 10, 0, matches);
+      bench_sink = bench_sink + matches[0].distance;
+    });
+    bench.run("FaceGallery::searchQuantized/pq16+rerank100/top10", 0, batch, [&]{
+      for (unsigned int i=0; i < batch; i++)
+        product.searchQuantized(embeddings.ptr<float>(BENCHMARK_GALLERY_SIZE+i), 10, 100, matches);
+      bench_sink = bench_sink + matches[0].distance;
+    });
+  }
+
+  // Recall against latency and memory of every codec setting
+  const cv::Mat queries = embeddings.rowRange(BENCHMARK_GALLERY_SIZE, BENCHMARK_GALLERY_SIZE+max_batch);
+  product.setRerank(100);
+  const std::pair<std::string,const upm::FaceGallery*> settings[] = {{"float+hnsw", &approximate}, {"int8", &scalar}, {"pq16", &product}};
+  for (const std::pair<std::string,const upm::FaceGallery*> &setting : settings)
+  {
+    std::ostringstream outs;
+    upm::reportGalleryTradeoffs(*setting.second, queries, 10, outs);
+    UPM_PRINT("FaceGallery " << setting.first << " trade-offs:" << std::endl << outs.str());
+  }
+
+  // All-pairs verification scoring, 'batch' is the number of samples
+  upm::RecognitionEvaluator evaluator;
+  for (unsigned int i=0; i < BENCHMARK_EVALUATION_SIZE; i++)
+    evaluator.addEmbedding(std::to_string(i/8), embeddings.row(i));
+  bench.run("RecognitionEvaluator::score", 0, BENCHMARK_EVALUATION_SIZE, [&]{
+    evaluator.score();
+    bench_sink = bench_sink + evaluator.getIdentificationRate(1);
+  });
+
+  const std::string output = vm["output"].as<std::string>();
+  if (not output.empty())
+  {
+    std::ofstream ofs(output);
+    ofs << bench.toJson() << std::endl;
+  }
+  return EXIT_SUCCESS;
+};
@@ -9,12 +9,365 @@
 
 // ----------------------- INCLUDES --------------------------------------------
 #include <boost/shared_ptr.hpp>
+#include <boost/filesystem.hpp>
 #include <opencv2/opencv.hpp>
 #include <trace.hpp>
 #include <Viewer.hpp>
 #include <FaceAnnotation.hpp>
 #include <FaceComposite.hpp>
+#include <FaceAnnotationCodec.hpp>
+#include <EmbeddingCodec.hpp>
+#include <FaceGallery.hpp>
+#include <GalleryFile.hpp>
 #include <utils.hpp>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs: 'condition', reporting 'what' when it does not hold
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+check
+  (
+  bool condition,
+  const std::string &what
+  )
+{
+  if (not condition)
+    UPM_ERROR("Check failed: " << what);
+  return condition;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs: true if both searches return the same identities and distances
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+sameMatches
+  (
+  const std::vector<upm::GalleryMatch> &expected,
+  const std::vector<upm::GalleryMatch> &matches
+  )
+{
+  if (expected.size() != matches.size())
+    return false;
+  for (unsigned int i=0; i < expected.size(); i++)
+    if ((expected[i].id != matches[i].id) or (expected[i].distance != matches[i].distance))
+      return false;
+  return true;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method:
+// Inputs:
+// Outputs: true if every field of both annotations is equal
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+sameAnnotation
+  (
+  const upm::FaceAnnotation &expected,
+  const upm::FaceAnnotation &ann
+  )
+{
+  return (expected.filename == ann.filename) and (expected.bbox == ann.bbox) and
+         (expected.headpose.x == ann.headpose.x) and (expected.headpose.y == ann.headpose.y) and (expected.headpose.z == ann.headpose.z) and
+         (expected.parts == ann.parts) and (expected.attribute == ann.attribute) and (expected.attribute.fake == ann.attribute.fake);
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: encodes random annotations one by one and as a block
+// and checks that decoding returns them unchanged. Truncated records and
+// blocks must be rejected, leaving the output untouched.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+testAnnotationCodec()
+{
+  UPM_PRINT("Testing annotation codec ...");
+  cv::RNG rng(0);
+  std::vector<upm::FaceAnnotation> anns(16);
+  for (unsigned int i=0; i < anns.size(); i++)
+  {
+    upm::FaceAnnotation &ann = anns[i];
+    ann.filename = "test/image" + std::to_string(i) + ".png";
+    ann.bbox = {i, cv::Rect_<float>(rng.uniform(0.0f,100.0f), rng.uniform(0.0f,100.0f), rng.uniform(10.0f,200.0f), rng.uniform(10.0f,200.0f)), rng.uniform(0.0f,1.0f)};
+    ann.headpose = cv::Point3f(rng.uniform(-90.0f,90.0f), rng.uniform(-90.0f,90.0f), rng.uniform(-90.0f,90.0f));
+    ann.attribute = {rng.uniform(0.0f,1.0f), rng.uniform(0.0f,80.0f), rng.uniform(0.0f,1.0f), rng.uniform(0.0f,1.0f), rng.uniform(0.0f,1.0f), rng.uniform(0.0f,1.0f), rng.uniform(0.0f,1.0f)};
+    // Parts without landmarks and parts with a few, some occluded
+    for (upm::FacePart &part : ann.parts)
+      for (unsigned int j=0; j < (i+part.label) % 4; j++)
+        ann.parts[part.label].landmarks.push_back({static_cast<unsigned int>(100*part.label+j), cv::Point2f(rng.uniform(0.0f,300.0f), rng.uniform(0.0f,300.0f)), static_cast<float>(j % 2)});
+  }
+
+  // Single records, consumed exactly
+  bool passed = true;
+  for (unsigned int i=0; passed and (i < anns.size()); i++)
+  {
+    std::vector<unsigned char> record;
+    upm::FaceAnnotation ann;
+    passed = check(upm::encodeAnnotation(anns[i], record) and (record.size() == upm::getEncodedSize(anns[i])), "annotation encoded");
+    const unsigned char *data = record.data();
+    size_t size = record.size();
+    passed = passed and check(upm::decodeAnnotation(data, size, ann) and (size == 0) and sameAnnotation(anns[i], ann), "annotation decoded");
+    data = record.data();
+    size = record.size()-1;
+    passed = passed and check(not upm::decodeAnnotation(data, size, ann), "truncated annotation rejected");
+  }
+
+  // Blocks, including an empty one
+  for (unsigned int count : {0u, 1u, static_cast<unsigned int>(anns.size())})
+  {
+    const std::vector<upm::FaceAnnotation> block(anns.begin(), anns.begin()+count);
+    std::vector<unsigned char> buffer;
+    std::vector<upm::FaceAnnotation> decoded;
+    passed = passed and check(upm::encodeAnnotations(block, buffer) and upm::decodeAnnotations(buffer.data(), buffer.size(), decoded), "annotation block round trip");
+    passed = passed and check(decoded.size() == block.size(), "annotation block size");
+    for (unsigned int i=0; passed and (i < block.size()); i++)
+      passed = check(sameAnnotation(block[i], decoded[i]), "annotation block record");
+    passed = passed and check((not upm::decodeAnnotations(buffer.data(), buffer.size()-1, decoded)) and (decoded.size() == block.size()), "truncated annotation block rejected");
+  }
+  return passed;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: trains the scalar and product quantizers, restores
+// them from their serialized parameters and checks that the copy encodes and
+// decodes as the original. Truncated parameters must not be restored.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+testEmbeddingCodecs()
+{
+  UPM_PRINT("Testing embedding codecs ...");
+  const unsigned int dimension = 32, num_samples = 1000;
+  cv::RNG rng(0);
+  cv::Mat samples(num_samples, dimension, CV_32F);
+  rng.fill(samples, cv::RNG::NORMAL, 0, 1);
+  std::vector<boost::shared_ptr<upm::EmbeddingCodec> > codecs;
+  codecs.push_back(boost::shared_ptr<upm::EmbeddingCodec>(new upm::ScalarQuantizer()));
+  codecs.push_back(boost::shared_ptr<upm::EmbeddingCodec>(new upm::ProductQuantizer(8)));
+  bool passed = true;
+  for (const boost::shared_ptr<upm::EmbeddingCodec> &codec : codecs)
+  {
+    passed = passed and check(codec->train(samples, upm::GalleryMetric::l2), codec->getName() + " trained");
+    std::vector<unsigned char> buffer;
+    codec->serialize(buffer);
+    boost::shared_ptr<upm::EmbeddingCodec> restored = upm::EmbeddingCodec::deserialize(buffer.data(), buffer.size());
+    passed = passed and check(restored and (restored->getName() == codec->getName()) and (restored->getCodeSize() == codec->getCodeSize()), codec->getName() + " restored");
+    std::vector<unsigned char> code(codec->getCodeSize()), restored_code(codec->getCodeSize());
+    std::vector<float> decoded(dimension), restored_decoded(dimension);
+    for (unsigned int i=0; passed and (i < num_samples); i+=50)
+    {
+      codec->encode(samples.ptr<float>(i), code.data());
+      restored->encode(samples.ptr<float>(i), restored_code.data());
+      codec->decode(code.data(), decoded.data());
+      restored->decode(restored_code.data(), restored_decoded.data());
+      passed = check((code == restored_code) and (decoded == restored_decoded), codec->getName() + " restored codes");
+      // Decoding approximates the sample better than another sample does
+      const float *sample = samples.ptr<float>(i), *other = samples.ptr<float>((i+1) % num_samples);
+      float error = 0.0f, separation = 0.0f;
+      for (unsigned int j=0; j < dimension; j++)
+      {
+        error += (decoded[j]-sample[j])*(decoded[j]-sample[j]);
+        separation += (other[j]-sample[j])*(other[j]-sample[j]);
+      }
+      passed = passed and check(error < separation, codec->getName() + " decoded embedding");
+    }
+    passed = passed and check(not upm::EmbeddingCodec::deserialize(buffer.data(), buffer.size()-1), codec->getName() + " truncated parameters rejected");
+  }
+  return passed;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: enrolls random identities, replaces and removes some
+// and checks exact, approximate and quantized searches before and after
+// compaction.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats:
+//
+// -----------------------------------------------------------------------------
+static bool
+testGallery()
+{
+  UPM_PRINT("Testing gallery ...");
+  const unsigned int dimension = 32, num_identities = 1000, num_removed = 100;
+  cv::RNG rng(0);
+  cv::Mat embeddings(num_identities+1, dimension, CV_32F);
+  rng.fill(embeddings, cv::RNG::NORMAL, 0, 1);
+  upm::FaceGallery gallery(dimension);
+  gallery.enableIndex();
+  for (unsigned int i=0; i < num_identities; i++)
+    gallery.insert(static_cast<int>(i), embeddings.ptr<float>(i));
+  bool passed = check(gallery.setCodec(boost::shared_ptr<upm::EmbeddingCodec>(new upm::ProductQuantizer(8))), "gallery codec set");
+  gallery.setRerank(50);
+
+  // Every identity removed from the first ones, the last one replaced
+  const int replaced = static_cast<int>(num_identities)-1;
+  for (unsigned int i=0; i < num_removed; i++)
+    passed = passed and check(gallery.remove(static_cast<int>(i)), "identity removed");
+  passed = passed and check(not gallery.remove(0), "identity removed twice");
+  gallery.insert(replaced, embeddings.ptr<float>(num_identities));
+  passed = passed and check((gallery.size() == num_identities-num_removed) and (not gallery.contains(0)) and gallery.contains(replaced), "gallery identities");
+
+  std::vector<upm::GalleryMatch> expected, matches;
+  for (unsigned int pass=0; passed and (pass < 2); pass++)
+  {
+    // The second pass checks the compacted gallery
+    if (pass == 1)
+    {
+      gallery.compact();
+      passed = check(gallery.size() == num_identities-num_removed, "compacted gallery identities");
+    }
+    for (unsigned int i=0; passed and (i <= num_identities); i+=10)
+    {
+      // Removed identities are never returned, enrolled ones find themselves
+      const int id = (i < num_identities) ? static_cast<int>(i) : replaced;
+      const bool enrolled = (i >= num_removed) and (i != static_cast<unsigned int>(replaced));
+      gallery.searchExact(embeddings.ptr<float>(i), 10, expected);
+      passed = check(expected.size() == 10, "exact search size");
+      for (const upm::GalleryMatch &match : expected)
+        passed = passed and check((match.id >= static_cast<int>(num_removed)) and (match.id < static_cast<int>(num_identities)), "removed identity not returned");
+      passed = passed and check((expected[0].id == id) == enrolled, "exact search finds the identity");
+      if (not enrolled)
+        continue;
+      gallery.searchApproximate(embeddings.ptr<float>(i), 10, matches);
+      passed = passed and check((not matches.empty()) and (matches[0].id == id), "approximate search finds the identity");
+      gallery.searchQuantized(embeddings.ptr<float>(i), 10, 50, matches);
+      passed = passed and check((not matches.empty()) and (matches[0].id == id), "quantized search finds the identity");
+    }
+  }
+  return passed;
+};
+
+// -----------------------------------------------------------------------------
+//
+// Purpose and Method: writes a gallery, reopens it, appends to its log,
+// replays it, compacts it and checks every step against the gallery kept in
+// memory. Truncated files and files with a link out of the graph must be
+// rejected when opened.
+// Inputs:
+// Outputs:
+// Dependencies:
+// Restrictions and Caveats: the corrupt file relies on the header layout of
+// GalleryFile.cpp.
+//
+// -----------------------------------------------------------------------------
+static bool
+testGalleryFile()
+{
+  UPM_PRINT("Testing gallery files ...");
+  const unsigned int dimension = 32, num_identities = 500;
+  cv::RNG rng(0);
+  cv::Mat embeddings(num_identities+1, dimension, CV_32F);
+  rng.fill(embeddings, cv::RNG::NORMAL, 0, 1);
+  upm::FaceGallery gallery(dimension);
+  gallery.enableIndex();
+  std::unordered_map<int,std::string> metadata;
+  for (unsigned int i=0; i < num_identities; i++)
+  {
+    gallery.insert(static_cast<int>(i), embeddings.ptr<float>(i));
+    metadata[static_cast<int>(i)] = "identity" + std::to_string(i);
+  }
+  const boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  boost::filesystem::create_directories(dir);
+  const std::string path = (dir / "gallery.bin").string();
+  const int appended = static_cast<int>(num_identities);
+  std::vector<upm::GalleryMatch> expected, matches;
+
+  // Write and open: the mapped gallery answers as the original one
+  bool passed = check(upm::GalleryFile::write(path, gallery, metadata), "gallery written");
+  {
+    upm::GalleryFile file;
+    passed = passed and check(file.open(path), "gallery opened");
+    for (unsigned int i=0; passed and (i < num_identities); i+=25)
+    {
+      gallery.search(embeddings.ptr<float>(i), 5, expected);
+      file.getGallery()->search(embeddings.ptr<float>(i), 5, matches);
+      passed = check(sameMatches(expected, matches), "opened gallery search") and check(file.getMetadata(static_cast<int>(i)) == metadata[static_cast<int>(i)], "opened gallery metadata");
+    }
+    passed = passed and check(file.append(appended, embeddings.ptr<float>(appended), "appended") and file.remove(0), "log appended");
+  }
+  gallery.insert(appended, embeddings.ptr<float>(appended));
+  gallery.remove(0);
+
+  // Reopen: the log is replayed over the snapshot
+  for (unsigned int pass=0; passed and (pass < 2); pass++)
+  {
+    // The second pass checks the snapshot the log was folded into
+    if (pass == 1)
+      passed = check(upm::GalleryFile::compact(path), "gallery compacted");
+    upm::GalleryFile file;
+    passed = passed and check(file.open(path), "gallery reopened");
+    passed = passed and check((file.getGallery()->size() == gallery.size()) and (not file.getGallery()->contains(0)), "replayed identities");
+    passed = passed and check((file.getMetadata(appended) == "appended") and file.getMetadata(0).empty(), "replayed metadata");
+    for (unsigned int i=1; passed and (i <= num_identities); i+=25)
+    {
+      gallery.searchExact(embeddings.ptr<float>(i), 5, expected);
+      file.getGallery()->searchExact(embeddings.ptr<float>(i), 5, matches);
+      passed = check(sameMatches(expected, matches), "reopened gallery search");
+    }
+  }
+
+  // Corrupt copies are rejected instead of mapped
+  const std::string corrupt_path = (dir / "corrupt.bin").string();
+  boost::system::error_code error;
+  boost::filesystem::copy_file(path, corrupt_path, error);
+  boost::filesystem::resize_file(corrupt_path, boost::filesystem::file_size(path)/2, error);
+  {
+    upm::GalleryFile file;
+    passed = passed and check((not error) and (not file.open(corrupt_path)), "truncated gallery rejected");
+  }
+  boost::filesystem::remove(corrupt_path, error);
+  boost::filesystem::copy_file(path, corrupt_path, error);
+  {
+    // The graph block offset is the last of the 8 following the 64 bytes of
+    // header fields, the first link of the first slot follows its level and
+    // link counts
+    std::fstream stream(corrupt_path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    unsigned long long graph_offset = 0;
+    stream.seekg(64 + 7*sizeof(unsigned long long));
+    stream.read(reinterpret_cast<char*>(&graph_offset), sizeof(graph_offset));
+    const unsigned int bad_link = 2*num_identities;
+    stream.seekp(graph_offset + 2*sizeof(unsigned int));
+    stream.write(reinterpret_cast<const char*>(&bad_link), sizeof(bad_link));
+    passed = passed and check((not error) and stream.good(), "bad link written");
+  }
+  {
+    upm::GalleryFile file;
+    passed = passed and check(not file.open(corrupt_path), "gallery with a bad link rejected");
+  }
+  boost::filesystem::remove_all(dir, error);
+  return passed;
+};
 
 // -----------------------------------------------------------------------------
 //
@@ -32,6 +385,9 @@ main
   char **argv
   )
 {
+  if ((not testAnnotationCodec()) or (not testEmbeddingCodecs()) or (not testGallery()) or (not testGalleryFile()))
+    return EXIT_FAILURE;
+
   // Read sample annotations
   UPM_PRINT("Processing from a video file ...");
   cv::VideoCapture capture;
@@ -67,6 +423,7 @@ main
 //    showResults(viewer, ticks, 20, frame, composite, faces, ann);
   }
 
+  UPM_TRACE_EXPORT("faces_framework_test_trace.json");
   UPM_PRINT("End of faces_framework_test");
   return EXIT_SUCCESS;
 };